@@ -0,0 +1,220 @@
+//! \file
+//! \brief Compares inlined and compact method wrappers (see lc_compact.hpp): code size and call latency.
+//!
+//! Generates LC_BENCH_CLASSES classes with the same handful of typical methods each, then times
+//! calls to every method from Lua. Calls are spread over all of the classes, like they would be in
+//! a big API, so that wrappers compete for the instruction cache. Build it once as is and once with
+//! LC_COMPACT_BINDINGS defined; scripts/call_bench.sh does both and reports the sizes too.
+//!
+//! "call_bench generational" switches Lua 5.4's collector to generational mode first, which mostly
+//! shows in the allocating case. scripts/lua_versions_bench.sh compares Lua 5.3 and 5.4 builds.
+//!
+//! The array case converts a table with lc::ScratchArray (see lc_scratch.hpp), and the scratch
+//! arena's high water mark and size are printed at the end; it only grows on the first calls.
+//!
+//! It's also an example of recording and replaying calls (see lc_record.hpp):
+//! - "call_bench record calls.lcr", built with LC_RECORD_CALLS, dumps the last calls the script made.
+//! - "call_bench replay calls.lcr" makes the calls from a dump again, instead of running the script.
+//!
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <lc/lc.hpp>
+#include <lc/lc_gc.hpp>
+#include <lc/lc_record.hpp>
+#include <lc/lc_scratch.hpp>
+
+#ifndef LC_BENCH_CLASSES
+#define LC_BENCH_CLASSES 100
+#endif
+
+#ifndef LC_BENCH_CALLS
+#define LC_BENCH_CALLS 2000000
+#endif
+
+#ifndef LC_BENCH_RECORDED_CALLS
+#define LC_BENCH_RECORDED_CALLS (1 << 18)
+#endif
+
+namespace
+{
+
+constexpr std::size_t numClasses = LC_BENCH_CLASSES;
+
+enum class Channel
+{
+    RED,
+    GREEN,
+    BLUE
+};
+
+template <std::size_t Index_>
+struct BenchClass
+{
+    using Next = BenchClass<(Index_ + 1) % numClasses>;
+
+    int64_t value = (int64_t)Index_;
+    double scale = 1.0;
+    Channel channel = Channel::RED;
+
+    int64_t get() { return value; }
+    int add(int a, int b) { return (int)value + a + b; }
+    double mul(double x, float y) { return x * y * scale; }
+    void set(int64_t v, bool flag) { value = flag ? v : -v; }
+    void tint(Channel c) { channel = c; }
+    uint32_t link(Next* next, uint32_t amount) { return (uint32_t)(next->value + amount); }
+
+    double sum(lc::ScratchArray<double> values)
+    {
+        double result = 0.0;
+        for (double x : values) result += x;
+        return result * scale;
+    }
+
+    double dot(lc::ScratchArray<double> a, lc::ScratchArray<double> b)
+    {
+        double result = 0.0;
+        for (std::size_t i = 0; i < a.size() && i < b.size(); i++) result += a[i] * b[i];
+        return result * scale;
+    }
+};
+
+template <typename Types_, std::size_t... Indices_>
+void add_methods(Types_& types, lc::detail::IndexSequence<Indices_...>)
+{
+    using Expand = int[];
+    (void)Expand{0, (types.template at<BenchClass<Indices_>>().set_constructor(lc::Constructor<>()), 0)...};
+    (void)Expand{0, (types.template at<BenchClass<Indices_>>().add_methods(
+                         LC_METHOD("get", &BenchClass<Indices_>::get),
+                         LC_METHOD("add", &BenchClass<Indices_>::add),
+                         LC_METHOD("mul", &BenchClass<Indices_>::mul),
+                         LC_METHOD("set", &BenchClass<Indices_>::set),
+                         LC_METHOD("tint", &BenchClass<Indices_>::tint),
+                         LC_METHOD("link", &BenchClass<Indices_>::link),
+                         LC_METHOD("sum", &BenchClass<Indices_>::sum),
+                         LC_METHOD("dot", &BenchClass<Indices_>::dot)), 0)...};
+}
+
+template <typename>
+struct MakeBenchTypes;
+
+template <std::size_t... Indices_>
+struct MakeBenchTypes<lc::detail::IndexSequence<Indices_...>>
+{
+    using Type = lc::TypeSet<lc::Enum<Channel>, lc::Class<BenchClass<Indices_>>...>;
+};
+
+struct BenchTypes : MakeBenchTypes<typename lc::detail::BuildIndexSequence<numClasses>::Type>::Type {};
+
+char classNames[numClasses][16];
+
+template <typename Api_, std::size_t... Indices_>
+void set_types(Api_& api, lc::detail::IndexSequence<Indices_...> indices)
+{
+    for (std::size_t i = 0; i < numClasses; i++)
+        snprintf(classNames[i], sizeof(classNames[i]), "C%d", (int)i);
+
+    auto& types = api.template set_types<BenchTypes>("Channel", classNames[Indices_]...);
+    types.template at<Channel>().add_values(
+        lc::enum_value("RED", Channel::RED),
+        lc::enum_value("GREEN", Channel::GREEN),
+        lc::enum_value("BLUE", Channel::BLUE)
+    );
+    add_methods(types, indices);
+}
+
+// Makes one instance of each class, then times each method over all of them.
+char const* const benchScript = R"lua(
+local api, n, calls = ...
+local objs = {}
+for i = 1, n do objs[i] = api["C" .. (i - 1)]() end
+
+local blue = api.Channel.BLUE
+local values = {1, 2, 3, 4, 5, 6, 7, 8}
+local cases = {
+    { "get()",         function(o) return o:get() end },
+    { "add(int, int)", function(o) return o:add(1, 2) end },
+    { "mul(double, float)", function(o) return o:mul(1.5, 2.0) end },
+    { "set(int64, bool)", function(o) return o:set(7, true) end },
+    { "tint(enum)",    function(o) return o:tint(blue) end },
+    { "link(class, uint)", function(o, next) return o:link(next, 3) end },
+    { "sum(array of 8)",  function(o) return o:sum(values) end },
+    { "dot(2 arrays of 8)", function(o) return o:dot(values, values) end },
+    { "new instance",  function(o) return api.C0() end },
+}
+for _, case in ipairs(cases) do
+    local f = case[2]
+    local start = os.clock()
+    for i = 1, calls do f(objs[i % n + 1], objs[(i + 1) % n + 1]) end
+    print(string.format("%-20s %8.1f ns/call", case[1], (os.clock() - start) * 1e9 / calls))
+end
+)lua";
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    char const* mode = argc > 2 ? argv[1] : "";
+    char const* path = argc > 2 ? argv[2] : nullptr;
+
+    auto api = lc::make_api("BenchApi");
+    set_types(api, typename lc::detail::BuildIndexSequence<numClasses>::Type{});
+
+    lua_State* L = luaL_newstate();
+    luaL_openlibs(L);
+    api.export_to(L);
+
+    bool generational = argc == 2 && strcmp(argv[1], "generational") == 0;
+    if (generational && !lc::set_gc_mode(L, lc::GcMode::GENERATIONAL)) {
+        printf("%s has no generational collector.\n", LUA_RELEASE);
+        generational = false;
+    }
+
+#if defined(LC_COMPACT_BINDINGS)
+    printf("%s, compact wrappers, %d classes", LUA_RELEASE, (int)numClasses);
+#else
+    printf("%s, inlined wrappers, %d classes", LUA_RELEASE, (int)numClasses);
+#endif
+    printf(generational ? ", generational GC\n" : "\n");
+
+    if (strcmp(mode, "replay") == 0) {
+        lc::CallLog log;
+        if (!log.load(path)) {
+            printf("Error: couldn't load %s\n", path);
+            lua_close(L);
+            return EXIT_FAILURE;
+        }
+
+        lc::ReplayStats stats = log.replay(L, api);
+        printf("replayed %d calls(%d failed, %d skipped): %.1f ns/call\n", (int)stats.calls, (int)stats.failed,
+               (int)stats.skipped, stats.calls ? stats.seconds * 1e9 / stats.calls : 0.0);
+        lua_close(L);
+        return EXIT_SUCCESS;
+    }
+
+    lc::CallRecorder recorder(LC_BENCH_RECORDED_CALLS);
+    bool record = strcmp(mode, "record") == 0;
+#if !defined(LC_RECORD_CALLS)
+    if (record) printf("Built without LC_RECORD_CALLS, so nothing will be recorded.\n");
+#endif
+    if (record) recorder.attach(L);
+
+    if (luaL_loadstring(L, benchScript) == LUA_OK) {
+        lua_getglobal(L, "BenchApi");
+        lua_pushinteger(L, (lua_Integer)numClasses);
+        lua_pushinteger(L, LC_BENCH_CALLS);
+        lua_pcall(L, 3, 0, 0);
+    }
+    if (lua_gettop(L)) printf("Error: %s\n", lua_tostring(L, -1));
+
+    lc::ScratchStats scratch = lc::scratch_stats(L);
+    printf("scratch arena: %d bytes high water mark, %d bytes allocated\n",
+           (int)scratch.highWaterMark, (int)scratch.capacity);
+    lua_close(L);
+
+    if (record && !recorder.dump(path)) {
+        printf("Error: couldn't write %s\n", path);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
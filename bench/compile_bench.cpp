@@ -0,0 +1,87 @@
+//! \file
+//! \brief Generates an API with LC_BENCH_TYPES types, to measure how compile time and binary size scale.
+//!
+//! Every type has a constructor and a method that takes the previous type and returns the next one,
+//! so each one goes through the exporters and through the stack managers' type lookups.
+//! The type list is named with lc::TypeSet, as big APIs should do.
+//! Use scripts/compile_bench.sh to build it at several sizes, or projectfiles/compile_bench.pro.
+//!
+#include <cstdio>
+#include <cstdlib>
+#include <lc/lc.hpp>
+
+#ifndef LC_BENCH_TYPES
+#define LC_BENCH_TYPES 200
+#endif
+
+namespace
+{
+
+constexpr std::size_t numTypes = LC_BENCH_TYPES;
+
+template <std::size_t Index_>
+struct BenchType
+{
+    using Prev = BenchType<(Index_ + numTypes - 1) % numTypes>;
+    using Next = BenchType<(Index_ + 1) % numTypes>;
+
+    int value = (int)Index_;
+
+    Next* step(Prev* prev, int amount)
+    {
+        value += prev ? prev->value + amount : amount;
+        return lc::HeapFactory<Next>::make();
+    }
+};
+
+template <typename Types_, std::size_t... Indices_>
+void add_methods(Types_& types, lc::detail::IndexSequence<Indices_...>)
+{
+    using Expand = int[];
+    (void)Expand{0, (types.template at<BenchType<Indices_>>().set_constructor(lc::Constructor<>()), 0)...};
+    (void)Expand{0, (types.template at<BenchType<Indices_>>().add_methods(
+                         LC_METHOD("step", &BenchType<Indices_>::step)), 0)...};
+}
+
+template <typename>
+struct MakeBenchTypes;
+
+template <std::size_t... Indices_>
+struct MakeBenchTypes<lc::detail::IndexSequence<Indices_...>>
+{
+    using Type = lc::TypeSet<lc::Class<BenchType<Indices_>>...>;
+};
+
+struct BenchTypes : MakeBenchTypes<typename lc::detail::BuildIndexSequence<numTypes>::Type>::Type {};
+
+template <typename Api_, std::size_t... Indices_>
+void set_types(Api_& api, lc::detail::IndexSequence<Indices_...> indices)
+{
+    // Scripts only ever use the first type and the last one (the first one's Prev), so the rest can share a name.
+    auto& types = api.template set_types<BenchTypes>((Indices_ == 0 ? "First" : Indices_ + 1 == numTypes ? "Last" : "T")...);
+    add_methods(types, indices);
+}
+
+} // namespace
+
+int main()
+{
+    auto api = lc::make_api("BenchApi");
+    set_types(api, typename lc::detail::BuildIndexSequence<numTypes>::Type{});
+
+    lua_State* L = luaL_newstate();
+    luaL_openlibs(L);
+    api.export_to(L);
+
+    // With a single type, it's its own Prev.
+    if (luaL_dostring(L, "local a = BenchApi.First() return a:step((BenchApi.Last or BenchApi.First)(), 1)")) {
+        printf("Error: %s\n", lua_tostring(L, -1));
+        lua_close(L);
+        return EXIT_FAILURE;
+    }
+    printf("Result: %s\n", luaL_typename(L, -1));
+    lua_close(L);
+
+    printf("Exported %d types\n", (int)numTypes);
+    return EXIT_SUCCESS;
+}
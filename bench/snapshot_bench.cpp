@@ -0,0 +1,175 @@
+//! \file
+//! \brief Measures how fast snapshots (see lc_snapshot.hpp) save and restore big value graphs.
+//!
+//! A script builds a linked list of LC_BENCH_NODES tables. Every tenth node also holds an instance
+//! of a bound class with a serializer and an enum class value, and every node refers to the same
+//! few strings and to the node before it, so the snapshot has shared references and cycles too.
+//! The graph is saved into a std::string, restored, and walked again to check that nothing's missing.
+//!
+//! "snapshot_bench 5000000" overrides the number of nodes.
+//!
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <lc/lc.hpp>
+#include <lc/lc_snapshot.hpp>
+
+#ifndef LC_BENCH_NODES
+#define LC_BENCH_NODES 1000000
+#endif
+
+namespace
+{
+
+enum class Kind
+{
+    ROCK,
+    TREE,
+    WATER
+};
+
+struct Item
+{
+    int64_t id = 0;
+    double weight = 1.0;
+
+    int64_t get_id() { return id; }
+};
+
+void save_item(const Item& item, lc::SnapshotWriter& writer)
+{
+    writer.write_integer(item.id);
+    writer.write_number(item.weight);
+}
+
+Item* load_item(lc::SnapshotReader& reader)
+{
+    Item* item = new Item();
+    item->id = reader.read_integer();
+    item->weight = reader.read_number();
+    return item;
+}
+
+using BenchTypes = lc::TypeSet<lc::Enum<Kind>, lc::Class<Item>>;
+
+// Returns the head of the list.
+char const* const buildScript = R"lua(
+local api, n = ...
+local kinds = { api.Kind.ROCK, api.Kind.TREE, api.Kind.WATER }
+local labels = { "small", "medium", "large" }
+local head
+for i = 1, n do
+    local node = { index = i, label = labels[i % 3 + 1], next = head }
+    if head then head.prev = node end
+    if i % 10 == 0 then
+        node.item = api.Item()
+        node.kind = kinds[i % 3 + 1]
+    end
+    head = node
+end
+return head
+)lua";
+
+// Returns the number of nodes and items reachable from the head.
+char const* const countScript = R"lua(
+local node = ...
+local nodes, items = 0, 0
+while node do
+    nodes = nodes + 1
+    if node.item then items = items + 1 end
+    node = node.next
+end
+return nodes, items
+)lua";
+
+double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+//! Runs script with the numArgs values on top of the stack as its arguments.
+bool run(lua_State* L, char const* script, int numArgs, int numResults)
+{
+    if (luaL_loadstring(L, script) != LUA_OK) return false;
+    lua_insert(L, -numArgs - 1);
+    return lua_pcall(L, numArgs, numResults, 0) == LUA_OK;
+}
+
+} // namespace
+
+int main(int argc, char** argv)
+{
+    lua_Integer numNodes = argc > 1 ? (lua_Integer)strtoll(argv[1], nullptr, 10) : LC_BENCH_NODES;
+
+    auto api = lc::make_api("BenchApi");
+    auto& types = api.set_types<BenchTypes>("Kind", "Item");
+    types.at<Kind>().add_values(
+        lc::enum_value("ROCK", Kind::ROCK),
+        lc::enum_value("TREE", Kind::TREE),
+        lc::enum_value("WATER", Kind::WATER)
+    );
+    types.at<Item>().set_constructor(lc::Constructor<>());
+    types.at<Item>().add_methods(LC_METHOD("id", &Item::get_id));
+    types.at<Item>().set_serializer(&save_item, &load_item);
+
+    lua_State* L = luaL_newstate();
+    luaL_openlibs(L);
+    api.export_to(L);
+
+    printf("%s, %lld nodes\n", LUA_RELEASE, (long long)numNodes);
+
+    lua_getglobal(L, "BenchApi");
+    lua_pushinteger(L, numNodes);
+    if (!run(L, buildScript, 2, 1)) {
+        printf("Error: %s\n", lua_tostring(L, -1));
+        lua_close(L);
+        return EXIT_FAILURE;
+    }
+    int root = lua_gettop(L);
+
+    std::string snapshot;
+    auto start = std::chrono::steady_clock::now();
+    int status;
+    {
+        lc::SnapshotWriter writer(&lc::SnapshotWriter::string_sink, &snapshot);
+        status = lc::save_snapshot(L, root, api, writer);
+    }
+    double saveSeconds = seconds_since(start);
+    if (status != LUA_OK) {
+        printf("Error saving: %s\n", lua_tostring(L, -1));
+        lua_close(L);
+        return EXIT_FAILURE;
+    }
+
+    // The original graph goes before restoring, so that both sides run with a similar heap.
+    lua_settop(L, 0);
+    lua_gc(L, LUA_GCCOLLECT, 0);
+
+    start = std::chrono::steady_clock::now();
+    lc::SnapshotReader reader(snapshot.data(), snapshot.size());
+    status = lc::restore_snapshot(L, api, reader);
+    double restoreSeconds = seconds_since(start);
+    if (status != LUA_OK) {
+        printf("Error restoring: %s\n", lua_tostring(L, -1));
+        lua_close(L);
+        return EXIT_FAILURE;
+    }
+
+    if (!run(L, countScript, 1, 2)) {
+        printf("Error: %s\n", lua_tostring(L, -1));
+        lua_close(L);
+        return EXIT_FAILURE;
+    }
+    lua_Integer nodes = lua_tointeger(L, -2);
+    lua_Integer items = lua_tointeger(L, -1);
+
+    printf("snapshot: %.1f MB\n", snapshot.size() / (1024.0 * 1024.0));
+    printf("save:     %.3f s, %.2fM nodes/s\n", saveSeconds, numNodes / saveSeconds * 1e-6);
+    printf("restore:  %.3f s, %.2fM nodes/s\n", restoreSeconds, numNodes / restoreSeconds * 1e-6);
+    printf("restored %lld nodes and %lld items, expected %lld and %lld\n",
+           (long long)nodes, (long long)items, (long long)numNodes, (long long)(numNodes / 10));
+
+    lua_close(L);
+    return nodes == numNodes && items == numNodes / 10 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -4,9 +4,12 @@
 #include <cassert>
 #include <cstdint>
 
-#define LUA_COMPAT_APIINTCASTS
 #include <lua.hpp>
 
+#if LUA_VERSION_NUM < 503
+    #error "(LC): LuaCat needs Lua 5.3 or 5.4."
+#endif
+
 //! Force inline macro for all of the small functions
 //! that would make debug builds with no inlining substantially slower.
 //!
@@ -18,6 +21,17 @@
     #define LC_FORCE_INLINE inline
 #endif
 
+//! The opposite, for shared code that every wrapper calls, which would otherwise
+//! be copied into each of them by the optimizer.
+//!
+#if defined(__MSC_VER)
+    #define LC_NOINLINE __declspec(noinline)
+#elif defined(__clang__) || defined(__GNUC__)
+    #define LC_NOINLINE __attribute__((noinline))
+#else
+    #define LC_NOINLINE
+#endif
+
 
 namespace lc
 {
@@ -29,6 +43,37 @@ using TypeId = uint16_t;
 // Does this matter practically? No. Will I do it anyway? Yes...
 using Byte = unsigned char;
 
+//! What differs between the Lua versions that LuaCat supports, 5.3 and 5.4.
+namespace detail
+{
+
+//! Makes a full userdata with room for the given number of user values. Lua 5.3 userdata always
+//! have one; in 5.4, ones that never need a user value (enum class values, say) are smaller without.
+//!
+LC_FORCE_INLINE void* new_userdata(lua_State* L, std::size_t size, int numUserValues)
+{
+#if LUA_VERSION_NUM >= 504
+    return lua_newuserdatauv(L, size, numUserValues);
+#else
+    (void)numUserValues;
+    return lua_newuserdata(L, size);
+#endif
+}
+
+//! lua_resume, with 5.4's signature.
+LC_FORCE_INLINE int resume(lua_State* thread, lua_State* from, int numArgs, int* numResults)
+{
+#if LUA_VERSION_NUM >= 504
+    return lua_resume(thread, from, numArgs, numResults);
+#else
+    int status = lua_resume(thread, from, numArgs);
+    *numResults = lua_gettop(thread);
+    return status;
+#endif
+}
+
+} // namespace detail
+
 } // namespace lc
 
 
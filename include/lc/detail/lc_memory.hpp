@@ -0,0 +1,146 @@
+#ifndef LC_MEMORY_HPP
+#define LC_MEMORY_HPP
+
+#include <climits>
+#include <cstddef>
+#include <lc/detail/lc_common.hpp>
+
+//! \file
+//! \brief Tells the garbage collector about memory that bound instances hold outside of Lua.
+//!
+//! Lua only sees the few bytes of userdata that point to an instance, so by default it has no idea
+//! that collecting it would free, say, a texture. Types with an lc::NativeSize specialization have
+//! their size added to their state's total when they're pushed, and removed again by __gc.
+//! Every KB added makes the collector do as much work as a KB allocated by Lua would.
+//!
+
+namespace lc
+{
+
+//! Specialize this to report how much memory an instance of T_ owns outside of Lua, e.g.
+//!
+//!     template <> struct lc::NativeSize<Image>
+//!     {
+//!         static constexpr bool enabled = true;
+//!         static std::size_t of(const Image& image) { return image.width() * image.height() * 4; }
+//!     };
+//!
+//! of() is called when an instance is pushed and again when it's collected, so it should
+//! return the same size both times; if it doesn't, the state's total is only an estimate.
+//!
+template <typename T_>
+struct NativeSize
+{
+    static constexpr bool enabled = false;
+    static std::size_t of(const T_&) { return 0; }
+};
+
+namespace detail
+{
+
+//! Per-state accounting, kept in a userdata in the registry.
+struct NativeMemory
+{
+    std::size_t total;
+    std::size_t unreported; // Less than a KB that hasn't been passed on to the collector yet.
+
+    static void* key()
+    {
+        static char key;
+        return &key;
+    }
+};
+
+inline NativeMemory* native_memory(lua_State* L, bool create)
+{
+    lua_rawgetp(L, LUA_REGISTRYINDEX, NativeMemory::key());
+    NativeMemory* memory = (NativeMemory*)lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    if (memory || !create) return memory;
+
+    memory = (NativeMemory*)new_userdata(L, sizeof(NativeMemory), 0);
+    memory->total = 0;
+    memory->unreported = 0;
+    lua_rawsetp(L, LUA_REGISTRYINDEX, NativeMemory::key());
+    return memory;
+}
+
+//! Adds to L's total and makes the collector step for every whole KB.
+//! May run finalizers, like any allocation would.
+//!
+inline void add_native_memory(lua_State* L, std::size_t bytes)
+{
+    if (bytes == 0) return;
+
+    NativeMemory* memory = native_memory(L, true);
+    memory->total += bytes;
+    memory->unreported += bytes;
+    if (memory->unreported < 1024) return;
+
+    std::size_t kb = memory->unreported / 1024;
+    if (kb > INT_MAX) kb = INT_MAX;
+    memory->unreported -= kb * 1024;
+
+    // Stepping would restart a collector that was stopped on purpose.
+    if (lua_gc(L, LUA_GCISRUNNING, 0)) lua_gc(L, LUA_GCSTEP, (int)kb);
+}
+
+//! Never touches the collector, so it's safe to call from __gc.
+inline void remove_native_memory(lua_State* L, std::size_t bytes)
+{
+    NativeMemory* memory = bytes ? native_memory(L, false) : nullptr;
+    if (!memory) return;
+
+    memory->total = bytes < memory->total ? memory->total - bytes : 0;
+}
+
+//! Type-erased NativeSize<T_>::of, stored in instance metatables for code that
+//! only has an instance pointer and its metatable (channels, snapshots).
+//!
+struct NativeSizeHook
+{
+    std::size_t (*of)(const void* instance);
+
+    static void* key()
+    {
+        static char key;
+        return &key;
+    }
+};
+
+template <typename T_>
+std::size_t native_size_of(const void* instance)
+{
+    return NativeSize<T_>::of(*(const T_*)instance);
+}
+
+template <typename T_>
+const NativeSizeHook* native_size_hook()
+{
+    static const NativeSizeHook hook = {&native_size_of<T_>};
+    return &hook;
+}
+
+//! Native size of an instance, going by the hook in the instance metatable at metatableIndex.
+inline std::size_t native_size(lua_State* L, int metatableIndex, const void* instance)
+{
+    lua_rawgetp(L, metatableIndex, NativeSizeHook::key());
+    const NativeSizeHook* hook = (const NativeSizeHook*)lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    return hook ? hook->of(instance) : 0;
+}
+
+} // namespace detail
+
+//! How many bytes of native memory are held by the instances that are alive in L,
+//! as reported by their lc::NativeSize specializations.
+//!
+inline std::size_t native_memory(lua_State* L)
+{
+    const detail::NativeMemory* memory = detail::native_memory(L, false);
+    return memory ? memory->total : 0;
+}
+
+} // namespace lc
+
+#endif // LC_MEMORY_HPP
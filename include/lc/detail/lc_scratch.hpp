@@ -0,0 +1,257 @@
+#ifndef LC_SCRATCH_DETAIL_HPP
+#define LC_SCRATCH_DETAIL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <vector>
+#include <lc/detail/lc_common.hpp>
+
+//! \file
+//! \brief The per-state bump allocator that argument conversions take their temporaries from.
+//!
+//! Wrappers whose signatures have arguments that allocate (see lc_scratch.hpp) are called through
+//! call_in_scratch_scope(), which opens a ScratchScope, and everything allocated from then on is given back when
+//! it closes. Blocks are kept, so once the arena has grown to fit the biggest call, calls don't allocate.
+//!
+//! luaL_error() longjmps past the scope's destructor, and so does yielding. Scopes are remembered with
+//! their address, which is the same for all calls made from the same place, so the next scope that
+//! opens at the same depth or above knows that the ones at or below it are gone, and gives back what
+//! they allocated first. (This assumes that the stack grows down and that Lua code runs on the
+//! thread's own stack, which is true of Lua's coroutines.)
+//!
+
+namespace lc
+{
+namespace detail
+{
+
+struct ScratchBlock
+{
+    ScratchBlock* next;
+    std::size_t size;
+
+    Byte* data() { return (Byte*)(this + 1); }
+
+    //! \returns Null if it couldn't be allocated.
+    static ScratchBlock* make(std::size_t size, ScratchBlock* next)
+    {
+        ScratchBlock* block = (ScratchBlock*)std::malloc(sizeof(ScratchBlock) + size);
+        if (!block) return nullptr;
+        block->next = next;
+        block->size = size;
+        return block;
+    }
+};
+
+class ScratchArena
+{
+public:
+    static constexpr std::size_t default_block_size() { return 4096; }
+
+    ScratchArena() : first_(nullptr), current_(nullptr), offset_(0), used_(0), highWaterMark_(0), capacity_(0)
+    {
+        marks_.reserve(16);
+    }
+
+    ScratchArena(const ScratchArena&) = delete;
+    ScratchArena& operator=(const ScratchArena&) = delete;
+
+    ~ScratchArena()
+    {
+        free_blocks();
+    }
+
+    static void* key()
+    {
+        static char key;
+        return &key;
+    }
+
+    //! Whether a scope is open, i.e. whether allocations will be given back.
+    bool in_scope() const { return !marks_.empty(); }
+
+    std::size_t used() const { return used_; }
+    std::size_t high_water_mark() const { return highWaterMark_; }
+    std::size_t capacity() const { return capacity_; }
+
+    void reset_high_water_mark() { highWaterMark_ = used_; }
+
+    //! \returns Null if a new block was needed and couldn't be allocated.
+    LC_FORCE_INLINE void* allocate(std::size_t size, std::size_t alignment)
+    {
+        if (current_) {
+            std::uintptr_t start = (std::uintptr_t)(current_->data() + offset_);
+            std::uintptr_t aligned = (start + alignment - 1) & ~(std::uintptr_t)(alignment - 1);
+            std::size_t end = (std::size_t)(aligned - (std::uintptr_t)current_->data()) + size;
+            if (end <= current_->size) {
+                add_used(end - offset_);
+                offset_ = end;
+                return (void*)aligned;
+            }
+        }
+        return allocate_from_next_block(size, alignment);
+    }
+
+    //! Makes sure that calls needing up to the given number of bytes fit without allocating.
+    void reserve(std::size_t bytes)
+    {
+        if (capacity_ >= bytes) return;
+        if (in_scope()) {
+            ScratchBlock** last = &first_;
+            while (*last) last = &(*last)->next;
+            *last = ScratchBlock::make(bytes - capacity_, nullptr);
+            if (*last) capacity_ = bytes;
+        }
+        else {
+            coalesce(bytes);
+        }
+    }
+
+    void enter(std::uintptr_t frame)
+    {
+        // Scopes at or below this frame were closed by a longjmp.
+        while (!marks_.empty() && marks_.back().frame <= frame) rewind();
+        marks_.push_back(Mark{frame, current_, offset_, used_});
+    }
+
+    void leave(std::uintptr_t frame)
+    {
+        // Scopes above ours in the list were closed by a longjmp that our method caught.
+        while (marks_.back().frame != frame) marks_.pop_back();
+        rewind();
+
+        // The biggest call so far didn't fit in one block, so make one that it fits in.
+        if (marks_.empty() && first_ && first_->next) coalesce(capacity_);
+    }
+
+private:
+    struct Mark
+    {
+        std::uintptr_t frame;
+        ScratchBlock* block;
+        std::size_t offset;
+        std::size_t used;
+    };
+
+    LC_FORCE_INLINE void add_used(std::size_t bytes)
+    {
+        used_ += bytes;
+        if (used_ > highWaterMark_) highWaterMark_ = used_;
+    }
+
+    LC_NOINLINE void* allocate_from_next_block(std::size_t size, std::size_t alignment)
+    {
+        ScratchBlock* next = current_ ? current_->next : first_;
+        std::size_t needed = size + alignment - 1;
+        if (!next || next->size < needed) {
+            std::size_t blockSize = current_ ? current_->size * 2 : default_block_size();
+            if (blockSize < needed) blockSize = needed;
+            next = ScratchBlock::make(blockSize, next);
+            if (!next) return nullptr;
+            if (current_) current_->next = next;
+            else first_ = next;
+            capacity_ += blockSize;
+        }
+
+        // What was left of the current block counts as used until the scope closes.
+        if (current_) add_used(current_->size - offset_);
+        current_ = next;
+        offset_ = 0;
+        return allocate(size, alignment);
+    }
+
+    void rewind()
+    {
+        const Mark& mark = marks_.back();
+        current_ = mark.block;
+        offset_ = mark.offset;
+        used_ = mark.used;
+        marks_.pop_back();
+    }
+
+    //! Replaces the blocks with a single one. Only done when nothing is allocated.
+    void coalesce(std::size_t size)
+    {
+        free_blocks();
+        first_ = ScratchBlock::make(size, nullptr);
+        if (first_) capacity_ = size;
+    }
+
+    void free_blocks()
+    {
+        while (first_) {
+            ScratchBlock* next = first_->next;
+            std::free(first_);
+            first_ = next;
+        }
+        current_ = nullptr;
+        offset_ = 0;
+        capacity_ = 0;
+    }
+
+private:
+    ScratchBlock* first_;
+    ScratchBlock* current_; // Null until the first allocation, and again after scopes have closed.
+    std::size_t offset_;    // Into current_.
+    std::size_t used_;
+    std::size_t highWaterMark_;
+    std::size_t capacity_;
+    std::vector<Mark> marks_; // One per open scope, innermost last.
+};
+
+inline int scratch_arena_gc(lua_State* L)
+{
+    ((ScratchArena*)lua_touserdata(L, 1))->~ScratchArena();
+    return 0;
+}
+
+//! L's arena, kept in a userdata in the registry.
+inline ScratchArena* scratch_arena(lua_State* L, bool create)
+{
+    lua_rawgetp(L, LUA_REGISTRYINDEX, ScratchArena::key());
+    ScratchArena* arena = (ScratchArena*)lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    if (arena || !create) return arena;
+
+    arena = new (new_userdata(L, sizeof(ScratchArena), 0)) ScratchArena();
+    lua_createtable(L, 0, 1);
+    lua_pushcfunction(L, &scratch_arena_gc);
+    lua_setfield(L, -2, "__gc");
+    lua_setmetatable(L, -2);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, ScratchArena::key());
+    return arena;
+}
+
+//! Gives back everything allocated from L's arena while it's open.
+class ScratchScope
+{
+public:
+    explicit ScratchScope(lua_State* L) : arena_(scratch_arena(L, true)) { arena_->enter((std::uintptr_t)this); }
+    ~ScratchScope() { arena_->leave((std::uintptr_t)this); }
+
+    ScratchScope(const ScratchScope&) = delete;
+    ScratchScope& operator=(const ScratchScope&) = delete;
+
+private:
+    ScratchArena* arena_;
+};
+
+//! Calls a wrapper with a scope open. Every scope is opened here, by this one function, so that
+//! calls made from the same place have theirs at the same address. The wrapper is passed in a
+//! way that keeps the compiler from making copies of the function specialized for it.
+//!
+LC_NOINLINE inline int call_in_scratch_scope(lua_State* L, lua_CFunction call)
+{
+    ScratchScope scope(L);
+    return call(L);
+}
+
+//! Stack managers that allocate from the arena in at() derive from this.
+struct ScratchStackManager {};
+
+} // namespace detail
+} // namespace lc
+
+#endif // LC_SCRATCH_DETAIL_HPP
@@ -2,8 +2,11 @@
 #define LG_STACK_HPP
 
 #include <cstdint>
+#include <cstring>
 #include <type_traits>
 #include <lc/detail/lc_common.hpp>
+#include <lc/detail/lc_memory.hpp>
+#include <lc/detail/lc_scratch.hpp>
 #include <lc/detail/lc_utility.hpp>
 
 //! \file
@@ -12,6 +15,9 @@
 
 namespace lc
 {
+
+class DirectorBase; // lc_director.hpp
+
 namespace detail
 {
 
@@ -35,13 +41,30 @@ struct unqualified_type
 //! \retval Defines a constexpr boolean, ::value, indicating the result.
 //!
 template <typename T_, typename ApiTypeList_>
-struct is_user_type : std::conditional<ApiTypeList_::template contains<typename unqualified_type<T_>::type>(),
-                                       std::false_type,
-                                       std::true_type>::type {};
+struct is_user_type : std::integral_constant<bool,
+                      ApiTypeList_::template contains<typename unqualified_type<T_>::type>()> {};
+
+//! Returns whether or not a type is a struct registered with lc::Struct, by value or by reference.
+template <typename T_, typename ApiTypeList_>
+struct is_struct_type : std::integral_constant<bool,
+                        ApiTypeList_::template contains<StructTag<typename std::remove_cv<
+                                                        typename std::remove_reference<T_>::type>::type>>()> {};
+
+//! Returns whether or not a type is a class bound as handles with lc::HandleClass, by pointer.
+template <typename T_, typename ApiTypeList_>
+struct is_handle_type : std::integral_constant<bool,
+                        ApiTypeList_::template contains<HandleTag<typename unqualified_type<T_>::type>>()> {};
 
 template <typename T_, typename ApiTypeList_, ApiId ApiId_>
 struct UserTypeStackManager;
 
+template <typename T_, typename ApiTypeList_, ApiId ApiId_>
+class StructStackManager;
+
+// Defined in lc_handle.hpp
+template <typename T_, typename ApiTypeList_, ApiId ApiId_>
+class HandleStackManager;
+
 //! StackManager base for types that aren't valid user types for whatever reason.
 //! This also serves as a good place to document the two functions that define a StackManager,
 //! since they need to be present here to make sure that eroneous errors are deferred to link-time.
@@ -69,14 +92,24 @@ public:
     //!
     template <std::size_t Index_>
     static T_ at(lua_State* L);
+
+    //! Same as above, for when the index isn't known at compile-time, e.g. for values
+    //! that were pushed while converting a table.
+    //!
+    static T_ at(lua_State* L, int index);
 };
 
 //! Primary template; generates functions to push and extract types from the lua stack.
 //!
 template <typename T_, typename ApiTypeList_, ApiId ApiId_>
-struct StackManager : std::conditional<lc::detail::is_user_type<T_, ApiTypeList_>::value,
+struct StackManager : std::conditional<lc::detail::is_struct_type<T_, ApiTypeList_>::value,
+                      StructStackManager<typename std::remove_cv<typename std::remove_reference<T_>::type>::type,
+                                         ApiTypeList_, ApiId_>,
+                      typename std::conditional<lc::detail::is_handle_type<T_, ApiTypeList_>::value,
+                      HandleStackManager<typename lc::detail::unqualified_type<T_>::type, ApiTypeList_, ApiId_>,
+                      typename std::conditional<lc::detail::is_user_type<T_, ApiTypeList_>::value,
                       UserTypeStackManager<typename lc::detail::unqualified_type<T_>::type, ApiTypeList_, ApiId_>,
-                      UknownTypeStackManager<T_>>::type {};
+                      UknownTypeStackManager<T_>>::type>::type>::type {};
 
 //! Current representation of objects.
 //! There will probably be support for different representations to avoid the
@@ -105,76 +138,291 @@ inline char const* function_name(lua_State* L)
     return debug.name;
 }
 
-template <std::size_t... Types_>
-struct InIndexList { static constexpr bool result(TypeId) { return false; } };
+//! Registry key of an API's per-state type registry, a table made when the API is exported:
+//! [type ID + 1]: the type's instance metatable (classes only), or its methods table (handle classes)
+//! [TypeKey<T>::value()]: T's type ID, for pushing values from outside of the API's wrappers
+//! [-(type ID + 1)]: the metatable for borrowed instances, made the first time it's needed
+//!
+template <ApiId ApiId_>
+struct TypeRegistryKey
+{
+    static void* value()
+    {
+        static char key;
+        return &key;
+    }
+};
 
-template <std::size_t Head_, std::size_t... Tail_>
-struct InIndexList<Head_, Tail_...>
+//! Registry key of a table of every exported API's type registry, indexed by API ID + 1,
+//! for when the API ID is only known at runtime.
+//!
+struct ApiRegistryKey
 {
-    static constexpr LC_FORCE_INLINE bool result(TypeId id)
+    static void* value()
     {
-        return id == Head_ || IndexList<Tail_...>::result(id);
+        static char key;
+        return &key;
     }
 };
 
-template <std::size_t Head_>
-struct InIndexList<Head_>
+//! Pushes the table of every exported API's type registry, making it if it doesn't exist yet.
+inline void push_api_registry(lua_State* L)
+{
+    if (lua_rawgetp(L, LUA_REGISTRYINDEX, ApiRegistryKey::value()) != LUA_TTABLE) {
+        lua_pop(L, 1);
+        lua_newtable(L);
+        lua_pushvalue(L, -1);
+        lua_rawsetp(L, LUA_REGISTRYINDEX, ApiRegistryKey::value());
+    }
+}
+
+inline void register_api(lua_State* L, int typeRegistry, ApiId apiId)
+{
+    push_api_registry(L);
+    lua_pushvalue(L, typeRegistry);
+    lua_rawseti(L, -2, (lua_Integer)apiId + 1);
+    lua_pop(L, 1);
+}
+
+//! Pushes the type registry of the API with the given ID, or nil if it hasn't been exported to L.
+inline void push_type_registry(lua_State* L, ApiId apiId)
+{
+    if (lua_rawgetp(L, LUA_REGISTRYINDEX, ApiRegistryKey::value()) != LUA_TTABLE) return;
+    lua_rawgeti(L, -1, (lua_Integer)apiId + 1);
+    lua_remove(L, -2);
+}
+
+enum ApiUserDataKind
+{
+    API_USERDATA_FOREIGN,
+    API_USERDATA_INSTANCE,
+    API_USERDATA_ENUM_CLASS
+};
+
+//! Tells what the userdata at index is, for code that gets values from scripts without knowing what to expect.
+//! Instances have their type's metatable, owned or borrowed, and enum class values have no metatable at all,
+//! so the metatable decides which contents to read; the two aren't the same size everywhere. Anything else
+//! (userdata of another library, of a type that isn't exported to L, ...) is foreign.
+//! Sets apiId and typeId to the value's, unless it's foreign.
+//!
+inline ApiUserDataKind api_userdata_kind(lua_State* L, int index, ApiId& apiId, TypeId& typeId)
+{
+    if (lua_type(L, index) != LUA_TUSERDATA) return API_USERDATA_FOREIGN;
+
+    std::size_t size = lua_rawlen(L, index);
+    bool isInstance = lua_getmetatable(L, index) != 0;
+    if (isInstance) {
+        const UserDataContents* contents = (const UserDataContents*)lua_touserdata(L, index);
+        if (size != sizeof(UserDataContents)) {
+            lua_pop(L, 1);
+            return API_USERDATA_FOREIGN;
+        }
+        apiId = contents->apiId;
+        typeId = contents->typeId;
+    }
+    else {
+        const EnumClassContents* contents = (const EnumClassContents*)lua_touserdata(L, index);
+        if (size != sizeof(EnumClassContents)) return API_USERDATA_FOREIGN;
+        apiId = contents->apiId;
+        typeId = contents->typeId;
+    }
+
+    // Enum types have nothing at [type ID + 1] in the type registry.
+    bool matches = false;
+    push_type_registry(L, apiId);
+    if (lua_type(L, -1) == LUA_TTABLE) {
+        lua_rawgeti(L, -1, (lua_Integer)typeId + 1);
+        if (isInstance) {
+            lua_rawgeti(L, -2, -((lua_Integer)typeId + 1));
+            matches = lua_rawequal(L, -1, -4) || lua_rawequal(L, -2, -4);
+            lua_pop(L, 2);
+        }
+        else {
+            matches = lua_isnil(L, -1);
+            lua_pop(L, 1);
+        }
+    }
+    lua_pop(L, isInstance ? 2 : 1);
+
+    if (!matches) return API_USERDATA_FOREIGN;
+    return isInstance ? API_USERDATA_INSTANCE : API_USERDATA_ENUM_CLASS;
+}
+
+//! A unique light userdata key per C++ type, since there's no RTTI to identify types with.
+template <typename T_>
+struct TypeKey
+{
+    static void* value()
+    {
+        static char key;
+        return &key;
+    }
+};
+
+//! Pops the value on top of the stack (the instance metatable, or nil) into the type registry
+//! at typeRegistry, and maps T_ to typeId.
+//!
+template <typename T_>
+void register_type(lua_State* L, int typeRegistry, TypeId typeId)
+{
+    lua_rawseti(L, typeRegistry, (lua_Integer)typeId + 1);
+    lua_pushinteger(L, (lua_Integer)typeId);
+    lua_rawsetp(L, typeRegistry, TypeKey<T_>::value());
+}
+
+//! Pushes the instance metatable of a type, or nil if the API hasn't been exported to L.
+template <ApiId ApiId_>
+LC_FORCE_INLINE void push_metatable(lua_State* L, TypeId typeId)
+{
+    if (lua_rawgetp(L, LUA_REGISTRYINDEX, TypeRegistryKey<ApiId_>::value()) != LUA_TTABLE) return;
+    lua_rawgeti(L, -1, (lua_Integer)typeId + 1);
+    lua_remove(L, -2);
+}
+
+//! Pushes the metatable for instances that C++ keeps ownership of: the instance metatable without __gc (or __close).
+//! Pushes nil if the API hasn't been exported to L.
+//!
+template <ApiId ApiId_>
+void push_borrowed_metatable(lua_State* L, TypeId typeId)
+{
+    if (lua_rawgetp(L, LUA_REGISTRYINDEX, TypeRegistryKey<ApiId_>::value()) != LUA_TTABLE) return;
+    if (lua_rawgeti(L, -1, -((lua_Integer)typeId + 1)) != LUA_TNIL) {
+        lua_remove(L, -2);
+        return;
+    }
+
+    // [-2]: type registry
+    // [-1]: nil
+    lua_pop(L, 1);
+    lua_rawgeti(L, -1, (lua_Integer)typeId + 1);
+    lua_newtable(L);
+    lua_pushnil(L);
+    // [-4]: type registry
+    // [-3]: instance metatable
+    // [-2]: borrowed metatable
+    // [-1]: key
+    while (lua_next(L, -3)) {
+        if (lua_type(L, -2) == LUA_TSTRING && (strcmp(lua_tostring(L, -2), "__gc") == 0 ||
+                                               strcmp(lua_tostring(L, -2), "__close") == 0)) {
+            lua_pop(L, 1);
+            continue;
+        }
+
+        lua_pushvalue(L, -2);
+        lua_insert(L, -2);
+        lua_rawset(L, -4);
+    }
+
+    lua_remove(L, -2);
+    lua_pushvalue(L, -1);
+    lua_rawseti(L, -3, -((lua_Integer)typeId + 1));
+    lua_remove(L, -2);
+}
+
+//! Bumped whenever a script assigns a function (or nil) to a field of a director instance, which
+//! makes every director look its overrides up again. See lc_director.hpp.
+//!
+inline std::uint32_t& override_generation()
 {
-    static constexpr LC_FORCE_INLINE bool result(TypeId id) { return id == Head_; }
+    static std::uint32_t generation = 1;
+    return generation;
+}
+
+//! Defined in lc_director.hpp.
+inline bool push_director(lua_State* L, DirectorBase* director);
+inline void bind_director(lua_State* L, DirectorBase* director);
+
+//! Ties instances of classes derived from lc::DirectorBase to the userdata that scripts see them
+//! through. It compiles away for every other class.
+//!
+template <typename T_, bool = std::is_base_of<DirectorBase, T_>::value>
+struct DirectorBinding
+{
+    static LC_FORCE_INLINE bool push_bound(lua_State*, T_*) { return false; }
+    static LC_FORCE_INLINE void bind(lua_State*, T_*) {}
 };
 
+template <typename T_>
+struct DirectorBinding<T_, true>
+{
+    //! Pushes the userdata the director was bound to, if it's still alive, so that a script sees
+    //! the same instance, with the same overrides, however many times it's pushed.
+    static bool push_bound(lua_State* L, T_* val) { return push_director(L, val); }
+
+    //! Binds the director to the userdata on top of the stack.
+    static void bind(lua_State* L, T_* val) { bind_director(L, val); }
+};
 
 template <typename T_, typename ApiTypeList_, ApiId ApiId_>
 class ClassStackManager
 {
 private:
-    static constexpr TypeId type_id() { return ApiTypeList_::template index_of<T_>(); }
+    // Going through a template argument keeps the lookup at compile time even in debug builds,
+    // which would otherwise emit a call to a function named after the whole type list.
+    static constexpr TypeId type_id() { return (TypeId)std::integral_constant<int, ApiTypeList_::template index_of<T_>()>::value; }
 
 public:
     static LC_FORCE_INLINE int push(lua_State* L, T_* val)
     {
+        if (DirectorBinding<T_>::push_bound(L, val)) return 1;
+
         UserDataContents* contents = (UserDataContents*)lua_newuserdata(L, sizeof(UserDataContents));
         contents->apiId = ApiId_;
         contents->typeId = type_id();
         contents->instance = val;
 
-        // All method wrappers that wrap methods that return pointers to other API types
-        // are expected to have the respective type's instance metatable as its first upvalue.
-        lua_pushvalue(L, lua_upvalueindex(1));
+        // The instance metatable comes from the state's type registry, so that
+        // this works from anywhere, not only from within the API's wrappers.
+        push_metatable<ApiId_>(L, type_id());
         lua_setmetatable(L, -2);
 
+        if (NativeSize<T_>::enabled) add_native_memory(L, NativeSize<T_>::of(*val));
+        DirectorBinding<T_>::bind(L, val);
+        return 1;
+    }
+
+    //! Pushes an instance that C++ keeps ownership of, e.g. an element of a container.
+    //! It's never freed by Lua, so it must outlive every reference that scripts hold to it.
+    //!
+    static LC_FORCE_INLINE int push_borrowed(lua_State* L, T_* val)
+    {
+        if (DirectorBinding<T_>::push_bound(L, val)) return 1;
+
+        UserDataContents* contents = (UserDataContents*)lua_newuserdata(L, sizeof(UserDataContents));
+        contents->apiId = ApiId_;
+        contents->typeId = type_id();
+        contents->instance = val;
+
+        push_borrowed_metatable<ApiId_>(L, type_id());
+        lua_setmetatable(L, -2);
+        DirectorBinding<T_>::bind(L, val);
         return 1;
     }
+
     template <std::size_t Index_>
-    static LC_FORCE_INLINE T_* at(lua_State* L)
+    static LC_FORCE_INLINE T_* at(lua_State* L) { return at(L, (int)Index_); }
+
+    static LC_FORCE_INLINE T_* at(lua_State* L, int index)
     {
-        UserDataContents* contents = (UserDataContents*)lua_touserdata(L, Index_);
-        if (contents == nullptr) luaL_argerror(L, Index_, "class instance expected");
-        if (contents->apiId != ApiId_) luaL_argerror(L, Index_, "type isn't from this API");
+        // Handles (see lc_handle.hpp) are light userdata, which lua_touserdata() returns too.
+        if (lua_type(L, index) != LUA_TUSERDATA) luaL_argerror(L, index, "class instance expected");
+        UserDataContents* contents = (UserDataContents*)lua_touserdata(L, index);
+        if (contents->apiId != ApiId_) luaL_argerror(L, index, "type isn't from this API");
 
         TypeId typeId = contents->typeId;
-        if (typeId != type_id() && !is_derived(typeId)) luaL_argerror(L, Index_, "wrong type");
+        if (typeId != type_id() && !is_derived(typeId)) luaL_argerror(L, index, "wrong type");
+        if (!contents->instance) luaL_argerror(L, index, "instance was moved");
 
         return (T_*)contents->instance;
     }
 
 private:
-    template <typename PossiblyDerived_>
-    struct IsDerived : std::is_base_of<T_, PossiblyDerived_> {};
-
-    // The idea here is to generate an if statement like if (id == 0 || id == 5 || etc.)
+    // Derived types are looked up in a table with an entry per API type, so the check
+    // costs the same no matter how many types derive from T_.
 
     static LC_FORCE_INLINE bool is_derived(TypeId id)
     {
-        using DerivedTypeIdList = decltype(ApiTypeList_::template matching_indices<IsDerived>());
-        return in_list(DerivedTypeIdList{}, id);
-    }
-
-    template <std::size_t... Indices_>
-    static LC_FORCE_INLINE bool in_list(IndexList<Indices_...>, TypeId id)
-    {
-        if (sizeof...(Indices_) == 0) return false;
-        return InIndexList<Indices_...>::result(id);
+        return DerivedTable<T_, ApiTypeList_>::at(id);
     }
 };
 
@@ -183,12 +431,12 @@ template <typename T_, typename ApiTypeList_, ApiId ApiId_>
 class EnumClassStackManager
 {
 private:
-    static constexpr TypeId type_id() { return ApiTypeList_::template index_of<T_>(); }
+    static constexpr TypeId type_id() { return (TypeId)std::integral_constant<int, ApiTypeList_::template index_of<T_>()>::value; }
 
 public:
     static LC_FORCE_INLINE int push(lua_State* L, T_ val)
     {
-        EnumClassContents* contents = (EnumClassContents*)lua_newuserdata(L, sizeof(EnumClassContents));
+        EnumClassContents* contents = (EnumClassContents*)new_userdata(L, sizeof(EnumClassContents), 0);
         contents->apiId = ApiId_;
         contents->typeId = type_id();
         contents->value = (lua_Integer)val;
@@ -196,17 +444,128 @@ public:
         return 1;
     }
     template <std::size_t Index_>
-    static LC_FORCE_INLINE T_ at(lua_State* L)
+    static LC_FORCE_INLINE T_ at(lua_State* L) { return at(L, (int)Index_); }
+
+    static LC_FORCE_INLINE T_ at(lua_State* L, int index)
     {
-        EnumClassContents* contents = (EnumClassContents*)lua_touserdata(L, Index_);
-        if (contents == nullptr) luaL_argerror(L, Index_, "enum class expected");
-        if (contents->apiId != ApiId_) luaL_argerror(L, Index_, "type isn't from this API");
-        if (contents->typeId != type_id()) luaL_argerror(L, Index_, "wrong type");
+        if (lua_type(L, index) != LUA_TUSERDATA) luaL_argerror(L, index, "enum class expected");
+        EnumClassContents* contents = (EnumClassContents*)lua_touserdata(L, index);
+        if (contents->apiId != ApiId_) luaL_argerror(L, index, "type isn't from this API");
+        if (contents->typeId != type_id()) luaL_argerror(L, index, "wrong type");
 
         return (T_)contents->value;
     }
 };
 
+//! Describes one field of an lc::Struct. Generated by lc::Field.
+struct FieldDescriptor
+{
+    char const* name;
+
+    //! Converts the value at index and stores it in the field.
+    void (*read)(lua_State* L, int index, void* object);
+    //! Pushes the field's value.
+    void (*push)(lua_State* L, const void* object);
+    //! The same, but pointers to API classes are pushed borrowed (see ElementPusher).
+    void (*pushBorrowed)(lua_State* L, const void* object);
+};
+
+struct StructFields
+{
+    const FieldDescriptor* data = nullptr;
+    std::size_t size = 0;
+};
+
+//! Registry key of a struct's per-state info table.
+template <ApiId ApiId_, TypeId TypeId_>
+struct StructInfoKey
+{
+    static void* value()
+    {
+        static char key;
+        return &key;
+    }
+};
+
+//! Converts between plain structs and tables, one field at a time, using the fields' stack managers.
+//!
+//! Each struct has an info table in the registry, made when the API is exported:
+//! [0]: light userdata pointing to the struct's StructFields
+//! [1..n]: the field names, so conversions never have to make strings out of C strings
+//!
+template <typename T_, typename ApiTypeList_, ApiId ApiId_>
+class StructStackManager
+{
+private:
+    static constexpr TypeId type_id() { return (TypeId)std::integral_constant<int, ApiTypeList_::template index_of<StructTag<T_>>()>::value; }
+
+    static LC_FORCE_INLINE const StructFields* push_info(lua_State* L)
+    {
+        lua_rawgetp(L, LUA_REGISTRYINDEX, StructInfoKey<ApiId_, type_id()>::value());
+        lua_rawgeti(L, -1, 0);
+        const StructFields* fields = (const StructFields*)lua_touserdata(L, -1);
+        lua_pop(L, 1);
+        return fields;
+    }
+
+public:
+    static int push(lua_State* L, const T_& val)
+    {
+        const StructFields* fields = push_info(L);
+        lua_createtable(L, 0, (int)fields->size);
+        assign(L, fields, lua_gettop(L) - 1, val, false);
+        lua_remove(L, -2);
+        return 1;
+    }
+
+    //! Sets the fields of the table at index to val's, e.g. to reuse one table for many values.
+    //! Fields that point to API classes are pushed borrowed, since the table doesn't own them.
+    //!
+    static void assign(lua_State* L, int index, const T_& val)
+    {
+        index = lua_absindex(L, index);
+        const StructFields* fields = push_info(L);
+        lua_pushvalue(L, index);
+        assign(L, fields, lua_gettop(L) - 1, val, true);
+        lua_pop(L, 2);
+    }
+
+    template <std::size_t Index_>
+    static LC_FORCE_INLINE T_ at(lua_State* L) { return at(L, (int)Index_); }
+
+    //! Fields that are nil in the table keep their default-initialized values.
+    static T_ at(lua_State* L, int index)
+    {
+        index = lua_absindex(L, index);
+        luaL_checktype(L, index, LUA_TTABLE);
+
+        const StructFields* fields = push_info(L);
+        int info = lua_gettop(L);
+
+        T_ result = T_();
+        for (std::size_t i = 0; i < fields->size; i++) {
+            lua_rawgeti(L, info, (lua_Integer)i + 1);
+            if (lua_rawget(L, index) != LUA_TNIL) fields->data[i].read(L, info + 1, &result);
+            lua_pop(L, 1);
+        }
+
+        lua_pop(L, 1);
+        return result;
+    }
+
+private:
+    // [-1]: the table to fill out
+    static void assign(lua_State* L, const StructFields* fields, int info, const T_& val, bool borrowed)
+    {
+        for (std::size_t i = 0; i < fields->size; i++) {
+            lua_rawgeti(L, info, (lua_Integer)i + 1);
+            if (borrowed) fields->data[i].pushBorrowed(L, &val);
+            else fields->data[i].push(L, &val);
+            lua_rawset(L, -3);
+        }
+    }
+};
+
 // Switch implementations based on whether we are dealing with a regular class
 // or an enum class. @Note, regular enums are just lua_Integers.
 template <typename T_, typename ApiTypeList_, ApiId ApiId_>
@@ -215,6 +574,27 @@ struct UserTypeStackManager : std::conditional<std::is_class<T_>::value,
                                    EnumClassStackManager<T_, ApiTypeList_, ApiId_>
                                    >::type {};
 
+//! Pushes elements that point to API classes as borrowed instances, and everything else as usual.
+template <typename T_, typename ApiTypeList_, ApiId ApiId_,
+          bool IsClassPointer_ = std::is_pointer<T_>::value
+                                 && std::is_class<typename unqualified_type<T_>::type>::value
+                                 && ApiTypeList_::template contains<typename unqualified_type<T_>::type>()>
+struct ElementPusher
+{
+    static LC_FORCE_INLINE void push(lua_State* L, const T_& val) { StackManager<T_, ApiTypeList_, ApiId_>::push(L, val); }
+};
+
+template <typename T_, typename ApiTypeList_, ApiId ApiId_>
+struct ElementPusher<T_, ApiTypeList_, ApiId_, true>
+{
+    using Class = typename unqualified_type<T_>::type;
+
+    static LC_FORCE_INLINE void push(lua_State* L, T_ val)
+    {
+        ClassStackManager<Class, ApiTypeList_, ApiId_>::push_borrowed(L, (Class*)val);
+    }
+};
+
 //! The implementation of any stack manager that works on signed integers.
 //!
 //! \note The implementation is provided through inheritance.
@@ -229,9 +609,11 @@ struct SignedIntegerManager
     }
 
     template <std::size_t Index_>
-    static LC_FORCE_INLINE T_ at(lua_State* L)
+    static LC_FORCE_INLINE T_ at(lua_State* L) { return at(L, (int)Index_); }
+
+    static LC_FORCE_INLINE T_ at(lua_State* L, int index)
     {
-        return (T_)luaL_checkinteger(L, Index_);
+        return (T_)luaL_checkinteger(L, index);
     }
 };
 
@@ -245,14 +627,16 @@ struct UnsignedIntegerManager
 {
     static LC_FORCE_INLINE int push(lua_State* L, T_ val)
     {
-        lua_pushunsigned(L, val);
+        lua_pushinteger(L, (lua_Integer)val);
         return 1;
     }
 
     template <std::size_t Index_>
-    static LC_FORCE_INLINE T_ at(lua_State* L)
+    static LC_FORCE_INLINE T_ at(lua_State* L) { return at(L, (int)Index_); }
+
+    static LC_FORCE_INLINE T_ at(lua_State* L, int index)
     {
-        return (T_)luaL_checkunsigned(L, Index_);
+        return (T_)(lua_Unsigned)luaL_checkinteger(L, index);
     }
 };
 
@@ -271,9 +655,11 @@ struct RealNumberManager
     }
 
     template <std::size_t Index_>
-    static LC_FORCE_INLINE T_ at(lua_State* L)
+    static LC_FORCE_INLINE T_ at(lua_State* L) { return at(L, (int)Index_); }
+
+    static LC_FORCE_INLINE T_ at(lua_State* L, int index)
     {
-        return (T_)luaL_checknumber(L, Index_);
+        return (T_)luaL_checknumber(L, index);
     }
 };
 
@@ -288,9 +674,11 @@ struct StackManager<bool, ApiTypeList_, ApiId_>
     }
 
     template <std::size_t Index_>
-    static LC_FORCE_INLINE bool at(lua_State* L)
+    static LC_FORCE_INLINE bool at(lua_State* L) { return at(L, (int)Index_); }
+
+    static LC_FORCE_INLINE bool at(lua_State* L, int index)
     {
-        return (bool)lua_toboolean(L, Index_);
+        return (bool)lua_toboolean(L, index);
     }
 };
 
@@ -320,6 +708,235 @@ struct StackManager<uint32_t, ApiTypeList_, ApiId_> : UnsignedIntegerManager<uin
 template <typename ApiTypeList_, ApiId ApiId_> 
 struct StackManager<uint64_t, ApiTypeList_, ApiId_> : UnsignedIntegerManager<uint64_t> {};
 
+//! How an argument is read, worked out from the stack manager that lc::Method would use for it,
+//! so that custom stack managers are always respected. For wrappers that read some arguments
+//! without going through the stack managers' at().
+//!
+enum ArgKind : uint8_t
+{
+    ARG_KIND_INLINE, // Only readable with the stack manager's at().
+    ARG_KIND_BOOLEAN,
+    ARG_KIND_INTEGER,
+    ARG_KIND_NUMBER,
+    ARG_KIND_CLASS,
+    ARG_KIND_ENUM_CLASS
+};
+
+template <typename T_, typename TypeSet_, ApiId ApiId_,
+          typename Manager_ = StackManager<T_, TypeSet_, ApiId_>,
+          typename Unqualified_ = typename unqualified_type<T_>::type>
+struct ArgKindOf : std::integral_constant<ArgKind,
+    std::is_same<T_, bool>::value ? ARG_KIND_BOOLEAN :
+    std::is_base_of<SignedIntegerManager<T_>, Manager_>::value ? ARG_KIND_INTEGER :
+    std::is_base_of<UnsignedIntegerManager<T_>, Manager_>::value ? ARG_KIND_INTEGER :
+    std::is_base_of<RealNumberManager<T_>, Manager_>::value ? ARG_KIND_NUMBER :
+    std::is_pointer<T_>::value &&
+    std::is_base_of<ClassStackManager<Unqualified_, TypeSet_, ApiId_>, Manager_>::value ? ARG_KIND_CLASS :
+    std::is_base_of<EnumClassStackManager<Unqualified_, TypeSet_, ApiId_>, Manager_>::value ? ARG_KIND_ENUM_CLASS :
+    ARG_KIND_INLINE> {};
+
+//! Where an argument is left when it's read ahead of a call, in the form its kind is read in.
+union ArgSlot
+{
+    bool boolean;
+    lua_Integer integer;
+    lua_Number number;
+    void* pointer;
+};
+
+//! Reads numeric arguments for FusedArgs. Everything else is read with its stack manager, as usual.
+template <typename T_, typename TypeSet_, ApiId ApiId_, ArgKind Kind_ = ArgKindOf<T_, TypeSet_, ApiId_>::value>
+struct FusedArg
+{
+    static LC_FORCE_INLINE int read(lua_State*, int, ArgSlot&) { return 1; }
+
+    template <std::size_t Index_>
+    static LC_FORCE_INLINE T_ get(lua_State* L, const ArgSlot&) { return StackManager<T_, TypeSet_, ApiId_>::template at<Index_>(L); }
+};
+
+template <typename T_, typename TypeSet_, ApiId ApiId_>
+struct FusedArg<T_, TypeSet_, ApiId_, ARG_KIND_INTEGER>
+{
+    //! \returns Whether the value could be converted, like luaL_checkinteger() would.
+    static LC_FORCE_INLINE int read(lua_State* L, int index, ArgSlot& slot)
+    {
+        int isNum = 0;
+        slot.integer = lua_tointegerx(L, index, &isNum);
+        return isNum;
+    }
+
+    template <std::size_t>
+    static LC_FORCE_INLINE T_ get(lua_State*, const ArgSlot& slot) { return (T_)slot.integer; }
+};
+
+template <typename T_, typename TypeSet_, ApiId ApiId_>
+struct FusedArg<T_, TypeSet_, ApiId_, ARG_KIND_NUMBER>
+{
+    static LC_FORCE_INLINE int read(lua_State* L, int index, ArgSlot& slot)
+    {
+        int isNum = 0;
+        slot.number = lua_tonumberx(L, index, &isNum);
+        return isNum;
+    }
+
+    template <std::size_t>
+    static LC_FORCE_INLINE T_ get(lua_State*, const ArgSlot& slot) { return (T_)slot.number; }
+};
+
+//! Raises the error that the stack managers would have for the first numeric argument that can't be converted.
+LC_NOINLINE inline void fused_arg_error(lua_State* L, const ArgKind* kinds, int numArgs)
+{
+    for (int i = 0; i < numArgs; i++) {
+        if (kinds[i] == ARG_KIND_INTEGER) luaL_checkinteger(L, i + 2);
+        else if (kinds[i] == ARG_KIND_NUMBER) luaL_checknumber(L, i + 2);
+    }
+}
+
+//! Raises an error about the element of argument arg on top of the stack.
+LC_NOINLINE inline void element_error(lua_State* L, int arg, lua_Integer element, char const* expected)
+{
+    luaL_error(L, "In function '%s': bad element %d of argument %d (%s expected, got %s)",
+               function_name(L), (int)element, arg, expected, luaL_typename(L, -1));
+}
+
+//! Checks an element of an array argument, on top of the stack, the way its stack manager would, so that
+//! a bad one is reported by its place in the array instead of by its stack index, which means nothing to scripts.
+//! \returns What was expected instead, or nullptr if the element is fine.
+//!
+template <typename T_, typename TypeSet_, ApiId ApiId_, ArgKind Kind_ = ArgKindOf<T_, TypeSet_, ApiId_>::value>
+struct ElementCheck
+{
+    // Anything else reports its own errors. Structs are at least tables.
+    static LC_FORCE_INLINE char const* expected(lua_State* L)
+    {
+        return is_struct_type<T_, TypeSet_>::value && !lua_istable(L, -1) ? "table" : nullptr;
+    }
+};
+
+template <typename T_, typename TypeSet_, ApiId ApiId_>
+struct ElementCheck<T_, TypeSet_, ApiId_, ARG_KIND_INTEGER>
+{
+    static LC_FORCE_INLINE char const* expected(lua_State* L)
+    {
+        int isNum = 0;
+        lua_tointegerx(L, -1, &isNum);
+        return isNum ? nullptr : "integer";
+    }
+};
+
+template <typename T_, typename TypeSet_, ApiId ApiId_>
+struct ElementCheck<T_, TypeSet_, ApiId_, ARG_KIND_NUMBER>
+{
+    static LC_FORCE_INLINE char const* expected(lua_State* L)
+    {
+        int isNum = 0;
+        lua_tonumberx(L, -1, &isNum);
+        return isNum ? nullptr : "number";
+    }
+};
+
+template <typename T_, typename TypeSet_, ApiId ApiId_>
+struct ElementCheck<T_, TypeSet_, ApiId_, ARG_KIND_CLASS>
+{
+    using Class = typename unqualified_type<T_>::type;
+
+    static char const* expected(lua_State* L)
+    {
+        if (lua_type(L, -1) != LUA_TUSERDATA) return "class instance";
+        const UserDataContents* contents = (const UserDataContents*)lua_touserdata(L, -1);
+        if (contents->apiId != ApiId_) return "instance from this API";
+        TypeId typeId = contents->typeId;
+        if (typeId != (TypeId)TypeSet_::template index_of<Class>() && !DerivedTable<Class, TypeSet_>::at(typeId))
+            return "instance of a compatible class";
+        if (!contents->instance) return "instance that wasn't moved";
+        return nullptr;
+    }
+};
+
+template <typename T_, typename TypeSet_, ApiId ApiId_>
+struct ElementCheck<T_, TypeSet_, ApiId_, ARG_KIND_ENUM_CLASS>
+{
+    using Enum = typename unqualified_type<T_>::type;
+
+    static char const* expected(lua_State* L)
+    {
+        if (lua_type(L, -1) != LUA_TUSERDATA) return "enum class";
+        const EnumClassContents* contents = (const EnumClassContents*)lua_touserdata(L, -1);
+        if (contents->apiId != ApiId_) return "enum class from this API";
+        if (contents->typeId != (TypeId)TypeSet_::template index_of<Enum>()) return "value of the right enum class";
+        return nullptr;
+    }
+};
+
+//! Validates all of a signature's numeric arguments in one go. They're read ahead of the call with
+//! lua_tointegerx() and lua_tonumberx(), which convert exactly what luaL_checkinteger() and
+//! luaL_checknumber() do, and their results are combined into a single check. Only if that fails
+//! are the arguments looked at one at a time again, for the error message, by shared code.
+//!
+//! Arguments start at stack index 2, after the instance.
+//!
+template <typename TypeSet_, ApiId ApiId_, typename... Args_>
+struct FusedArgs
+{
+    // The trailing entry keeps the array from being empty.
+    static constexpr ArgKind kinds[sizeof...(Args_) + 1] = { ArgKindOf<Args_, TypeSet_, ApiId_>::value..., ARG_KIND_INLINE };
+
+    template <std::size_t... Indices_>
+    static LC_FORCE_INLINE void read(lua_State* L, ArgSlot* slots, IndexSequence<Indices_...>)
+    {
+        int ok = 1;
+        using Expand = int[];
+        (void)Expand{0, (ok &= FusedArg<Args_, TypeSet_, ApiId_>::read(L, (int)Indices_ + 2, slots[Indices_]), 0)...};
+        if (!ok) fused_arg_error(L, kinds, (int)sizeof...(Args_));
+    }
+};
+
+template <typename TypeSet_, ApiId ApiId_, typename... Args_>
+constexpr ArgKind FusedArgs<TypeSet_, ApiId_, Args_...>::kinds[sizeof...(Args_) + 1];
+
+template <typename T_, typename TypeSet_, ApiId ApiId_>
+struct uses_scratch : std::is_base_of<ScratchStackManager, StackManager<T_, TypeSet_, ApiId_>> {};
+
+//! uses_scratch for every argument, like PredicateTable.
+template <typename TypeSet_, ApiId ApiId_, typename... Args_>
+struct ScratchFlags
+{
+    static constexpr bool values[sizeof...(Args_) + 1] = { (bool)uses_scratch<Args_, TypeSet_, ApiId_>::value..., false };
+};
+
+template <typename TypeSet_, ApiId ApiId_, typename... Args_>
+constexpr bool ScratchFlags<TypeSet_, ApiId_, Args_...>::values[sizeof...(Args_) + 1];
+
+template <typename TypeSet_, ApiId ApiId_, typename... Args_>
+struct args_use_scratch :
+        std::integral_constant<bool, count_flags(ScratchFlags<TypeSet_, ApiId_, Args_...>::values, 0, sizeof...(Args_)) != 0> {};
+
+template <typename TypeSet_, ApiId ApiId_, typename Pointer_>
+struct method_uses_scratch;
+
+template <typename TypeSet_, ApiId ApiId_, typename Result_, typename Class_, typename... Args_>
+struct method_uses_scratch<TypeSet_, ApiId_, Result_(Class_::*)(Args_...)> : args_use_scratch<TypeSet_, ApiId_, Args_...> {};
+
+//! The wrapper to push for a method: for signatures with arguments that allocate from the scratch
+//! arena (see lc_scratch.hpp), it's called in a scope that gives the memory back.
+template <bool UsesScratch_, lua_CFunction Call_>
+struct ScratchCall
+{
+    static constexpr lua_CFunction function() { return Call_; }
+};
+
+template <lua_CFunction Call_>
+struct ScratchCall<true, Call_>
+{
+    static int call(lua_State* L)
+    {
+        lua_CFunction volatile wrapper = Call_;
+        return call_in_scratch_scope(L, wrapper);
+    }
+
+    static constexpr lua_CFunction function() { return &call; }
+};
+
 } // end detail
 } // end lc
 
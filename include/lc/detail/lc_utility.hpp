@@ -1,6 +1,8 @@
 #ifndef LC_UTILITY_HPP
 #define LC_UTILITY_HPP
+#include <cstdlib>
 #include <type_traits>
+#include <utility>
 #include <lc/detail/lc_common.hpp>
 
 namespace lc
@@ -10,18 +12,35 @@ namespace lc
 namespace detail
 {
 
+// The metafunctions below are all flat: none of them recurse over the elements of a list.
+// APIs can have hundreds of types, and recursive versions made every lookup instantiate
+// a template per element, which blew up compile times and ran into template depth limits.
+
 // Helper index sequence
 template<std::size_t... Indices_>
-struct IndexSequence
+struct IndexSequence {};
+
+template <typename, bool>
+struct DoubleIndexSequence;
+
+template <std::size_t... Indices_>
+struct DoubleIndexSequence<IndexSequence<Indices_...>, false>
 {
-    using Next = IndexSequence<Indices_..., sizeof...(Indices_)>;
+    using Type = IndexSequence<Indices_..., (sizeof...(Indices_) + Indices_)...>;
 };
 
-// Builds an IndexSequence<0, 1, 2, ..., Num_-1>.
+template <std::size_t... Indices_>
+struct DoubleIndexSequence<IndexSequence<Indices_...>, true>
+{
+    using Type = IndexSequence<Indices_..., (sizeof...(Indices_) + Indices_)..., 2 * sizeof...(Indices_)>;
+};
+
+// Builds an IndexSequence<0, 1, 2, ..., Num_-1>, doubling a sequence of half the size,
+// so the depth is logarithmic in Num_.
 template<std::size_t Num_>
 struct BuildIndexSequence
 {
-    using Type = typename BuildIndexSequence<Num_ - 1>::Type::Next;
+    using Type = typename DoubleIndexSequence<typename BuildIndexSequence<Num_ / 2>::Type, Num_ % 2 == 1>::Type;
 };
 
 template<>
@@ -30,32 +49,100 @@ struct BuildIndexSequence<0>
     using Type = IndexSequence<>;
 };
 
-template <typename Target_, typename ...List_>
-struct IndexOf : std::integral_constant<int, -1> {};
+// A type list as a set of bases, one per element. Looking a type up is then a single
+// deduction against the bases instead of a walk down the list.
+// The types in a list are assumed to be distinct.
+
+template <std::size_t Index_, typename T_>
+struct IndexedType { using Type = T_; };
+
+template <typename, typename...>
+struct IndexedTypesImpl;
+
+template <std::size_t... Indices_, typename... Types_>
+struct IndexedTypesImpl<IndexSequence<Indices_...>, Types_...> : IndexedType<Indices_, Types_>... {};
+
+template <typename... Types_>
+struct IndexedTypes : IndexedTypesImpl<typename BuildIndexSequence<sizeof...(Types_)>::Type, Types_...> {};
+
+template <typename T_, std::size_t Index_>
+std::integral_constant<int, (int)Index_> indexed_type_lookup(const IndexedType<Index_, T_>*);
+
+template <typename T_>
+std::integral_constant<int, -1> indexed_type_lookup(...);
 
-template <typename Target_, typename NotTarget_, typename ...List_>
-struct IndexOf<Target_, NotTarget_, List_...> : std::integral_constant<int, 1 + IndexOf<Target_, List_...>::value> {};
+template <std::size_t Index_, typename T_>
+IndexedType<Index_, T_> indexed_type_at(const IndexedType<Index_, T_>*);
 
 template <typename Target_, typename ...List_>
-struct IndexOf<Target_, Target_, List_...> : std::integral_constant<int, 0> {};
+struct IndexOf : decltype(indexed_type_lookup<Target_>((IndexedTypes<List_...>*)nullptr)) {};
 
+template <std::size_t Index_, typename... Types_>
+using TypeAt = typename decltype(indexed_type_at<Index_>((IndexedTypes<Types_...>*)nullptr))::Type;
 
-// Used for finding the type exporter in a type-list that corresponds to a user-defined type.
+// A tuple laid out the same way. Standard library tuples nest a level per element,
+// which doesn't scale to an exporter per type in big APIs.
 
-template <class, class...>
-struct TypeFinder;
+template <std::size_t Index_, typename T_>
+struct TupleSlot
+{
+    template <typename Arg_>
+    explicit TupleSlot(Arg_&& arg) : value(std::forward<Arg_>(arg)) {}
 
-template <class Target_>
-struct TypeFinder<Target_>
+    T_ value;
+};
+
+template <typename, typename...>
+struct FlatTupleImpl;
+
+// Each element is constructed in place from one argument, so that building a tuple
+// doesn't make a temporary per element.
+template <std::size_t... Indices_, typename... Types_>
+struct FlatTupleImpl<IndexSequence<Indices_...>, Types_...> : TupleSlot<Indices_, Types_>...
 {
-    using Type = void;
+    template <typename... Args_>
+    explicit FlatTupleImpl(Args_&&... args)
+        : TupleSlot<Indices_, Types_>(std::forward<Args_>(args))...
+    {}
 };
 
-template <typename Target_, typename Head_, class... Tail_>
-struct TypeFinder<Target_, Head_, Tail_...>
+template <typename... Types_>
+struct FlatTuple : FlatTupleImpl<typename BuildIndexSequence<sizeof...(Types_)>::Type, Types_...>
 {
-    using Type = typename std::conditional<std::is_same<Target_, typename Head_::Type>::value,
-                 Head_, typename TypeFinder<Target_, Tail_...>::Type>::type;
+    using Base = FlatTupleImpl<typename BuildIndexSequence<sizeof...(Types_)>::Type, Types_...>;
+
+    template <typename... Args_>
+    explicit FlatTuple(Args_&&... args)
+        : Base(std::forward<Args_>(args)...)
+    {}
+};
+
+template <std::size_t Index_, typename T_>
+LC_FORCE_INLINE T_& tuple_get(TupleSlot<Index_, T_>& slot) { return slot.value; }
+
+template <std::size_t Index_, typename T_>
+LC_FORCE_INLINE const T_& tuple_get(const TupleSlot<Index_, T_>& slot) { return slot.value; }
+
+
+// Used for finding the type exporter in a type-list that corresponds to a user-defined type.
+
+template <typename Key_, typename Value_>
+struct TypeMapEntry {};
+
+template <typename... Entries_>
+struct TypeMap : Entries_... {};
+
+template <typename Key_, typename Value_>
+Value_* type_map_lookup(const TypeMapEntry<Key_, Value_>*);
+
+template <typename Key_>
+void* type_map_lookup(...);
+
+//! Finds the value for Target_ in a TypeMap, or void.
+template <typename Target_, typename Map_>
+struct TypeFinder
+{
+    using Type = typename std::remove_pointer<decltype(type_map_lookup<Target_>((Map_*)nullptr))>::type;
 };
 
 // Defined later
@@ -63,76 +150,82 @@ template <typename... Types_>
 struct TypeList;
 
 
-template <typename, typename...>
-struct TypeListContains;
-
-template <class Target_>
-struct TypeListContains<Target_> : std::false_type {};
+template <typename Target_, typename... List_>
+struct TypeListContains : std::integral_constant<bool, IndexOf<Target_, List_...>::value != -1> {};
 
-template <typename Target_, typename Head_, class... Tail_>
-struct TypeListContains<Target_, Head_, Tail_...> : std::conditional<std::is_same<Target_, Head_>::value,
-                                                                     std::true_type,
-                                                                     TypeListContains<Head_, Tail_...>>::type {};
+//! A predicate evaluated for every type in a list, as a table that can be read at compile time or at runtime.
+template <template <typename> class Predicate_, typename... Types_>
+struct PredicateTable
+{
+    // The trailing entry keeps the array from being empty.
+    static constexpr bool values[sizeof...(Types_) + 1] = { (bool)Predicate_<Types_>::value..., false };
+};
 
-template <template <typename> class, typename...>
-struct TypeListCountIf;
+template <template <typename> class Predicate_, typename... Types_>
+constexpr bool PredicateTable<Predicate_, Types_...>::values[sizeof...(Types_) + 1];
 
-template <template <typename> class Predicate_>
-struct TypeListCountIf<Predicate_> : std::integral_constant<std::size_t, 0> {};
+//! Counts the set flags in [begin, end). It splits the range in half so that
+//! the constexpr call depth is logarithmic in the size of the list.
+constexpr std::size_t count_flags(const bool* flags, std::size_t begin, std::size_t end)
+{
+    return end - begin == 0 ? 0
+         : end - begin == 1 ? (std::size_t)flags[begin]
+         : count_flags(flags, begin, begin + (end - begin) / 2)
+           + count_flags(flags, begin + (end - begin) / 2, end);
+}
+
+//! Index of the nth set flag in [begin, end), which must exist.
+constexpr std::size_t nth_flag(const bool* flags, std::size_t begin, std::size_t end, std::size_t nth)
+{
+    return end - begin == 1 ? begin
+         : nth < count_flags(flags, begin, begin + (end - begin) / 2)
+               ? nth_flag(flags, begin, begin + (end - begin) / 2, nth)
+               : nth_flag(flags, begin + (end - begin) / 2, end,
+                          nth - count_flags(flags, begin, begin + (end - begin) / 2));
+}
 
-template <template <typename> class Predicate_, typename Head_, typename... Tail_>
-struct TypeListCountIf<Predicate_, Head_, Tail_...> :
-        std::integral_constant<std::size_t, (std::size_t)Predicate_<Head_>::value
-                                            + TypeListCountIf<Predicate_, Tail_...>::value> {};
+template <template <typename> class Predicate_, typename... Types_>
+struct TypeListCountIf :
+        std::integral_constant<std::size_t, count_flags(PredicateTable<Predicate_, Types_...>::values,
+                                                        0, sizeof...(Types_))> {};
 
 
 // The IndexSequence above is meant to implement the C++14 type.
-// This one is for arbitrary indices, without the Next typedef.
+// This one is for arbitrary indices.
 template <std::size_t... Indices_>
-struct IndexList
-{
-    template <bool Cond_, std::size_t Tail_>
-    using AppendedIf = typename std::conditional<Cond_, IndexList<Indices_..., Tail_>,
-                                                        IndexList<Indices_...>>::type;
-};
+struct IndexList {};
 
 template <typename, template <typename> class, typename...>
-struct TypeListIndicesMatching;
+struct TypeListIndicesMatchingImpl;
 
-template <typename TypeList_, template <typename> class Predicate_>
-struct TypeListIndicesMatching<TypeList_, Predicate_> { using List = IndexList<>; };
-
-template <typename TypeList_, template <typename> class Predicate_, typename Head_, typename... Tail_>
-struct TypeListIndicesMatching<TypeList_, Predicate_, Head_, Tail_...>
+template <std::size_t... Nths_, template <typename> class Predicate_, typename... Types_>
+struct TypeListIndicesMatchingImpl<IndexSequence<Nths_...>, Predicate_, Types_...>
 {
-    using List = typename TypeListIndicesMatching<TypeList_, Predicate_, Tail_...>::List
-                 ::template AppendedIf<Predicate_<Head_>::value,
-                                       TypeList_::template index_of<Head_>()>;
+    using List = IndexList<nth_flag(PredicateTable<Predicate_, Types_...>::values, 0, sizeof...(Types_), Nths_)...>;
 };
 
-template <template <typename> class, typename...>
-struct TypeListFilter;
+template <template <typename> class Predicate_, typename... Types_>
+struct TypeListIndicesMatching :
+        TypeListIndicesMatchingImpl<typename BuildIndexSequence<TypeListCountIf<Predicate_, Types_...>::value>::Type,
+                                    Predicate_, Types_...> {};
 
-template <template <typename> class Predicate_>
-struct TypeListFilter<Predicate_> { using List = TypeList<>; };
+template <typename, typename...>
+struct TypeListSelect;
 
-template <template <typename> class Predicate_, typename Head_, typename... Tail_>
-struct TypeListFilter<Predicate_, Head_, Tail_...>
+template <std::size_t... Indices_, typename... Types_>
+struct TypeListSelect<IndexList<Indices_...>, Types_...>
 {
-    using List = typename TypeListFilter<Predicate_, Tail_...>::List
-                 ::template AppendedIf<Predicate_<Head_>::value, Head_>;
+    using List = TypeList<TypeAt<Indices_, Types_...>...>;
 };
 
+template <template <typename> class Predicate_, typename... Types_>
+struct TypeListFilter : TypeListSelect<typename TypeListIndicesMatching<Predicate_, Types_...>::List, Types_...> {};
+
 // Simple type list for storing raw user-defined types.
 
 template <typename... Types_>
 struct TypeList
 {
-    using This = TypeList<Types_...>;
-
-    template <bool Cond_, typename Tail_>
-    using AppendedIf = typename std::conditional<Cond_, TypeList<Types_..., Tail_>,
-                                                        TypeList<Types_...>>::type;
     template <typename T_>
     static constexpr bool contains() { return TypeListContains<T_, Types_...>::value; }
 
@@ -144,8 +237,13 @@ struct TypeList
     template <typename T_>
     static constexpr int index_of() { return IndexOf<T_, Types_...>::value; }
 
+    //! Index of T_ among the types matching Predicate_, without building the filtered list.
     template <typename T_, template <typename> class Predicate_>
-    static constexpr int index_of_where() { return filter<Predicate_>().template index_of<T_>(); }
+    static constexpr int index_of_where()
+    {
+        return index_of<T_>() < 0 || !Predicate_<T_>::value
+             ? -1 : (int)count_flags(PredicateTable<Predicate_, Types_...>::values, 0, (std::size_t)index_of<T_>());
+    }
 
     template <template <typename> class Predicate_>
     static constexpr auto filter() -> typename TypeListFilter<Predicate_, Types_...>::List
@@ -154,15 +252,56 @@ struct TypeList
     }
 
     template <template<typename> class Predicate_>
-    static constexpr auto matching_indices() -> typename TypeListIndicesMatching<This, Predicate_, Types_...>::List
+    static constexpr auto matching_indices() -> typename TypeListIndicesMatching<Predicate_, Types_...>::List
     {
-        return typename TypeListIndicesMatching<This, Predicate_, Types_...>::List{};
+        return typename TypeListIndicesMatching<Predicate_, Types_...>::List{};
     }
 };
 
+template <std::size_t Size_>
+struct FlagArray { bool values[Size_]; };
+
+template <typename Base_, typename... Types_>
+constexpr FlagArray<sizeof...(Types_) + 1> derived_flags(const TypeList<Types_...>*)
+{
+    // The trailing entry keeps the array from being empty.
+    return FlagArray<sizeof...(Types_) + 1>{{ __is_base_of(Base_, Types_)..., false }};
+}
+
+//! Whether or not each type in an API's type list is Base_ or derives from it, indexed by type ID.
+//!
+//! Every class in an API gets one of these, so it's kept cheap for big APIs: the builtin doesn't
+//! instantiate a template per pair of types like std::is_base_of does, and the table is named
+//! by List_, which is short when the list is a named lc::TypeSet, rather than by the whole list.
+//!
+template <typename Base_, typename List_>
+struct DerivedTable
+{
+    static constexpr FlagArray<List_::size() + 1> flags = derived_flags<Base_>((const List_*)nullptr);
+
+    static LC_FORCE_INLINE bool at(std::size_t index) { return index + 1 < sizeof(flags.values) && flags.values[index]; }
+};
+
+template <typename Base_, typename List_>
+constexpr FlagArray<List_::size() + 1> DerivedTable<Base_, List_>::flags;
+
+//! Stands in for plain structs in API type-lists, so that they aren't mistaken for classes.
+template <typename T_>
+struct StructTag { using Type = T_; };
+
 template <typename T_>
 struct HasMetatable : std::integral_constant<bool, std::is_class<T_>::value> {};
 
+template <typename T_>
+struct HasMetatable<StructTag<T_>> : std::false_type {};
+
+//! Stands in for classes bound as handles (see lc_handle.hpp) in API type-lists.
+template <typename T_>
+struct HandleTag { using Type = T_; };
+
+template <typename T_>
+struct HasMetatable<HandleTag<T_>> : std::false_type {};
+
 template <typename TypeList_, typename T_>
 constexpr int metatable_index() { return TypeList_::template index_of_where<T_, HasMetatable>(); }
 
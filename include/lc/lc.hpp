@@ -1,11 +1,21 @@
 #ifndef LC_HPP
 #define LC_HPP
 
+#include <memory>
 #include <vector>
-#include <tuple>
 #include <lc/detail/lc_stack.hpp>
 
-#define LC_METHOD(name, ptr) lc::Method<decltype(ptr), ptr>(name)
+// Defining LC_COMPACT_BINDINGS makes every LC_METHOD() an lc::CompactMethod (see lc_compact.hpp).
+#if defined(LC_COMPACT_BINDINGS)
+    #define LC_METHOD(name, ptr) lc::CompactMethod<decltype(ptr), ptr>(name)
+#else
+    #define LC_METHOD(name, ptr) lc::Method<decltype(ptr), ptr>(name)
+#endif
+// Defining LC_RECORD_CALLS makes every method wrapper report its calls to a recorder (see lc_record.hpp).
+#if defined(LC_RECORD_CALLS)
+    #include <lc/lc_record.hpp>
+#endif
+#define LC_FIELD(name, ptr) lc::Field<decltype(ptr), ptr>(name)
 // @Temporary until we replace vector?
 #define LC_EXPAND_EMPLACE(vec, ...)\
 do {\
@@ -23,13 +33,19 @@ do {\
 namespace lc
 {
 
+// Defined in lc_snapshot.hpp
+class SnapshotWriter;
+class SnapshotReader;
+
 namespace detail
 {
 
+//! \tparam Handle_ Whether the class is bound as handles. See lc_handle.hpp for that specialization.
 template <ApiId ApiId_,
           TypeId ClassId_,
           typename Class_,
-          size_t NumArgs_>
+          size_t NumArgs_,
+          bool Handle_ = false>
 struct MethodCallWrapperBase
 {
     static constexpr size_t num_expanded_args() { return NumArgs_ + 1; } // +1 for the instance.
@@ -40,11 +56,12 @@ struct MethodCallWrapperBase
         int numArgs = lua_gettop(L);
         if (numArgs != num_expanded_args()) luaL_error(L, "In function '%s': expected %d arguments(including self), got %d",
                                                        function_name(L), num_expanded_args(), numArgs);
-        if (!lua_isuserdata(L, 1)) luaL_argerror(L, 1, "expected instance. Did you forget to call with ':'?");
+        if (lua_type(L, 1) != LUA_TUSERDATA) luaL_argerror(L, 1, "expected instance. Did you forget to call with ':'?");
 
         UserDataContents* contents = (UserDataContents*)lua_touserdata(L, 1);
         if (contents->apiId != ApiId_) luaL_argerror(L, 1, "invalid instance(bad API ID)");
         if (contents->typeId != ClassId_) luaL_argerror(L, 1, "invalid instance(bad type ID)");
+        if (!contents->instance) luaL_argerror(L, 1, "invalid instance(moved)");
 
         return (Class_*)contents->instance;
     }
@@ -56,17 +73,20 @@ template <ApiId ApiId_,
           typename Result_,
           typename Class_,
           typename... Args_>
-struct MethodCallWrapper : MethodCallWrapperBase<ApiId_, ClassId_, Class_, sizeof...(Args_)>
+struct MethodCallWrapper : MethodCallWrapperBase<ApiId_, ClassId_, Class_, sizeof...(Args_), is_handle_type<Class_*, TypeSet_>::value>
 {
-    using Base = MethodCallWrapperBase<ApiId_, ClassId_, Class_, sizeof...(Args_)>;
+    using Base = MethodCallWrapperBase<ApiId_, ClassId_, Class_, sizeof...(Args_), is_handle_type<Class_*, TypeSet_>::value>;
     using Pointer = Result_(Class_::*)(Args_...);
     using Class = Class_;
     using Result = Result_;
+    using Fused = FusedArgs<TypeSet_, ApiId_, Args_...>;
 
     // Note: we can't pass the pointer type to the base class, typedef it, and use it here
     // due to a bug in MSVC; you end up with "cannot convert overloaded-function to lua_CFunction" errors,
     // presumably b/c it's just too much type indirection for it to handle.
 
+    // Numeric arguments are read and validated together, before the call (see FusedArgs).
+
     template <Pointer Func_>
     static int call(lua_State* L)
     {
@@ -74,11 +94,13 @@ struct MethodCallWrapper : MethodCallWrapperBase<ApiId_, ClassId_, Class_, sizeo
     }
 
     template <Result_(Class_::*Func_)(Args_...), std::size_t... Indices_>
-    static int LC_FORCE_INLINE call_impl(lua_State* L, detail::IndexSequence<Indices_...>)
+    static int LC_FORCE_INLINE call_impl(lua_State* L, detail::IndexSequence<Indices_...> indices)
     {
         Class_* instance = Base::instance(L);
+        ArgSlot slots[sizeof...(Args_) + 1];
+        Fused::read(L, slots, indices);
         return StackManager<Result_, TypeSet_, ApiId_>::push(L, (instance->*Func_)(
-               detail::StackManager<Args_, TypeSet_, ApiId_>::template at<Indices_ + 2>(L)...));
+               detail::FusedArg<Args_, TypeSet_, ApiId_>::template get<Indices_ + 2>(L, slots[Indices_])...));
     }
 };
 
@@ -88,12 +110,13 @@ template <ApiId ApiId_,
           typename Class_,
           typename... Args_>
 struct MethodCallWrapper<ApiId_, ClassId_, TypeSet_, void, Class_, Args_...>
-       : MethodCallWrapperBase<ApiId_, ClassId_, Class_, sizeof...(Args_)>
+       : MethodCallWrapperBase<ApiId_, ClassId_, Class_, sizeof...(Args_), is_handle_type<Class_*, TypeSet_>::value>
 {
-    using Base = MethodCallWrapperBase<ApiId_, ClassId_, Class_, sizeof...(Args_)>;
+    using Base = MethodCallWrapperBase<ApiId_, ClassId_, Class_, sizeof...(Args_), is_handle_type<Class_*, TypeSet_>::value>;
     using Pointer = void(Class_::*)(Args_...);
     using Class = Class_;
     using Result = void;
+    using Fused = FusedArgs<TypeSet_, ApiId_, Args_...>;
 
     template <Pointer Func_>
     static int call(lua_State* L)
@@ -103,10 +126,12 @@ struct MethodCallWrapper<ApiId_, ClassId_, TypeSet_, void, Class_, Args_...>
     }
 
     template <Pointer Func_, std::size_t... Indices_>
-    static LC_FORCE_INLINE void call_impl(lua_State* L, detail::IndexSequence<Indices_...>)
+    static LC_FORCE_INLINE void call_impl(lua_State* L, detail::IndexSequence<Indices_...> indices)
     {
         Class_* instance = Base::instance(L);
-        (instance->*Func_)(detail::StackManager<Args_, TypeSet_, ApiId_>::template at<Indices_ + 2>(L)...);
+        ArgSlot slots[sizeof...(Args_) + 1];
+        Fused::read(L, slots, indices);
+        (instance->*Func_)(detail::FusedArg<Args_, TypeSet_, ApiId_>::template get<Indices_ + 2>(L, slots[Indices_])...);
     }
 };
 
@@ -126,24 +151,47 @@ auto make_call_wrapper(Result_(Class_::*)(Args_...)) -> MethodCallWrapper<ApiId_
 namespace detail
 {
 
-template <typename ExportFunc_>
-struct ExportPair
+//! What add_methods() keeps of a method until the API is exported. Methods that carry state,
+//! like bound lambdas (see lc_callable.hpp), keep it in data and export with dataExporter.
+//!
+struct MethodExportPair
 {
-    ExportPair()
-        : name(), exporter()
-    {}
-
-    ExportPair(char const* name, ExportFunc_ func)
-        : name(name), exporter(func)
-    {}
+    char const* name = nullptr;
+    void (*exporter)(lua_State* L, char const* name) = nullptr;
+    void (*dataExporter)(lua_State* L, char const* name, const void* data) = nullptr;
+    std::shared_ptr<const void> data;
 
-    bool empty() const { return !name || !exporter; }
+    void export_to(lua_State* L) const
+    {
+        if (dataExporter) dataExporter(L, name, data.get());
+        else exporter(L, name);
+    }
+};
 
-    char const* name;
-    ExportFunc_ exporter;
+//! Makes the MethodExportPair of a method wrapper. Specialized by wrappers that carry state.
+template <typename Method_>
+struct MethodExport
+{
+    template <ApiId ApiId_, TypeId TypeId_, typename TypeSet_>
+    static MethodExportPair pair(const Method_& method)
+    {
+        MethodExportPair result;
+        result.name = method.name();
+        result.exporter = &Method_::template export_to<ApiId_, TypeId_, TypeSet_>;
+        return result;
+    }
 };
 
-using MethodExportPair = ExportPair<void(*)(lua_State*, char const*, lua_Integer*)>;
+#if !defined(LC_RECORD_CALLS)
+
+//! Pushes a method's wrapper. lc_record.hpp has the version that records calls.
+template <ApiId ApiId_, TypeId TypeId_, typename TypeSet_, typename Pointer_, lua_CFunction Call_>
+LC_FORCE_INLINE void push_method(lua_State* L, char const*)
+{
+    lua_pushcfunction(L, (ScratchCall<method_uses_scratch<TypeSet_, ApiId_, Pointer_>::value, Call_>::function()));
+}
+
+#endif
 
 } // namespace detail
 
@@ -158,24 +206,14 @@ public:
     char const* name() const { return name_; }
 
     template <ApiId ApiId_, TypeId TypeId_, typename TypeSet_>
-    static void export_to(lua_State* L, char const* name, lua_Integer* classMetatables)
+    static void export_to(lua_State* L, char const* name)
     {
         using Wrapper = decltype(detail::make_call_wrapper<ApiId_, TypeId_, TypeSet_>(Pointer_));
-        using Result = typename lc::detail::unqualified_type<typename Wrapper::Result>::type;
         // TODO: static_assert result is a pointer to an API type if result is not a value.
 
-        // If the type doesn't have a metatable, just push and set the function as usual
-        // in the table on top of the stack. This is expected to be resolved at compile-time.
-        if (!lc::detail::HasMetatable<Result>::value) {
-            lua_pushcfunction(L, &Wrapper::template call<Pointer_>);
-            lua_setfield(L, -2, name);
-            return;
-        }
-
-        // If, however, the type DOES have a metatable, the user type stack manager
-        // expects the type's metatable as the function's first upvalue.
-        lua_rawgeti(L, LUA_REGISTRYINDEX, classMetatables[lc::detail::metatable_index<TypeSet_, Result>()]);
-        lua_pushcclosure(L, &Wrapper::template call<Pointer_>, 1);
+        // Results that are API classes find their metatable in the state's type registry,
+        // so the wrapper doesn't need any upvalues.
+        detail::push_method<ApiId_, TypeId_, TypeSet_, PointerType_, &Wrapper::template call<Pointer_>>(L, name);
         lua_setfield(L, -2, name);
     }
 
@@ -183,6 +221,70 @@ private:
     char const* name_;
 };
 
+namespace detail
+{
+
+template <typename>
+struct MemberPointerTraits;
+
+template <typename Class_, typename Member_>
+struct MemberPointerTraits<Member_ Class_::*>
+{
+    using Class = Class_;
+    using Member = Member_;
+};
+
+} // namespace detail
+
+//! A field of a struct registered with lc::Struct. Added with TypeExporter::add_fields().
+template <typename PointerType_, PointerType_ Pointer_>
+class Field
+{
+private:
+    using Class = typename detail::MemberPointerTraits<PointerType_>::Class;
+    using Member = typename detail::MemberPointerTraits<PointerType_>::Member;
+
+public:
+    explicit Field(char const* name)
+        : name_(name)
+    {}
+
+    char const* name() const { return name_; }
+
+    template <ApiId ApiId_, typename TypeSet_>
+    detail::FieldDescriptor descriptor() const
+    {
+        detail::FieldDescriptor result;
+        result.name = name_;
+        result.read = &read<ApiId_, TypeSet_>;
+        result.push = &push<ApiId_, TypeSet_>;
+        result.pushBorrowed = &push_borrowed<ApiId_, TypeSet_>;
+        return result;
+    }
+
+private:
+    template <ApiId ApiId_, typename TypeSet_>
+    static void read(lua_State* L, int index, void* object)
+    {
+        ((Class*)object)->*Pointer_ = detail::StackManager<Member, TypeSet_, ApiId_>::at(L, index);
+    }
+
+    template <ApiId ApiId_, typename TypeSet_>
+    static void push(lua_State* L, const void* object)
+    {
+        detail::StackManager<Member, TypeSet_, ApiId_>::push(L, ((const Class*)object)->*Pointer_);
+    }
+
+    template <ApiId ApiId_, typename TypeSet_>
+    static void push_borrowed(lua_State* L, const void* object)
+    {
+        detail::ElementPusher<Member, TypeSet_, ApiId_>::push(L, ((const Class*)object)->*Pointer_);
+    }
+
+private:
+    char const* name_;
+};
+
 struct NullFactory {};
 
 template <typename T_, typename... CtorArgs_>
@@ -204,6 +306,7 @@ class Class
 public:
     using Type = Type_;
     using Factory = Factory_;
+    using ListType = Type_;
 
 public:
     explicit Class(char const* name)
@@ -223,6 +326,7 @@ class Enum
 public:
     using Type = Type_;
     using Factory = Factory_;
+    using ListType = Type_;
 
 public:
     explicit Enum(char const* name)
@@ -235,6 +339,28 @@ private:
     char const* name_;
 };
 
+//! A plain struct that is converted to and from a table, field by field, whenever it is
+//! passed to or returned from a method. It has to be default constructible and copyable.
+//!
+template <class Type_>
+class Struct
+{
+public:
+    using Type = Type_;
+    using Factory = NullFactory;
+    using ListType = detail::StructTag<Type_>;
+
+public:
+    explicit Struct(char const* name)
+        : name_(name)
+    {}
+
+    char const* name() const { return name_; }
+
+private:
+    char const* name_;
+};
+
 namespace detail
 {
 struct RawEnumValue 
@@ -271,8 +397,173 @@ enum SpecialKeys : lua_Integer
     TYPE_NAMES
 };
 
+enum TypeKind : uint8_t
+{
+    TYPE_KIND_CLASS,
+    TYPE_KIND_ENUM,
+    TYPE_KIND_STRUCT,
+    TYPE_KIND_HANDLE
+};
+
+//! What is known about an API type at runtime, indexed by type ID.
+//! Filled out by the ExporterSet when it is exported.
+//!
+struct RuntimeTypeInfo
+{
+    char const* name = nullptr;
+    TypeKind kind = TYPE_KIND_CLASS;
+
+    // Snapshot hooks (classes only). Null if the class can't be serialized.
+    const void* exporter = nullptr;
+    void (*save)(const void* exporter, const void* instance, lc::SnapshotWriter& writer) = nullptr;
+    void* (*load)(const void* exporter, lc::SnapshotReader& reader) = nullptr;
+};
+
 }
 
+namespace detail
+{
+
+//! __index of class instances. Upvalue 1 is the class's methods table.
+//! Fields that scripts set on an instance live in a table in its user value, which is only looked at
+//! once the key turns out not to be a method, and only made on the first assignment. Instances that
+//! never get any fields cost nothing extra.
+//!
+inline int instance_index(lua_State* L)
+{
+    // [1]: instance userdata
+    // [2]: key
+    lua_pushvalue(L, 2);
+    if (lua_rawget(L, lua_upvalueindex(1)) != LUA_TNIL) return 1;
+    if (lua_getuservalue(L, 1) != LUA_TTABLE) return 1; // nil
+
+    lua_pushvalue(L, 2);
+    lua_rawget(L, -2);
+    return 1;
+}
+
+//! __newindex of class instances: sets a field in the instance's own table. Methods can't be overwritten,
+//! except on directors (lc_director.hpp), where assigning a function to a method overrides it.
+//!
+template <bool Director_>
+int instance_newindex(lua_State* L)
+{
+    // [1]: instance userdata
+    // [2]: key
+    // [3]: value
+    int valueType = lua_type(L, 3);
+    if (Director_ && (valueType == LUA_TFUNCTION || valueType == LUA_TNIL)) {
+        // Overriding a virtual method, or taking an override back. See lc_director.hpp.
+        ++override_generation();
+    } else {
+        lua_pushvalue(L, 2);
+        if (lua_rawget(L, lua_upvalueindex(1)) != LUA_TNIL) {
+            luaL_error(L, "attempt to assign to method '%s' of an instance",
+                       lua_type(L, 2) == LUA_TSTRING ? lua_tostring(L, 2) : "?");
+        }
+        lua_pop(L, 1);
+    }
+
+    if (lua_getuservalue(L, 1) != LUA_TTABLE) {
+        // Clearing a field that was never set doesn't need a table.
+        if (lua_isnil(L, 3)) return 0;
+
+        lua_pop(L, 1);
+        lua_createtable(L, 0, 1);
+        lua_pushvalue(L, -1);
+        lua_setuservalue(L, 1);
+    }
+
+    // [4]: fields table
+    lua_insert(L, 2);
+    lua_rawset(L, 2);
+    return 0;
+}
+
+//! Sanity checks for exporting a class. They're kept out of the exporter templates so that
+//! assert messages don't spell out the whole API type list once per class.
+inline void check_class_export(char const* name, bool hasConstructor)
+{
+    // TODO: handle this better.
+    assert(name && *name && "Attempted to export a class without a name.");
+    assert(hasConstructor && "Attempted to export a class without a constructor.");
+    (void)name;
+    (void)hasConstructor;
+}
+
+//! Construction and destruction of class instances, shared by every way of exporting a class.
+template <ApiId ApiId_,
+          TypeId TypeId_,
+          typename Type_,
+          typename Factory_,
+          typename TypeSet_>
+struct ClassLifecycle
+{
+    //! __call metamethod of the class table. The instance metatable is upvalue 1.
+    template <typename... Args_>
+    static int construct(lua_State* L)
+    {
+        return construct_impl<Args_...>(L, typename detail::BuildIndexSequence<sizeof...(Args_)>::Type{});
+    }
+
+    template <typename... Args_, std::size_t... Indices_>
+    static int construct_impl(lua_State* L, detail::IndexSequence<Indices_...>)
+    {
+        size_t numArgs = lua_gettop(L);
+        if (numArgs != sizeof...(Args_) + 1) luaL_error(L, "In constructor for type '%s': expected %d arguments, got %d",
+                                                        detail::function_name(L), sizeof...(Args_), numArgs-1);
+        Type_* instance = Factory_::make(detail::StackManager<Args_, TypeSet_, ApiId_>::template at<Indices_ + 2>(L)...);
+        if (!instance) return luaL_error(L, "Failed to allocate object(API ID: %u, Type ID: %u).", ApiId_, TypeId_);
+
+        UserDataContents* contents = (UserDataContents*)lua_newuserdata(L, sizeof(UserDataContents));
+        contents->apiId = ApiId_;
+        contents->typeId = TypeId_;
+        contents->instance = instance;
+
+        // [1]: class table
+        // [2]: new userdata
+        lua_pushvalue(L, lua_upvalueindex(1));
+        lua_setmetatable(L, -2);
+        // [1]: class table
+        // [2]: new userdata
+        if (NativeSize<Type_>::enabled) detail::add_native_memory(L, NativeSize<Type_>::of(*instance));
+        detail::DirectorBinding<Type_>::bind(L, instance);
+        return 1;
+    }
+
+    static int gc(lua_State* L)
+    {
+        UserDataContents* contents = (UserDataContents*)lua_touserdata(L, -1);
+        if (!contents->instance) return 0; // Moved out.
+
+        if (NativeSize<Type_>::enabled) detail::remove_native_memory(L, NativeSize<Type_>::of(*(Type_*)contents->instance));
+#if defined(LC_RECORD_CALLS)
+        detail::record_free(L, contents->instance);
+#endif
+        Factory_::free((Type_*)contents->instance);
+        return 0;
+    }
+
+    //! __close metamethod of classes that enable it: frees the instance as soon as a to-be-closed
+    //! variable holding it goes out of scope. The userdata is left empty, like a moved instance.
+    //!
+    static int close(lua_State* L)
+    {
+        UserDataContents* contents = (UserDataContents*)lua_touserdata(L, 1);
+        if (!contents->instance) return 0;
+
+        if (NativeSize<Type_>::enabled) detail::remove_native_memory(L, NativeSize<Type_>::of(*(Type_*)contents->instance));
+#if defined(LC_RECORD_CALLS)
+        detail::record_free(L, contents->instance);
+#endif
+        Factory_::free((Type_*)contents->instance);
+        contents->instance = nullptr;
+        return 0;
+    }
+};
+
+} // namespace detail
+
 template <ApiId ApiId_,
           TypeId TypeId_,
           typename Type_,
@@ -304,6 +595,7 @@ public:
 
 private:
     using CtorExportFunc = void(*)(lua_State* L);
+    using Lifecycle = detail::ClassLifecycle<ApiId_, TypeId_, Type_, Factory_, TypeSet_>;
 
     template <typename... Args_>
     struct CtorExporter
@@ -314,74 +606,26 @@ private:
             // [-2]: methods table
             // [-1]: class metatable
             lua_pushvalue(L, -3);
-            lua_pushcclosure(L, &call_metamethod, 1);
+            lua_pushcclosure(L, &Lifecycle::template construct<Args_...>, 1);
             lua_setfield(L, -2, "__call");
             lua_pushvalue(L, -2);
             // [-4]: instance metatable
             // [-3]: methods table
             // [-2]: class metatable
             // [-1]: methods table (copy)
-            lua_pushcclosure(L, &index_metamethod, 1);
+            lua_pushcclosure(L, &detail::instance_index, 1);
             // [-4]: instance metatable
             // [-3]: methods table
             // [-2]: class metatable
             // [-1]: index metamethod
             lua_setfield(L, -4, "__index");
-            lua_pushcfunction(L, &gc_metamethod);
+            lua_pushvalue(L, -2);
+            lua_pushcclosure(L, &detail::instance_newindex<std::is_base_of<DirectorBase, Type_>::value>, 1);
+            lua_setfield(L, -4, "__newindex");
+            lua_pushcfunction(L, &Lifecycle::gc);
             lua_setfield(L, -4, "__gc");
             // [-3..-1]: what we started with.
         }
-
-        static int call_metamethod(lua_State* L)
-        {
-            return call_metamethod_impl(L, typename detail::BuildIndexSequence<sizeof...(Args_)>::Type{});
-        }
-
-        template <std::size_t... Indices_>
-        static int call_metamethod_impl(lua_State* L, detail::IndexSequence<Indices_...>)
-        {
-            using Contents = lc::detail::UserDataContents;
-            size_t numArgs = lua_gettop(L);
-            if (numArgs != sizeof...(Args_) + 1) luaL_error(L, "In constructor for type '%s': expected %d arguments, got %d",
-                                                            detail::function_name(L), sizeof...(Args_), numArgs-1);
-            Type* instance = Factory::make(detail::StackManager<Args_, TypeSet_, ApiId_>::template at<Indices_ + 2>(L)...);
-            if (!instance) return luaL_error(L, "Failed to allocate object(API ID: %u, Type ID: %u).", api_id(), type_id());
-
-            Contents contents;
-            contents.apiId = api_id();
-            contents.typeId = type_id();
-            contents.instance = instance;
-
-            Contents* uData = (Contents*)lua_newuserdata(L, sizeof(contents));
-            *uData = contents;
-
-            // [1]: class table
-            // [2]: new userdata
-            // lua_rawgeti(L, 1, detail::SpecialKeys::INSTANCE_METATABLE);
-            lua_pushvalue(L, lua_upvalueindex(1));
-            lua_setmetatable(L, -2);
-            // [1]: class table
-            // [2]: new userdata
-            return 1;
-        }
-
-        // @Optimization: the same one can be used for all classes.
-        static int index_metamethod(lua_State* L)
-        {
-            // [1]: instance userdata
-            // [2]: method name
-            lua_pushvalue(L, lua_upvalueindex(1)); // push the _methods table
-            lua_getfield(L, -1, lua_tostring(L, -2)); // get the method, or nil
-            return 1;
-        }
-
-        static int gc_metamethod(lua_State* L)
-        {
-            using Contents = lc::detail::UserDataContents;
-            Contents* contents = (Contents*)lua_touserdata(L, -1);
-            Factory_::free((Type*)contents->instance);
-            return 0;
-        }
     };
 
     struct OperatorExporter
@@ -394,9 +638,14 @@ private:
         }
     };
 
+public:
+    using SaveHook = void(*)(const Type_& instance, lc::SnapshotWriter& writer);
+    using LoadHook = Type_*(*)(lc::SnapshotReader& reader);
+
 public:
     explicit TypeExporter(char const* name)
-        : name_(name), methodsTable_(LUA_NOREF)
+        : name_(name), ctorExportFunc_(nullptr), methodsTable_(LUA_NOREF), saveHook_(nullptr), loadHook_(nullptr),
+          closeable_(false)
     {}
 
     char const* name() const { return name_; }
@@ -411,17 +660,47 @@ public:
     void add_methods(Methods_... methods)
     {
         methodExportPairs_.reserve(sizeof...(Methods_));
-        LC_EXPAND_EMPLACE(methodExportPairs_, methods.name(),
-                          methods.template export_to<ApiId_, TypeId_, TypeSet_>);
+        LC_EXPAND_PUSH_BACK(methodExportPairs_, (detail::MethodExport<Methods_>::template pair<ApiId_, TypeId_, TypeSet_>(methods)));
+    }
+
+    //! Lets instances of this class be written to and restored from snapshots (see lc_snapshot.hpp).
+    //! The load hook has to return an instance that Factory_::free() can free, or nullptr on failure.
+    //!
+    void set_serializer(SaveHook save, LoadHook load)
+    {
+        saveHook_ = save;
+        loadHook_ = load;
+    }
+
+    //! Lets scripts free instances deterministically, with Lua 5.4's to-be-closed variables:
+    //!
+    //!     local file <close> = Api.File("log.txt")
+    //!
+    //! Instances are freed when the variable goes out of scope, even by an error, and calling
+    //! their methods afterwards is an error. Only instances that Lua owns are freed this way.
+    //! It changes nothing under Lua 5.3, which has no to-be-closed variables.
+    //!
+    void enable_close() { closeable_ = true; }
+
+    detail::RuntimeTypeInfo runtime_type_info() const
+    {
+        detail::RuntimeTypeInfo result;
+        result.name = name_;
+        result.kind = detail::TYPE_KIND_CLASS;
+        if (saveHook_ && loadHook_) {
+            result.exporter = this;
+            result.save = &save_trampoline;
+            result.load = &load_trampoline;
+        }
+
+        return result;
     }
 
     // During this phase, we are responsible for exporting our type to the lua state
-    // along with type information (TODO) and storing our instance metatable in the list.
-    void export_meta(lua_State* L, lua_Integer* classMetatables) const
+    // along with type information (TODO) and storing our instance metatable in the type registry.
+    void export_meta(lua_State* L, int typeRegistry) const
     {
-        // TODO: handle this better.
-        assert(name_ && *name_ && "Attempted to export a class without a name.");
-        assert(ctorExportFunc_ && "Attempted to export a class without a constructor.");
+        detail::check_class_export(name_, ctorExportFunc_ != nullptr);
 
         // [1]: API table
         lua_newtable(L); // class table
@@ -435,7 +714,7 @@ public:
         // [4]: instance methods table
         // [5]: class metatable
         ctorExportFunc_(L); // Export the constructor (added to the class metatable).
-        lua_setmetatable(L, 2); // Done with the class metatable, set it.
+        lua_setmetatable(L, -4); // Done with the class metatable, set it.
 
         // [1]: API table
         // [2]: class table
@@ -444,7 +723,15 @@ public:
         methodsTable_ = luaL_ref(L, LUA_REGISTRYINDEX);
         // Export Lua compatible operators to the instance metatable.
         OperatorExporter::export_to(L);
-        classMetatables[lc::detail::metatable_index<TypeSet, Type>()] = luaL_ref(L, LUA_REGISTRYINDEX);
+        if (closeable_) {
+            lua_pushcfunction(L, &Lifecycle::close);
+            lua_setfield(L, -2, "__close");
+        }
+        if (NativeSize<Type>::enabled) {
+            lua_pushlightuserdata(L, (void*)detail::native_size_hook<Type>());
+            lua_rawsetp(L, -2, detail::NativeSizeHook::key());
+        }
+        detail::register_type<Type>(L, typeRegistry, TypeId_);
 
         // [1]: API table
         // [2]: class table
@@ -454,22 +741,38 @@ public:
     }
 
     // Presumably, by the time this function is called, all of the metatables are filled out.
-    void export_other(lua_State* L, lua_Integer* classMetatables) const
+    void export_other(lua_State* L, int) const
     {
         // [1]: API table.
-        // Grab the methods table, fill it, and pop it back off.
+        // Grab the methods table, fill it, and pop it back off. The class table goes under it,
+        // for methods that add functions to the class too (see lc_batch.hpp).
+        lua_getfield(L, -1, name_);
         lua_rawgeti(L, LUA_REGISTRYINDEX, methodsTable_);
         for (const detail::MethodExportPair& p : methodExportPairs_)
-            p.exporter(L, p.name, classMetatables);
-        lua_pop(L, 1);
+            p.export_to(L);
+        lua_pop(L, 2);
         // [1]: API table.
     }
 
+private:
+    static void save_trampoline(const void* exporter, const void* instance, lc::SnapshotWriter& writer)
+    {
+        ((const TypeExporter*)exporter)->saveHook_(*(const Type_*)instance, writer);
+    }
+
+    static void* load_trampoline(const void* exporter, lc::SnapshotReader& reader)
+    {
+        return ((const TypeExporter*)exporter)->loadHook_(reader);
+    }
+
 private:
     char const* name_;
     CtorExportFunc ctorExportFunc_;
     std::vector<detail::MethodExportPair> methodExportPairs_;
     mutable lua_Integer methodsTable_;
+    SaveHook saveHook_;
+    LoadHook loadHook_;
+    bool closeable_;
 };
 
 //! Type exporter for enums.
@@ -501,8 +804,21 @@ public:
         LC_EXPAND_PUSH_BACK(values_, (lc::detail::RawEnumValue)values);
     }
 
-    void export_meta(lua_State*, lua_Integer*) const {}
-    void export_other(lua_State* L, lua_Integer*) const
+    detail::RuntimeTypeInfo runtime_type_info() const
+    {
+        detail::RuntimeTypeInfo result;
+        result.name = name_;
+        result.kind = detail::TYPE_KIND_ENUM;
+        return result;
+    }
+
+    void export_meta(lua_State* L, int typeRegistry) const
+    {
+        lua_pushnil(L); // No metatable.
+        detail::register_type<Type>(L, typeRegistry, TypeId_);
+    }
+
+    void export_other(lua_State* L, int) const
     {
         // No point in exporting if there aren't any values...
         if (values_.empty()) return;
@@ -514,7 +830,7 @@ public:
 
             // @Space, @Slow. This is a wasteful implementation. This way, each stores
             // an api id and type id, when they could all reference the same ones.
-            Contents* contents = (Contents*)lua_newuserdata(L, sizeof(Contents));
+            Contents* contents = (Contents*)detail::new_userdata(L, sizeof(Contents), 0);
             contents->apiId = ApiId_;
             contents->typeId = TypeId_;
             contents->value = (lua_Integer)v.value;
@@ -528,40 +844,117 @@ private:
     std::vector<lc::detail::RawEnumValue> values_;
 };
 
-namespace detail
+//! Type exporter for structs.
+template <ApiId ApiId_,
+          TypeId TypeId_,
+          typename Type_,
+          typename Factory_,
+          typename TypeSet_>
+class TypeExporter<ApiId_, TypeId_, Type_, Factory_, TypeSet_, lc::Struct<Type_>>
 {
+public:
+    using Type = Type_;
+    using Factory = Factory_;
+    using Wrapper = lc::Struct<Type_>;
 
-template <std::size_t Index_>
-struct ExporterCaller
-{
-    template <typename Tuple_>
-    static LC_FORCE_INLINE void export_meta(const Tuple_& t, lua_State* L, lua_Integer* classMetatables)
+    static constexpr ApiId api_id() { return ApiId_; }
+    static constexpr TypeId type_id() { return TypeId_; }
+
+public:
+    explicit TypeExporter(char const* name)
+        : name_(name)
+    {}
+
+    char const* name() const { return name_; }
+
+    template <typename... Fields_>
+    void add_fields(Fields_... fields)
     {
-        std::get<Index_>(t).export_meta(L, classMetatables);
-        ExporterCaller<Index_-1>::export_meta(t, L, classMetatables);
+        fields_.reserve(fields_.size() + sizeof...(Fields_));
+        LC_EXPAND_PUSH_BACK(fields_, (fields.template descriptor<ApiId_, TypeSet_>()));
     }
 
-    template <typename Tuple_>
-    static LC_FORCE_INLINE void export_other(const Tuple_& t, lua_State* L, lua_Integer* classMetatables)
+    detail::RuntimeTypeInfo runtime_type_info() const
     {
-        std::get<Index_>(t).export_other(L, classMetatables);
-        ExporterCaller<Index_-1>::export_other(t, L, classMetatables);
+        detail::RuntimeTypeInfo result;
+        result.name = name_;
+        result.kind = detail::TYPE_KIND_STRUCT;
+        return result;
     }
-};
 
-template <>
-struct ExporterCaller<0>
-{
-    template <typename Tuple_>
-    static LC_FORCE_INLINE void export_meta(const Tuple_& t, lua_State* L, lua_Integer* classMetatables)
+    void export_meta(lua_State* L, int typeRegistry) const
+    {
+        lua_pushnil(L); // No metatable.
+        detail::register_type<Type>(L, typeRegistry, TypeId_);
+    }
+
+    void export_other(lua_State* L, int) const
     {
-        std::get<0>(t).export_meta(L, classMetatables);
+        // See StructStackManager for the layout.
+        structFields_.data = fields_.data();
+        structFields_.size = fields_.size();
+
+        int numFields = (int)fields_.size();
+        lua_createtable(L, numFields, 1);
+        lua_pushlightuserdata(L, (void*)&structFields_);
+        lua_rawseti(L, -2, 0);
+        for (int i = 0; i < numFields; i++) {
+            lua_pushstring(L, fields_[i].name);
+            lua_rawseti(L, -2, i + 1);
+        }
+        lua_rawsetp(L, LUA_REGISTRYINDEX, detail::StructInfoKey<ApiId_, TypeId_>::value());
     }
 
+private:
+    char const* name_;
+    std::vector<detail::FieldDescriptor> fields_;
+    mutable detail::StructFields structFields_;
+};
+
+namespace detail
+{
+
+//! The exporting functions of one type exporter. Exporting goes through a table of these, so that
+//! ExporterSet::export_to() is a few loops rather than a call, usually inlined, per type per phase.
+struct ExporterFunctions
+{
+    void (*exportMeta)(const void*, lua_State*, int);
+    void (*exportOther)(const void*, lua_State*, int);
+    RuntimeTypeInfo (*runtimeTypeInfo)(const void*);
+};
+
+template <typename T_>
+struct ExporterFunctionsFactory
+{
+    static void export_meta(const void* p, lua_State* L, int typeRegistry) { ((const T_*)p)->export_meta(L, typeRegistry); }
+    static void export_other(const void* p, lua_State* L, int typeRegistry) { ((const T_*)p)->export_other(L, typeRegistry); }
+    static RuntimeTypeInfo runtime_type_info(const void* p) { return ((const T_*)p)->runtime_type_info(); }
+
+    static constexpr ExporterFunctions make() { return ExporterFunctions{&export_meta, &export_other, &runtime_type_info}; }
+};
+
+template <typename>
+struct ExporterCaller;
+
+template <std::size_t... Indices_>
+struct ExporterCaller<IndexSequence<Indices_...>>
+{
+    //! Runs all of the phases of exporting over every exporter in a tuple, in type ID order.
     template <typename Tuple_>
-    static LC_FORCE_INLINE void export_other(const Tuple_& t, lua_State* L, lua_Integer* classMetatables)
+    static void export_all(const Tuple_& t, lua_State* L, int typeRegistry, RuntimeTypeInfo* info)
     {
-        std::get<0>(t).export_other(L, classMetatables);
+        static const ExporterFunctions functions[] = {
+            ExporterFunctionsFactory<typename std::decay<decltype(tuple_get<Indices_>(t))>::type>::make()...
+        };
+        const void* const exporters[] = { &tuple_get<Indices_>(t)... };
+        constexpr std::size_t count = sizeof...(Indices_);
+
+        for (std::size_t i = 0; i < count; i++)
+            functions[i].exportMeta(exporters[i], L, typeRegistry);
+        for (std::size_t i = 0; i < count; i++)
+            info[i] = functions[i].runtimeTypeInfo(exporters[i]);
+        for (std::size_t i = 0; i < count; i++)
+            functions[i].exportOther(exporters[i], L, typeRegistry);
     }
 };
 
@@ -570,7 +963,10 @@ struct ExporterSetWrapper
     void* exporterSet = nullptr;
     void (*exportFunc)(void*, lua_State*) = nullptr;
     void (*free)(void*) = nullptr;
+    const RuntimeTypeInfo* (*typeInfoFunc)(const void*) = nullptr;
+    std::size_t typeCount = 0;
     void export_to(lua_State* L) { exportFunc(exporterSet, L); }
+    const RuntimeTypeInfo* type_info() const { return exporterSet ? typeInfoFunc(exporterSet) : nullptr; }
 
     void delete_and_null()
     {
@@ -586,6 +982,7 @@ struct ExporterSetWrapperFactory
 {
     static void export_to(void* p, lua_State* L) { ((T_*)p)->export_to(L); }
     static void free(void* p) { delete ((T_*)p); }
+    static const RuntimeTypeInfo* type_info(const void* p) { return ((const T_*)p)->type_info(); }
 };
 
 template <typename T_>
@@ -598,35 +995,92 @@ static lc::detail::ExporterSetWrapper wrap_exporter_set(T_* exporterSet)
     result.exporterSet = exporterSet;
     result.exportFunc = &Factory::export_to;
     result.free = &Factory::free;
+    result.typeInfoFunc = &Factory::type_info;
+    result.typeCount = T_::type_count();
     return result;
 }
 
+//! Something set up in every state an API is exported to, alongside its types.
+struct Attachment
+{
+    const void* object = nullptr;
+    void (*exportFunc)(const void*, lua_State*) = nullptr;
+    void export_to(lua_State* L) const { exportFunc(object, L); }
+};
+
+template <typename T_>
+struct AttachmentFactory
+{
+    static void export_to(const void* p, lua_State* L) { ((const T_*)p)->export_to(L); }
+};
+
 } // namespace detail
 
-template <typename... TypeExporters_>
+namespace detail
+{
+
+template <ApiId ApiId_, typename TypeSet_, typename, typename... Wrappers_>
+struct TypeSetExporters;
+
+template <ApiId ApiId_, typename TypeSet_, std::size_t... Indices_, typename... Wrappers_>
+struct TypeSetExporters<ApiId_, TypeSet_, IndexSequence<Indices_...>, Wrappers_...>
+{
+    using Tuple = FlatTuple<TypeExporter<ApiId_, Indices_, typename Wrappers_::Type, typename Wrappers_::Factory,
+                                         TypeSet_, Wrappers_>...>;
+
+    //! Maps each type to its exporter.
+    using Map = TypeMap<TypeMapEntry<typename Wrappers_::Type,
+                                     TypeExporter<ApiId_, Indices_, typename Wrappers_::Type, typename Wrappers_::Factory,
+                                                  TypeSet_, Wrappers_>>...>;
+};
+
+} // namespace detail
+
+//! The types of an API. lc::Api::set_types() makes one out of its arguments, but naming it saves
+//! a lot in big APIs. Otherwise, the whole type list is spelled out in the name of everything
+//! instantiated per type, so object files and compile times grow with the square of the number of types:
+//!
+//!     struct GameTypes : lc::TypeSet<lc::Class<Foo>, lc::Enum<Color>> {};
+//!     auto& types = api.set_types<GameTypes>("Foo", "Color");
+//!
+template <typename... Wrappers_>
+struct TypeSet : detail::TypeList<typename Wrappers_::ListType...>
+{
+    //! The type exporters of an API with these types, in type ID order.
+    //! Self_ is what the exporters see as the API type list.
+    template <ApiId ApiId_, typename Self_>
+    using Exporters = detail::TypeSetExporters<ApiId_, Self_, typename detail::BuildIndexSequence<sizeof...(Wrappers_)>::Type,
+                                               Wrappers_...>;
+};
+
+template <ApiId ApiId_, typename TypeSet_>
 class ExporterSet
 {
 private:
+    // Worked out once per set, so that each lookup in at() is a single deduction.
+    using Exporters = typename TypeSet_::template Exporters<ApiId_, TypeSet_>;
+
+    // A member template rather than an alias, so that at()'s mangled name refers to it
+    // instead of spelling out the whole exporter map.
     template <typename Type_>
-    using ExporterFor = typename detail::TypeFinder<Type_, TypeExporters_...>::Type;
-    using TypeSet = detail::TypeList<typename TypeExporters_::Type...>;
+    struct ExporterFor { using Type = typename detail::TypeFinder<Type_, typename Exporters::Map>::Type; };
 
 public:
-    ExporterSet(std::tuple<TypeExporters_...>&& exporters)
-        : exporters_(exporters)
-    {}
+    //! Takes the name of each type, in order.
+    template <typename... Names_>
+    explicit ExporterSet(Names_... names)
+        : exporters_(names...)
+    {
+        static_assert(sizeof...(Names_) == TypeSet_::size(), "(LC): set_types() needs one name per type in the set.");
+    }
 
     ExporterSet(const ExporterSet&) = delete;
 
     template <class Type_>
-    auto at() -> TypeExporter<ExporterFor<Type_>::api_id(),
-                              ExporterFor<Type_>::type_id(),
-                              typename ExporterFor<Type_>::Type,
-                              typename ExporterFor<Type_>::Factory, TypeSet,
-                              typename ExporterFor<Type_>::Wrapper>&
+    auto at() -> typename ExporterFor<Type_>::Type&
     {
         // Class IDs are just indices in an API's type set.
-        return std::get<ExporterFor<Type_>::type_id()>(exporters_);
+        return detail::tuple_get<ExporterFor<Type_>::Type::type_id()>(exporters_);
     }
 
     void export_to(lua_State* L)
@@ -635,13 +1089,31 @@ public:
         // can register their type names, metatables, etc. somewhere in the lua_State
         // before they register things like methods that depend on API type information
         // and metatables of other types in the API.
-        detail::ExporterCaller<sizeof...(TypeExporters_)-1>::export_meta(exporters_, L, metatables_);
-        detail::ExporterCaller<sizeof...(TypeExporters_)-1>::export_other(exporters_, L, metatables_);
+        //
+        // The type registry maps type IDs to instance metatables for this state (see lc_stack.hpp).
+        // [-2]: type registry
+        // [-1]: API table
+        lua_createtable(L, (int)type_count(), (int)type_count());
+        lua_insert(L, -2);
+        int typeRegistry = lua_absindex(L, -2);
+
+        using Caller = detail::ExporterCaller<typename detail::BuildIndexSequence<type_count()>::Type>;
+        Caller::export_all(exporters_, L, typeRegistry, typeInfo_);
+
+        lua_pushvalue(L, typeRegistry);
+        lua_rawsetp(L, LUA_REGISTRYINDEX, detail::TypeRegistryKey<ApiId_>::value());
+        detail::register_api(L, typeRegistry, ApiId_);
+        lua_remove(L, typeRegistry);
     }
 
+    static constexpr std::size_t type_count() { return std::integral_constant<std::size_t, TypeSet_::size()>::value; }
+
+    //! Runtime information about each type, indexed by type ID. Only valid after export_to().
+    const detail::RuntimeTypeInfo* type_info() const { return typeInfo_; }
+
 private:
-    std::tuple<TypeExporters_...> exporters_;
-    lua_Integer metatables_[TypeSet::template filter<lc::detail::HasMetatable>().size()];
+    typename Exporters::Tuple exporters_;
+    detail::RuntimeTypeInfo typeInfo_[TypeSet_::size()];
 };
 
 template <ApiId ApiId_>
@@ -660,34 +1132,30 @@ public:
     Api(const Api&) = delete;
 
     Api(Api&& other)
-        : name_(other.name_), exporterSet_(other.exporterSet_)
-    {}
+        : name_(other.name_), exporterSet_(other.exporterSet_), attachments_(std::move(other.attachments_))
+    {
+        other.exporterSet_ = lc::detail::ExporterSetWrapper{};
+    }
 
     template <typename... Wrappers_>
-    auto set_types(Wrappers_... wrappers) -> ExporterSet<TypeExporter<ApiId_, detail::IndexOf<Wrappers_, Wrappers_...>::value,
-                                                                      typename Wrappers_::Type,
-                                                                      typename Wrappers_::Factory,
-                                                                      detail::TypeList<typename Wrappers_::Type...>,
-                                                                      Wrappers_>...>&
+    auto set_types(Wrappers_... wrappers) -> ExporterSet<ApiId_, lc::TypeSet<Wrappers_...>>&
     {
-        exporterSet_.delete_and_null();
-
-        auto exporterTuple = std::make_tuple(TypeExporter<ApiId_, detail::IndexOf<Wrappers_, Wrappers_...>::value,
-                                                          typename Wrappers_::Type,
-                                                          typename Wrappers_::Factory,
-                                                          detail::TypeList<typename Wrappers_::Type...>,
-                                                          Wrappers_>(wrappers.name())...);
+        return set_types<lc::TypeSet<Wrappers_...>>(wrappers.name()...);
+    }
 
-        auto* temp = new ExporterSet<TypeExporter<ApiId_, detail::IndexOf<Wrappers_, Wrappers_...>::value,
-                                      typename Wrappers_::Type,
-                                      typename Wrappers_::Factory,
-                                      detail::TypeList<typename Wrappers_::Type...>,
-                                      Wrappers_>...>(std::move(exporterTuple));
+    //! Sets the types from a named lc::TypeSet, with a name for each type in the set, in order.
+    template <typename TypeSet_, typename... Names_>
+    auto set_types(Names_... names) -> ExporterSet<ApiId_, TypeSet_>&
+    {
+        exporterSet_.delete_and_null();
 
+        auto* temp = new ExporterSet<ApiId_, TypeSet_>(names...);
         exporterSet_ = lc::detail::wrap_exporter_set(temp);
         return *temp;
     }
 
+    char const* name() const { return name_; }
+
     void export_to(lua_State* L)
     {
         // If the API is named, push/use a new table. Otherwise, just use the global table.
@@ -702,11 +1170,38 @@ public:
             exporterSet_.export_to(L);
             lua_pop(L, 1);
         }
+
+        for (const lc::detail::Attachment& a : attachments_)
+            a.export_to(L);
+    }
+
+    static constexpr ApiId id() { return ApiId_; }
+
+    //! Runtime information about the type with the given ID, as of the last export_to(), or nullptr.
+    const lc::detail::RuntimeTypeInfo* type_info(TypeId typeId) const
+    {
+        const lc::detail::RuntimeTypeInfo* info = exporterSet_.type_info();
+        if (!info || typeId >= exporterSet_.typeCount) return nullptr;
+        return &info[typeId];
+    }
+
+    //! Adds something to set up in every state this API is exported to, after the types are exported.
+    //! Anything with an export_to(lua_State*) const member works, e.g. an lc::Bundle or an lc::BytecodeCache.
+    //! The API only keeps a pointer, so the object has to outlive it.
+    //!
+    template <typename T_>
+    void attach(const T_& object)
+    {
+        lc::detail::Attachment attachment;
+        attachment.object = &object;
+        attachment.exportFunc = &lc::detail::AttachmentFactory<T_>::export_to;
+        attachments_.push_back(attachment);
     }
 
 private:
     char const* name_;
     lc::detail::ExporterSetWrapper exporterSet_;
+    std::vector<lc::detail::Attachment> attachments_;
 };
 
 
@@ -731,6 +1226,85 @@ auto enum_value(char const* name, T_ value) -> lc::EnumValue<T_>
     return lc::EnumValue<T_>{name, value};
 }
 
+//! Pushes an instance of a class from the API with the given ID, from anywhere that has a lua_State,
+//! e.g. from a callback that didn't come from one of the API's wrappers. Like anything else pushed
+//! to Lua, the instance is owned by Lua from then on. A director that's already bound to a userdata
+//! pushes that one, like it does when it's returned from a method.
+//!
+//! \returns 1. nil is pushed if the API hasn't been exported to L or doesn't have a class T_,
+//!          in which case the instance still belongs to the caller.
+//!
+template <ApiId ApiId_ = 0, typename T_>
+auto push(lua_State* L, T_* instance) -> typename std::enable_if<std::is_class<T_>::value, int>::type
+{
+    using Contents = lc::detail::UserDataContents;
+    if (!instance) {
+        lua_pushnil(L);
+        return 1;
+    }
+    if (lc::detail::DirectorBinding<T_>::push_bound(L, instance)) return 1;
+    if (lua_rawgetp(L, LUA_REGISTRYINDEX, lc::detail::TypeRegistryKey<ApiId_>::value()) != LUA_TTABLE) {
+        lua_pop(L, 1);
+        lua_pushnil(L);
+        return 1;
+    }
+
+    // [-1]: type registry
+    int typeRegistry = lua_gettop(L);
+    if (lua_rawgetp(L, typeRegistry, lc::detail::TypeKey<T_>::value()) != LUA_TNUMBER
+        || lua_rawgeti(L, typeRegistry, lua_tointeger(L, -1) + 1) != LUA_TTABLE) {
+        // Not a class from this API (or a struct).
+        lua_settop(L, typeRegistry - 1);
+        lua_pushnil(L);
+        return 1;
+    }
+
+    // [-3]: type registry
+    // [-2]: type ID
+    // [-1]: instance metatable
+    Contents* contents = (Contents*)lua_newuserdata(L, sizeof(Contents));
+    contents->apiId = ApiId_;
+    contents->typeId = (TypeId)lua_tointeger(L, -3);
+    contents->instance = instance;
+    lua_insert(L, -2);
+    lua_setmetatable(L, -2);
+    lua_replace(L, typeRegistry);
+    lua_settop(L, typeRegistry);
+
+    if (NativeSize<T_>::enabled) lc::detail::add_native_memory(L, NativeSize<T_>::of(*instance));
+    lc::detail::DirectorBinding<T_>::bind(L, instance);
+    return 1;
+}
+
+//! Pushes a value of an enum class from the API with the given ID. See above.
+template <ApiId ApiId_ = 0, typename T_>
+auto push(lua_State* L, T_ value) -> typename std::enable_if<std::is_enum<T_>::value, int>::type
+{
+    using Contents = lc::detail::EnumClassContents;
+    int top = lua_gettop(L);
+    if (lua_rawgetp(L, LUA_REGISTRYINDEX, lc::detail::TypeRegistryKey<ApiId_>::value()) != LUA_TTABLE
+        || lua_rawgetp(L, -1, lc::detail::TypeKey<T_>::value()) != LUA_TNUMBER) {
+        lua_settop(L, top);
+        lua_pushnil(L);
+        return 1;
+    }
+
+    // [-2]: type registry
+    // [-1]: type ID
+    TypeId typeId = (TypeId)lua_tointeger(L, -1);
+    lua_pop(L, 2);
+
+    Contents* contents = (Contents*)lc::detail::new_userdata(L, sizeof(Contents), 0);
+    contents->apiId = ApiId_;
+    contents->typeId = typeId;
+    contents->value = (lua_Integer)value;
+    return 1;
+}
+
 } // namespace lc
 
+#if defined(LC_COMPACT_BINDINGS)
+    #include <lc/lc_compact.hpp>
+#endif
+
 #endif // LC_HPP
@@ -0,0 +1,525 @@
+#ifndef LC_ASYNC_HPP
+#define LC_ASYNC_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <future>
+#include <new>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <lc/lc.hpp>
+
+//! \file
+//! \brief Methods that return futures, and the scheduler that resumes the coroutines waiting on them.
+//!
+//! An async method is bound like any other method, except that it returns an awaitable
+//! (anything with an lc::AwaitableTraits specialization, std::future by default).
+//! When it is called from a task spawned on an lc::Scheduler and the result isn't ready yet,
+//! the calling coroutine yields, and the scheduler resumes it with the converted result later.
+//! Called from anywhere else, it just blocks on the result.
+//!
+//! Schedulers can also preempt tasks, so that a script stuck in a loop can't stall the others:
+//! with a quota set (see Scheduler::set_quota()), a count hook makes each task yield once it has
+//! used up its slice of instructions or time, and it's resumed again on the next round.
+//!
+
+#define LC_ASYNC_METHOD(name, ptr) lc::AsyncMethod<decltype(ptr), ptr>(name)
+
+namespace lc
+{
+
+//! Describes how to poll an awaitable and extract its result.
+//! Specialize this for your own awaitable types.
+//!
+//! ready() must never block. get() is called at most once, and may block
+//! if it is called before ready() returns true.
+//!
+template <typename Awaitable_>
+struct AwaitableTraits
+{
+    static_assert(detail::TypeDependentFalse<Awaitable_>::value,
+    "\n\n(LC): No AwaitableTraits specialization found for the return type of an async method. \n\n");
+};
+
+template <typename T_>
+struct AwaitableTraits<std::future<T_>>
+{
+    using Result = T_;
+
+    static bool ready(std::future<T_>& f) { return f.wait_for(std::chrono::seconds(0)) == std::future_status::ready; }
+    static T_ get(std::future<T_>& f) { return f.get(); }
+};
+
+//! Runs Lua functions as coroutines ("tasks") on a single thread and resumes the ones
+//! suspended in async methods once their results are ready.
+//!
+//! There can be at most one scheduler per lua_State, and it has to be destroyed before the state is closed.
+//!
+class Scheduler
+{
+public:
+    //! Called with the failed task's thread, with the error message on top of its stack.
+    using ErrorHandler = void(*)(lua_State* thread, void* userData);
+
+    //! How long tasks may run before they're preempted. Slices are per resume, and are multiplied by
+    //! the task's priority. Zero means no limit.
+    //!
+    //! Tasks can only be preempted while running Lua code, and not while they're inside a coroutine
+    //! of their own or under a C function that can't be yielded across (e.g. a metamethod called from C).
+    //! Tasks that keep running past killAfter more slices like that are stopped with an error.
+    //!
+    struct Quota
+    {
+        int instructions = 0;
+        std::chrono::nanoseconds time = std::chrono::nanoseconds(0);
+        int checkInterval = 1000; // Instructions between clock checks, when there's a time limit.
+        int killAfter = 0;
+    };
+
+    struct TaskOptions
+    {
+        int priority = 1;         // Quota slices per resume.
+        void* userData = nullptr; // Passed back in TaskStats, e.g. to tell which tenant a task belongs to.
+    };
+
+    //! Time is measured around each resume, on the scheduler's thread, so it includes whatever
+    //! C++ the task called into.
+    //!
+    struct TaskStats
+    {
+        void* userData = nullptr;
+        std::chrono::nanoseconds time = std::chrono::nanoseconds(0);
+        uint64_t resumes = 0;
+        uint64_t preemptions = 0;
+    };
+
+    //! Called for every task that ends, whether it finished or failed.
+    using FinishHandler = void(*)(const TaskStats& stats, bool failed, void* userData);
+
+private:
+    using PollFunc = bool(*)(void*);
+
+    struct Task
+    {
+        lua_State* thread;
+        int threadRef;
+        void* awaitable; // Lives in a userdata on the task's stack while it's suspended.
+        PollFunc poll;
+        int priority;
+        TaskStats stats;
+    };
+
+    //! The budget of the task being resumed, checked by count_hook().
+    struct Slice
+    {
+        uint64_t instructions;
+        uint64_t instructionLimit;
+        uint64_t killLimit;
+        int interval;
+        std::chrono::steady_clock::time_point deadline;
+        std::chrono::steady_clock::time_point killDeadline;
+        bool timed;
+        bool preempted;
+    };
+
+    static void* registry_key()
+    {
+        static char key;
+        return &key;
+    }
+
+public:
+    explicit Scheduler(lua_State* L)
+        : L_(L), running_(nullptr), pendingAwaitable_(nullptr), pendingPoll_(nullptr),
+          errorHandler_(nullptr), errorUserData_(nullptr), finishHandler_(nullptr), finishUserData_(nullptr), slice_()
+    {
+        lua_pushlightuserdata(L, this);
+        lua_rawsetp(L, LUA_REGISTRYINDEX, registry_key());
+    }
+
+    ~Scheduler()
+    {
+        for (const Task& t : tasks_)
+            luaL_unref(L_, LUA_REGISTRYINDEX, t.threadRef);
+
+        lua_pushnil(L_);
+        lua_rawsetp(L_, LUA_REGISTRYINDEX, registry_key());
+    }
+
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    //! Returns the scheduler attached to L's main state, or nullptr.
+    static Scheduler* from(lua_State* L)
+    {
+        lua_rawgetp(L, LUA_REGISTRYINDEX, registry_key());
+        Scheduler* result = (Scheduler*)lua_touserdata(L, -1);
+        lua_pop(L, 1);
+        return result;
+    }
+
+    void set_error_handler(ErrorHandler handler, void* userData = nullptr)
+    {
+        errorHandler_ = handler;
+        errorUserData_ = userData;
+    }
+
+    void set_finish_handler(FinishHandler handler, void* userData = nullptr)
+    {
+        finishHandler_ = handler;
+        finishUserData_ = userData;
+    }
+
+    //! Applies from the next resume on. The default quota has no limits, and installs no hooks.
+    void set_quota(const Quota& quota)
+    {
+        quota_ = quota;
+    }
+
+    const Quota& quota() const { return quota_; }
+
+    //! Pops a function and its numArgs arguments off of the scheduler's lua_State
+    //! and starts running it as a new task, until it first yields or finishes.
+    //!
+    //! \returns false if the task errored before yielding.
+    //!
+    bool spawn(int numArgs)
+    {
+        return spawn(numArgs, TaskOptions());
+    }
+
+    bool spawn(int numArgs, const TaskOptions& options)
+    {
+        lua_State* thread = lua_newthread(L_);
+        int threadRef = luaL_ref(L_, LUA_REGISTRYINDEX);
+        lua_xmove(L_, thread, numArgs + 1);
+
+        Task task;
+        task.thread = thread;
+        task.threadRef = threadRef;
+        task.awaitable = nullptr;
+        task.poll = nullptr;
+        task.priority = options.priority > 0 ? options.priority : 1;
+        task.stats.userData = options.userData;
+        tasks_.push_back(task);
+
+        return resume(tasks_.size() - 1, numArgs);
+    }
+
+    //! Resumes every task that is ready to run, once.
+    //! Tasks that yielded without awaiting anything are resumed every time.
+    //!
+    //! \returns How many tasks are still alive.
+    //!
+    std::size_t run_once()
+    {
+        // Tasks spawned while we're resuming others wait for the next round.
+        std::size_t count = tasks_.size();
+        for (std::size_t i = 0; i < count;) {
+            Task& t = tasks_[i];
+            if (t.awaitable && !t.poll(t.awaitable)) { i++; continue; }
+
+            t.awaitable = nullptr;
+            t.poll = nullptr;
+            if (resume(i, 0)) { i++; continue; }
+
+            // The task was removed and the last one was swapped into its place. If that one
+            // was spawned this round, step over it. Otherwise, it still needs to be resumed.
+            if (tasks_.size() >= count) { i++; continue; }
+            count--;
+        }
+
+        return tasks_.size();
+    }
+
+    //! Runs tasks until all of them have finished.
+    void run()
+    {
+        while (run_once())
+            std::this_thread::yield();
+    }
+
+    std::size_t task_count() const { return tasks_.size(); }
+
+    //! Stats of a live task, by index, from 0 to task_count(). Indices change as tasks end.
+    const TaskStats& task_stats(std::size_t index) const { return tasks_[index].stats; }
+
+    //! Whether or not thread is a task that this scheduler is currently running,
+    //! i.e. whether an async method called on it can suspend it.
+    //!
+    bool is_running(lua_State* thread) const { return running_ == thread; }
+
+    //! Called by async method wrappers just before they yield the running task.
+    void suspend(void* awaitable, PollFunc poll)
+    {
+        pendingAwaitable_ = awaitable;
+        pendingPoll_ = poll;
+    }
+
+private:
+    //! Resumes the task at index. Finished or failed tasks are removed, swapping in the last task.
+    //! \returns false if the task was removed.
+    //!
+    bool resume(std::size_t index, int numArgs)
+    {
+        lua_State* thread = tasks_[index].thread;
+        Slice previousSlice = slice_;
+        start_slice(thread, tasks_[index].priority);
+
+        lua_State* previous = running_;
+        running_ = thread;
+        pendingAwaitable_ = nullptr;
+        pendingPoll_ = nullptr;
+        auto start = std::chrono::steady_clock::now();
+        int numResults = 0;
+        int status = detail::resume(thread, L_, numArgs, &numResults);
+        auto time = std::chrono::steady_clock::now() - start;
+        running_ = previous;
+
+        bool preempted = slice_.preempted;
+        slice_ = previousSlice;
+
+        Task& t = tasks_[index];
+        t.stats.time += std::chrono::duration_cast<std::chrono::nanoseconds>(time);
+        t.stats.resumes++;
+
+        if (status == LUA_YIELD) {
+            // Anything that was yielded by a plain coroutine.yield() is dropped. Tasks that were
+            // preempted yielded from a hook, in the middle of a Lua function, so their stack is left alone.
+            if (preempted) t.stats.preemptions++;
+            else if (!pendingAwaitable_) lua_pop(thread, numResults);
+
+            t.awaitable = pendingAwaitable_;
+            t.poll = pendingPoll_;
+            return true;
+        }
+
+        if (status != LUA_OK && errorHandler_)
+            errorHandler_(thread, errorUserData_);
+        if (finishHandler_)
+            finishHandler_(t.stats, status != LUA_OK, finishUserData_);
+
+        luaL_unref(L_, LUA_REGISTRYINDEX, tasks_[index].threadRef);
+        tasks_[index] = tasks_.back();
+        tasks_.pop_back();
+        return false;
+    }
+
+    //! Sets up the budget of a task that's about to be resumed, and the hook that enforces it.
+    void start_slice(lua_State* thread, int priority)
+    {
+        slice_ = Slice();
+        slice_.timed = quota_.time.count() > 0;
+        if (!quota_.instructions && !slice_.timed) {
+            lua_sethook(thread, nullptr, 0, 0);
+            return;
+        }
+
+        uint64_t numSlices = (uint64_t)quota_.killAfter + 1;
+        if (quota_.instructions) {
+            slice_.instructionLimit = (uint64_t)quota_.instructions * (uint64_t)priority;
+            slice_.killLimit = quota_.killAfter ? slice_.instructionLimit * numSlices : 0;
+        }
+        if (slice_.timed) {
+            auto now = std::chrono::steady_clock::now();
+            slice_.deadline = now + quota_.time * priority;
+            slice_.killDeadline = now + quota_.time * priority * (int)numSlices;
+        }
+
+        // Without a time limit, the hook only needs to run when the instructions run out.
+        int interval = quota_.instructions ? quota_.instructions : INT_MAX;
+        if (slice_.timed) interval = std::min(interval, std::max(quota_.checkInterval, 1));
+        slice_.interval = interval;
+        lua_sethook(thread, &count_hook, LUA_MASKCOUNT, interval);
+    }
+
+    //! Preempts the running task once its slice is used up. Coroutines that a task makes inherit its
+    //! hook, but only the task itself yields to the scheduler.
+    //!
+    static void count_hook(lua_State* L, lua_Debug*)
+    {
+        Scheduler* scheduler = from(L);
+        if (!scheduler || !scheduler->running_) return;
+
+        Slice& slice = scheduler->slice_;
+        slice.instructions += (uint64_t)slice.interval;
+        bool over = (slice.instructionLimit && slice.instructions >= slice.instructionLimit);
+        if (!over && !slice.timed) return;
+
+        auto now = std::chrono::steady_clock::now();
+        over = over || (slice.timed && now >= slice.deadline);
+        if (!over) return;
+
+        if (L == scheduler->running_ && lua_isyieldable(L)) {
+            slice.preempted = true;
+            lua_yield(L, 0);
+            return;
+        }
+
+        bool kill = scheduler->quota_.killAfter
+                    && ((slice.killLimit && slice.instructions >= slice.killLimit) || (slice.timed && now >= slice.killDeadline));
+        if (kill) luaL_error(L, "task ran over its quota where it couldn't be preempted");
+    }
+
+private:
+    lua_State* L_;
+    lua_State* running_;
+    void* pendingAwaitable_;
+    PollFunc pendingPoll_;
+    ErrorHandler errorHandler_;
+    void* errorUserData_;
+    FinishHandler finishHandler_;
+    void* finishUserData_;
+    Quota quota_;
+    Slice slice_;
+    std::vector<Task> tasks_;
+};
+
+namespace detail
+{
+
+//! Moves awaitables into userdata so that they live on a suspended coroutine's stack.
+template <typename Awaitable_>
+struct ParkedAwaitable
+{
+    static void* metatable_key()
+    {
+        static char key;
+        return &key;
+    }
+
+    static Awaitable_* push(lua_State* L, Awaitable_&& awaitable)
+    {
+        Awaitable_* result = new (detail::new_userdata(L, sizeof(Awaitable_), 0)) Awaitable_(std::move(awaitable));
+
+        if (lua_rawgetp(L, LUA_REGISTRYINDEX, metatable_key()) == LUA_TNIL) {
+            lua_pop(L, 1);
+            lua_createtable(L, 0, 1);
+            lua_pushcfunction(L, &gc_metamethod);
+            lua_setfield(L, -2, "__gc");
+            lua_pushvalue(L, -1);
+            lua_rawsetp(L, LUA_REGISTRYINDEX, metatable_key());
+        }
+        lua_setmetatable(L, -2);
+
+        return result;
+    }
+
+    static bool poll(void* awaitable) { return AwaitableTraits<Awaitable_>::ready(*(Awaitable_*)awaitable); }
+
+    static int gc_metamethod(lua_State* L)
+    {
+        ((Awaitable_*)lua_touserdata(L, 1))->~Awaitable_();
+        return 0;
+    }
+};
+
+template <typename Result_, typename TypeSet_, ApiId ApiId_>
+struct AwaitableResultPusher
+{
+    template <typename Awaitable_>
+    static LC_FORCE_INLINE int push(lua_State* L, Awaitable_& awaitable)
+    {
+        return StackManager<Result_, TypeSet_, ApiId_>::push(L, AwaitableTraits<Awaitable_>::get(awaitable));
+    }
+};
+
+template <typename TypeSet_, ApiId ApiId_>
+struct AwaitableResultPusher<void, TypeSet_, ApiId_>
+{
+    template <typename Awaitable_>
+    static LC_FORCE_INLINE int push(lua_State*, Awaitable_& awaitable)
+    {
+        AwaitableTraits<Awaitable_>::get(awaitable);
+        return 0;
+    }
+};
+
+template <ApiId ApiId_,
+          TypeId ClassId_,
+          typename TypeSet_,
+          typename Awaitable_,
+          typename Class_,
+          typename... Args_>
+struct AsyncMethodCallWrapper : MethodCallWrapperBase<ApiId_, ClassId_, Class_, sizeof...(Args_),
+                                                      is_handle_type<Class_*, TypeSet_>::value>
+{
+    using Base = MethodCallWrapperBase<ApiId_, ClassId_, Class_, sizeof...(Args_), is_handle_type<Class_*, TypeSet_>::value>;
+    using Pointer = Awaitable_(Class_::*)(Args_...);
+    using Class = Class_;
+    using Result = typename AwaitableTraits<Awaitable_>::Result;
+    using Pusher = AwaitableResultPusher<Result, TypeSet_, ApiId_>;
+
+    template <Pointer Func_>
+    static int call(lua_State* L)
+    {
+        Awaitable_ awaitable = call_impl<Func_>(L, typename detail::BuildIndexSequence<sizeof...(Args_)>::Type{});
+        if (AwaitableTraits<Awaitable_>::ready(awaitable)) return Pusher::push(L, awaitable);
+
+        // Outside of a scheduler task, there is nobody to resume us, so just wait.
+        Scheduler* scheduler = Scheduler::from(L);
+        if (!scheduler || !scheduler->is_running(L)) return Pusher::push(L, awaitable);
+
+        // [-1]: the parked awaitable. It stays there until we're resumed in resume().
+        Awaitable_* parked = ParkedAwaitable<Awaitable_>::push(L, std::move(awaitable));
+        scheduler->suspend(parked, &ParkedAwaitable<Awaitable_>::poll);
+        return lua_yieldk(L, 0, 0, &resume);
+    }
+
+    static int resume(lua_State* L, int, lua_KContext)
+    {
+        return Pusher::push(L, *(Awaitable_*)lua_touserdata(L, -1));
+    }
+
+    template <Pointer Func_, std::size_t... Indices_>
+    static LC_FORCE_INLINE Awaitable_ call_impl(lua_State* L, detail::IndexSequence<Indices_...>)
+    {
+        Class_* instance = Base::instance(L);
+        return (instance->*Func_)(detail::StackManager<Args_, TypeSet_, ApiId_>::template at<Indices_ + 2>(L)...);
+    }
+};
+
+template <ApiId ApiId_,
+          TypeId ClassId_,
+          typename TypeSet_,
+          typename Awaitable_,
+          typename Class_,
+          typename... Args_>
+auto make_async_call_wrapper(Awaitable_(Class_::*)(Args_...))
+    -> AsyncMethodCallWrapper<ApiId_, ClassId_, TypeSet_, Awaitable_, Class_, Args_...>
+{
+    return AsyncMethodCallWrapper<ApiId_, ClassId_, TypeSet_, Awaitable_, Class_, Args_...>{};
+}
+
+} // namespace detail
+
+//! A method that returns an awaitable. Added to classes with TypeExporter::add_methods(), like lc::Method.
+template <typename PointerType_, PointerType_ Pointer_>
+class AsyncMethod
+{
+public:
+    explicit AsyncMethod(char const* name)
+        : name_(name)
+    {}
+
+    char const* name() const { return name_; }
+
+    template <ApiId ApiId_, TypeId TypeId_, typename TypeSet_>
+    static void export_to(lua_State* L, char const* name)
+    {
+        using Wrapper = decltype(detail::make_async_call_wrapper<ApiId_, TypeId_, TypeSet_>(Pointer_));
+
+        lua_pushcfunction(L, (detail::ScratchCall<detail::method_uses_scratch<TypeSet_, ApiId_, PointerType_>::value,
+                                                  &Wrapper::template call<Pointer_>>::function()));
+        lua_setfield(L, -2, name);
+    }
+
+private:
+    char const* name_;
+};
+
+} // namespace lc
+
+#endif // LC_ASYNC_HPP
@@ -0,0 +1,345 @@
+#ifndef LC_BATCH_HPP
+#define LC_BATCH_HPP
+
+#include <vector>
+#include <lc/lc.hpp>
+#include <lc/lc_container.hpp>
+#if defined(LC_COMPACT_BINDINGS)
+    #include <lc/lc_compact.hpp>
+#endif
+
+//! \file
+//! \brief Methods that can also be called on many instances at once, from a single call into C++.
+//!
+//! A method added with LC_BATCH_METHOD() is exported as usual, and also as a function in the class
+//! table, named after the method with "_batch" appended, that takes an array per argument:
+//!
+//!     types.at<Foo>().add_methods(LC_BATCH_METHOD("set_pos", &Foo::set_pos));
+//!
+//!     Foo.set_pos_batch(foos, xs, ys) -- foos[i]:set_pos(xs[i], ys[i]) for every i
+//!
+//! The method is then called in a loop in C++, so a script that updates 10k objects crosses into
+//! C++ once rather than 10k times, and skips the method lookup and arity check of every call.
+//!
+//! - The first argument is an array of instances. Every other one is an array of values, or a single
+//!   value that's passed to every call (and converted once). Tables are always arrays, so struct
+//!   arguments can't be passed that way.
+//! - Arrays are Lua tables or lc::ContainerView's of std::vector's of the argument's type. Views are
+//!   read straight from the vector, so their elements aren't converted or checked at all.
+//! - Every array must have as many elements as the array of instances.
+//! - Methods that return something return an array of results. Ones that don't return nothing.
+//!
+//! Numbers in tables are checked together, per element, like lc::Method checks its arguments.
+//!
+
+#define LC_BATCH_METHOD(name, ptr) lc::BatchMethod<decltype(ptr), ptr>(name)
+
+namespace lc
+{
+namespace detail
+{
+
+//! \returns The vector that the view at index refers to, or nullptr if it isn't a view of one.
+template <typename T_, typename TypeSet_, ApiId ApiId_>
+const std::vector<T_>* vector_view_at(lua_State* L, int index)
+{
+    if (lua_type(L, index) != LUA_TUSERDATA || !lua_getmetatable(L, index)) return nullptr;
+
+    const std::vector<T_>* result = nullptr;
+    lua_rawgetp(L, LUA_REGISTRYINDEX, ContainerViewMetatable<std::vector<T_>, TypeSet_, ApiId_>::key());
+    lua_rawgetp(L, LUA_REGISTRYINDEX, ContainerViewMetatable<const std::vector<T_>, TypeSet_, ApiId_>::key());
+    if (lua_rawequal(L, -3, -2) || lua_rawequal(L, -3, -1)) result = *(const std::vector<T_>**)lua_touserdata(L, index);
+    lua_pop(L, 3);
+    return result;
+}
+
+LC_NOINLINE inline void batch_count_error(lua_State* L, int arg, lua_Integer count, lua_Integer expected)
+{
+    luaL_error(L, "In function '%s': argument %d has %d elements, expected %d",
+               function_name(L), arg, (int)count, (int)expected);
+}
+
+//! Raises the error that the stack managers would have for a single value.
+LC_NOINLINE inline void batch_value_error(lua_State* L, int arg, ArgKind kind)
+{
+    if (kind == ARG_KIND_INTEGER) luaL_checkinteger(L, arg);
+    else luaL_checknumber(L, arg);
+}
+
+LC_NOINLINE inline void batch_element_error(lua_State* L, int arg, lua_Integer element, ArgKind kind)
+{
+    luaL_error(L, "In function '%s': bad element %d of argument %d (%s expected, got %s)",
+               function_name(L), (int)element, arg, kind == ARG_KIND_INTEGER ? "integer" : "number", luaL_typename(L, arg));
+}
+
+//! The array of instances, at stack index 1.
+template <typename Class_, typename TypeSet_, ApiId ApiId_>
+struct BatchInstances
+{
+    const std::vector<Class_*>* vector = nullptr;
+    int table = 0;
+
+    //! \returns The number of elements.
+    lua_Integer open(lua_State* L, int copy)
+    {
+        if (lua_type(L, 1) == LUA_TTABLE) {
+            table = copy;
+            return (lua_Integer)lua_rawlen(L, 1);
+        }
+
+        vector = vector_view_at<Class_*, TypeSet_, ApiId_>(L, 1);
+        if (!vector) luaL_argerror(L, 1, "array of instances expected");
+        return (lua_Integer)vector->size();
+    }
+
+    LC_FORCE_INLINE Class_* get(lua_State* L, lua_Integer i)
+    {
+        if (vector) {
+            Class_* result = (*vector)[(std::size_t)i - 1];
+            if (!result) luaL_error(L, "In function '%s': element %d of argument 1 is null", function_name(L), (int)i);
+            return result;
+        }
+
+        lua_rawgeti(L, table, i);
+        char const* expected = ElementCheck<Class_*, TypeSet_, ApiId_>::expected(L);
+        if (expected) element_error(L, 1, i, expected);
+        lua_replace(L, 1);
+        return StackManager<Class_*, TypeSet_, ApiId_>::at(L, 1);
+    }
+};
+
+//! An array of arguments, or a single one. Elements of tables are moved to Index_, the argument's
+//! own stack index, to be read like lc::Method reads arguments.
+//!
+template <typename T_, typename TypeSet_, ApiId ApiId_, int Index_>
+struct BatchArg
+{
+    using Fused = FusedArg<T_, TypeSet_, ApiId_>;
+    using Value = typename std::decay<T_>::type;
+
+    ArgSlot slot;
+    const std::vector<Value>* vector = nullptr;
+    int table = 0;
+
+    //! \returns The number of elements, or -1 if it's a single value.
+    lua_Integer open(lua_State* L, int copy)
+    {
+        if (lua_type(L, Index_) == LUA_TTABLE) {
+            table = copy;
+            return (lua_Integer)lua_rawlen(L, Index_);
+        }
+
+        vector = vector_view_at<Value, TypeSet_, ApiId_>(L, Index_);
+        if (vector) return (lua_Integer)vector->size();
+
+        if (!Fused::read(L, Index_, slot)) batch_value_error(L, Index_, ArgKindOf<T_, TypeSet_, ApiId_>::value);
+        return -1;
+    }
+
+    //! \returns Whether the element could be converted.
+    LC_FORCE_INLINE int load(lua_State* L, lua_Integer i)
+    {
+        if (!table) return 1;
+
+        lua_rawgeti(L, table, i);
+        lua_replace(L, Index_);
+        return Fused::read(L, Index_, slot);
+    }
+
+    void check(lua_State* L, lua_Integer i)
+    {
+        if (table && !Fused::read(L, Index_, slot)) batch_element_error(L, Index_, i, ArgKindOf<T_, TypeSet_, ApiId_>::value);
+    }
+
+    LC_FORCE_INLINE T_ get(lua_State* L, lua_Integer i)
+    {
+        return vector ? (T_)(*vector)[(std::size_t)i - 1] : Fused::template get<Index_>(L, slot);
+    }
+};
+
+template <typename TypeSet_, ApiId ApiId_, typename Indices_, typename... Args_>
+struct BatchArgs;
+
+//! One BatchArg per argument. Arguments start at stack index 2, after the instances.
+template <typename TypeSet_, ApiId ApiId_, std::size_t... Indices_, typename... Args_>
+struct BatchArgs<TypeSet_, ApiId_, IndexSequence<Indices_...>, Args_...> : BatchArg<Args_, TypeSet_, ApiId_, (int)Indices_ + 2>...
+{
+    template <std::size_t Index_, typename T_>
+    LC_FORCE_INLINE BatchArg<T_, TypeSet_, ApiId_, (int)Index_ + 2>& at() { return *this; }
+
+    //! Checks that every array has count elements.
+    void open(lua_State* L, lua_Integer count)
+    {
+        lua_Integer counts[sizeof...(Args_) + 1] = { at<Indices_, Args_>().open(L, (int)Indices_ + 3 + (int)sizeof...(Args_))..., -1 };
+        for (std::size_t i = 0; i < sizeof...(Args_); i++)
+            if (counts[i] >= 0 && counts[i] != count) batch_count_error(L, (int)i + 2, counts[i], count);
+    }
+
+    //! Moves the i'th element of every table to its argument's index, and converts them.
+    LC_FORCE_INLINE void load(lua_State* L, lua_Integer i)
+    {
+        int ok = 1;
+        using Expand = int[];
+        (void)Expand{0, (ok &= at<Indices_, Args_>().load(L, i), 0)...};
+        if (!ok) check(L, i);
+    }
+
+    LC_NOINLINE void check(lua_State* L, lua_Integer i)
+    {
+        using Expand = int[];
+        (void)Expand{0, (at<Indices_, Args_>().check(L, i), 0)...};
+        (void)L;
+        (void)i;
+    }
+};
+
+template <ApiId ApiId_,
+          TypeId ClassId_,
+          typename TypeSet_,
+          typename Class_,
+          typename... Args_>
+struct BatchCallWrapperBase
+{
+    using Instances = BatchInstances<Class_, TypeSet_, ApiId_>;
+    using Args = BatchArgs<TypeSet_, ApiId_, typename BuildIndexSequence<sizeof...(Args_)>::Type, Args_...>;
+
+    static constexpr int num_expanded_args() { return (int)sizeof...(Args_) + 1; } // +1 for the instances.
+
+    //! Checks the arguments and copies them above themselves, leaving their indices free for elements.
+    //! \returns The number of elements.
+    //!
+    static lua_Integer open(lua_State* L, Instances& instances, Args& args)
+    {
+        int numArgs = lua_gettop(L);
+        if (numArgs != num_expanded_args()) luaL_error(L, "In function '%s': expected %d arguments, got %d",
+                                                       function_name(L), num_expanded_args(), numArgs);
+        luaL_checkstack(L, numArgs + 2, nullptr);
+        for (int i = 1; i <= numArgs; i++)
+            lua_pushvalue(L, i);
+
+        lua_Integer count = instances.open(L, numArgs + 1);
+        args.open(L, count);
+        return count;
+    }
+};
+
+template <ApiId ApiId_,
+          TypeId ClassId_,
+          typename TypeSet_,
+          typename Result_,
+          typename Class_,
+          typename... Args_>
+struct BatchCallWrapper : BatchCallWrapperBase<ApiId_, ClassId_, TypeSet_, Class_, Args_...>
+{
+    using Base = BatchCallWrapperBase<ApiId_, ClassId_, TypeSet_, Class_, Args_...>;
+    using Pointer = Result_(Class_::*)(Args_...);
+
+    template <Pointer Func_>
+    static int call(lua_State* L)
+    {
+        return call_impl<Func_>(L, typename BuildIndexSequence<sizeof...(Args_)>::Type{});
+    }
+
+    template <Pointer Func_, std::size_t... Indices_>
+    static int call_impl(lua_State* L, IndexSequence<Indices_...>)
+    {
+        typename Base::Instances instances;
+        typename Base::Args args;
+        lua_Integer count = Base::open(L, instances, args);
+
+        lua_createtable(L, (int)count, 0);
+        int results = lua_gettop(L);
+        for (lua_Integer i = 1; i <= count; i++) {
+            Class_* instance = instances.get(L, i);
+            args.load(L, i);
+            StackManager<Result_, TypeSet_, ApiId_>::push(L, (instance->*Func_)(
+                args.template at<Indices_, Args_>().get(L, i)...));
+            lua_rawseti(L, results, i);
+        }
+        return 1;
+    }
+};
+
+template <ApiId ApiId_,
+          TypeId ClassId_,
+          typename TypeSet_,
+          typename Class_,
+          typename... Args_>
+struct BatchCallWrapper<ApiId_, ClassId_, TypeSet_, void, Class_, Args_...> : BatchCallWrapperBase<ApiId_, ClassId_, TypeSet_, Class_, Args_...>
+{
+    using Base = BatchCallWrapperBase<ApiId_, ClassId_, TypeSet_, Class_, Args_...>;
+    using Pointer = void(Class_::*)(Args_...);
+
+    template <Pointer Func_>
+    static int call(lua_State* L)
+    {
+        call_impl<Func_>(L, typename BuildIndexSequence<sizeof...(Args_)>::Type{});
+        return 0;
+    }
+
+    template <Pointer Func_, std::size_t... Indices_>
+    static void call_impl(lua_State* L, IndexSequence<Indices_...>)
+    {
+        typename Base::Instances instances;
+        typename Base::Args args;
+        lua_Integer count = Base::open(L, instances, args);
+
+        for (lua_Integer i = 1; i <= count; i++) {
+            Class_* instance = instances.get(L, i);
+            args.load(L, i);
+            (instance->*Func_)(args.template at<Indices_, Args_>().get(L, i)...);
+        }
+    }
+};
+
+template <ApiId ApiId_,
+          TypeId ClassId_,
+          typename TypeSet_,
+          typename Result_,
+          typename Class_,
+          typename... Args_>
+auto make_batch_call_wrapper(Result_(Class_::*)(Args_...)) -> BatchCallWrapper<ApiId_, ClassId_, TypeSet_, Result_, Class_, Args_...>
+{
+    return BatchCallWrapper<ApiId_, ClassId_, TypeSet_, Result_, Class_, Args_...>{};
+}
+
+} // namespace detail
+
+//! A method that's also exported as a batch function. Added with add_methods(), like lc::Method.
+template <typename PointerType_, PointerType_ Pointer_>
+class BatchMethod
+{
+private:
+#if defined(LC_COMPACT_BINDINGS)
+    using Single = CompactMethod<PointerType_, Pointer_>;
+#else
+    using Single = Method<PointerType_, Pointer_>;
+#endif
+
+public:
+    explicit BatchMethod(char const* name)
+        : name_(name)
+    {}
+
+    char const* name() const { return name_; }
+
+    template <ApiId ApiId_, TypeId TypeId_, typename TypeSet_>
+    static void export_to(lua_State* L, char const* name)
+    {
+        using Wrapper = decltype(detail::make_batch_call_wrapper<ApiId_, TypeId_, TypeSet_>(Pointer_));
+
+        // [-2]: class table
+        // [-1]: methods table
+        Single::template export_to<ApiId_, TypeId_, TypeSet_>(L, name);
+        lua_pushfstring(L, "%s_batch", name);
+        lua_pushcfunction(L, &Wrapper::template call<Pointer_>);
+        lua_rawset(L, -4);
+    }
+
+private:
+    char const* name_;
+};
+
+} // namespace lc
+
+#endif // LC_BATCH_HPP
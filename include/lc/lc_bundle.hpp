@@ -0,0 +1,449 @@
+#ifndef LC_BUNDLE_HPP
+#define LC_BUNDLE_HPP
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <lc/detail/lc_common.hpp>
+
+#if defined(_WIN32)
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+//! \file
+//! \brief Script bundles: many chunks packed into one memory-mapped file.
+//!
+//! Layout (all integers little-endian, offsets from the start of the file):
+//!
+//!     BundleHeader
+//!     BundleEntry[entryCount]     sorted by name
+//!     names                       each one NUL-terminated
+//!     chunk data                  source or bytecode
+//!
+//! A bundle is mapped once and can be shared by any number of states (on any number of threads;
+//! it is never written to). Chunks are handed to lua_load straight out of the mapping.
+//!
+
+namespace lc
+{
+
+namespace detail
+{
+
+struct BundleHeader
+{
+    char magic[4];
+    uint32_t formatVersion;
+    uint32_t luaVersion; // LUA_VERSION_NUM of the bytecode, or 0 if there is none.
+    uint32_t entryCount;
+};
+
+struct BundleEntry
+{
+    uint32_t nameOffset;
+    uint32_t nameSize; // Without the NUL.
+    uint64_t dataOffset;
+    uint64_t dataSize;
+    uint32_t flags;
+    uint32_t padding;
+};
+
+enum BundleEntryFlags : uint32_t
+{
+    BUNDLE_ENTRY_BYTECODE = 1 << 0
+};
+
+constexpr uint32_t bundle_format_version() { return 1; }
+
+struct BundleSlice
+{
+    char const* data;
+    std::size_t size;
+};
+
+//! Hands the whole chunk to lua_load in one go, without copying it.
+inline char const* bundle_reader(lua_State*, void* userData, size_t* size)
+{
+    BundleSlice* slice = (BundleSlice*)userData;
+    char const* result = slice->data;
+    *size = slice->size;
+    slice->data = nullptr;
+    slice->size = 0;
+    return result;
+}
+
+} // namespace detail
+
+//! Builds bundle files. This is a build-time tool, so it doesn't try very hard to be fast.
+class BundleWriter
+{
+private:
+    struct Entry
+    {
+        std::string name;
+        std::string data;
+        bool bytecode;
+    };
+
+public:
+    //! Adds a chunk that require() will find under name. An existing chunk with the same name is replaced.
+    void add(char const* name, const void* data, std::size_t size, bool bytecode = false)
+    {
+        Entry* entry = find(name);
+        if (!entry) {
+            entries_.push_back(Entry());
+            entry = &entries_.back();
+            entry->name = name;
+        }
+
+        entry->data.assign((char const*)data, size);
+        entry->bytecode = bytecode;
+    }
+
+    //! Adds the script at path. Precompiled files are detected by the Lua signature.
+    //! \returns false if the file couldn't be read.
+    //!
+    bool add_file(char const* name, char const* path)
+    {
+        FILE* file = fopen(path, "rb");
+        if (!file) return false;
+
+        std::string data;
+        char buffer[4096];
+        std::size_t numRead = 0;
+        while ((numRead = fread(buffer, 1, sizeof(buffer), file)) > 0)
+            data.append(buffer, numRead);
+
+        bool ok = !ferror(file);
+        fclose(file);
+        if (!ok) return false;
+
+        bool bytecode = data.compare(0, sizeof(LUA_SIGNATURE) - 1, LUA_SIGNATURE) == 0;
+        add(name, data.data(), data.size(), bytecode);
+        return true;
+    }
+
+    //! Compiles every source chunk to bytecode for the Lua version L is running.
+    //! \returns false on the first chunk that fails to compile, with the error on top of L's stack.
+    //!
+    bool compile(lua_State* L, bool strip = false)
+    {
+        for (Entry& e : entries_) {
+            if (e.bytecode) continue;
+
+            std::string chunkName = "=" + e.name;
+            if (luaL_loadbufferx(L, e.data.data(), e.data.size(), chunkName.c_str(), "t") != LUA_OK)
+                return false;
+
+            e.data.clear();
+            lua_dump(L, &writer, &e.data, strip);
+            e.bytecode = true;
+            lua_pop(L, 1);
+        }
+
+        return true;
+    }
+
+    bool write(char const* path)
+    {
+        std::sort(entries_.begin(), entries_.end(),
+                  [](const Entry& a, const Entry& b) { return a.name < b.name; });
+
+        std::size_t namesOffset = sizeof(detail::BundleHeader) + entries_.size() * sizeof(detail::BundleEntry);
+        std::size_t namesSize = 0;
+        bool hasBytecode = false;
+        for (const Entry& e : entries_) {
+            namesSize += e.name.size() + 1;
+            hasBytecode = hasBytecode || e.bytecode;
+        }
+
+        detail::BundleHeader header;
+        memcpy(header.magic, "LCBN", sizeof(header.magic));
+        header.formatVersion = detail::bundle_format_version();
+        header.luaVersion = hasBytecode ? LUA_VERSION_NUM : 0;
+        header.entryCount = (uint32_t)entries_.size();
+
+        std::vector<detail::BundleEntry> index(entries_.size());
+        std::size_t nameOffset = namesOffset;
+        std::size_t dataOffset = namesOffset + namesSize;
+        for (std::size_t i = 0; i < entries_.size(); i++) {
+            const Entry& e = entries_[i];
+            detail::BundleEntry& entry = index[i];
+            entry.nameOffset = (uint32_t)nameOffset;
+            entry.nameSize = (uint32_t)e.name.size();
+            entry.dataOffset = dataOffset;
+            entry.dataSize = e.data.size();
+            entry.flags = e.bytecode ? (uint32_t)detail::BUNDLE_ENTRY_BYTECODE : 0u;
+            entry.padding = 0;
+
+            nameOffset += e.name.size() + 1;
+            dataOffset += e.data.size();
+        }
+
+        FILE* file = fopen(path, "wb");
+        if (!file) return false;
+
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+        if (!index.empty()) ok = ok && fwrite(index.data(), sizeof(detail::BundleEntry), index.size(), file) == index.size();
+        for (const Entry& e : entries_)
+            ok = ok && fwrite(e.name.c_str(), 1, e.name.size() + 1, file) == e.name.size() + 1;
+        for (const Entry& e : entries_)
+            ok = ok && fwrite(e.data.data(), 1, e.data.size(), file) == e.data.size();
+
+        ok = (fclose(file) == 0) && ok;
+        return ok;
+    }
+
+private:
+    Entry* find(char const* name)
+    {
+        for (Entry& e : entries_)
+            if (e.name == name) return &e;
+
+        return nullptr;
+    }
+
+    static int writer(lua_State*, const void* p, size_t size, void* userData)
+    {
+        ((std::string*)userData)->append((char const*)p, size);
+        return 0;
+    }
+
+private:
+    std::vector<Entry> entries_;
+};
+
+//! A read-only, memory-mapped bundle.
+class Bundle
+{
+public:
+    Bundle()
+        : data_(nullptr), size_(0), entries_(nullptr), entryCount_(0)
+#if defined(_WIN32)
+        , file_(INVALID_HANDLE_VALUE), mapping_(nullptr)
+#endif
+    {}
+
+    ~Bundle() { close(); }
+
+    Bundle(const Bundle&) = delete;
+    Bundle& operator=(const Bundle&) = delete;
+
+    //! Maps the bundle at path. Any previously opened bundle is closed first.
+    //! \returns false if the file couldn't be mapped, isn't a bundle (or a broken one), or has bytecode for another Lua version.
+    //!
+    bool open(char const* path)
+    {
+        close();
+        if (!map(path)) return false;
+
+        const detail::BundleHeader* header = (const detail::BundleHeader*)data_;
+        bool valid = size_ >= sizeof(detail::BundleHeader)
+                     && memcmp(header->magic, "LCBN", sizeof(header->magic)) == 0
+                     && header->formatVersion == detail::bundle_format_version()
+                     && (header->luaVersion == 0 || header->luaVersion == LUA_VERSION_NUM)
+                     && (size_ - sizeof(detail::BundleHeader)) / sizeof(detail::BundleEntry) >= header->entryCount;
+        if (!valid) {
+            close();
+            return false;
+        }
+
+        entries_ = (const detail::BundleEntry*)(data_ + sizeof(detail::BundleHeader));
+        entryCount_ = header->entryCount;
+
+        // Names are compared in place while searching, so they're checked up front. Data ranges are checked when loading.
+        for (std::size_t i = 0; i < entryCount_; i++) {
+            const detail::BundleEntry& entry = entries_[i];
+            if ((uint64_t)entry.nameOffset + entry.nameSize >= size_ || data_[entry.nameOffset + entry.nameSize] != '\0') {
+                close();
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void close()
+    {
+        unmap();
+        data_ = nullptr;
+        size_ = 0;
+        entries_ = nullptr;
+        entryCount_ = 0;
+    }
+
+    bool is_open() const { return data_ != nullptr; }
+    std::size_t size() const { return entryCount_; }
+    bool contains(char const* name) const { return find(name) != nullptr; }
+
+    //! Loads the named chunk straight out of the mapping.
+    //! On success, the chunk is pushed; otherwise, an error message is.
+    //!
+    //! \returns A Lua status code.
+    //!
+    int load(lua_State* L, char const* name) const
+    {
+        const detail::BundleEntry* entry = find(name);
+        if (!entry) {
+            lua_pushfstring(L, "no chunk '%s' in bundle", name);
+            return LUA_ERRFILE;
+        }
+
+        return load(L, *entry);
+    }
+
+    //! Adds a searcher to package.searchers, right after the preload searcher,
+    //! so require() finds chunks in the bundle first. The bundle has to outlive the state.
+    //!
+    void export_to(lua_State* L) const
+    {
+        lua_getglobal(L, "package");
+        if (!lua_istable(L, -1)) {
+            lua_pop(L, 1);
+            return;
+        }
+
+        lua_getfield(L, -1, "searchers");
+        lua_pushlightuserdata(L, (void*)this);
+        lua_pushcclosure(L, &searcher, 1);
+        // [-3]: package
+        // [-2]: package.searchers
+        // [-1]: our searcher
+        for (lua_Integer i = (lua_Integer)lua_rawlen(L, -2); i >= 2; i--) {
+            lua_rawgeti(L, -2, i);
+            lua_rawseti(L, -3, i + 1);
+        }
+        lua_rawseti(L, -2, 2);
+        lua_pop(L, 2);
+    }
+
+private:
+    char const* name_of(const detail::BundleEntry& entry) const { return data_ + entry.nameOffset; }
+
+    const detail::BundleEntry* find(char const* name) const
+    {
+        const detail::BundleEntry* first = entries_;
+        const detail::BundleEntry* last = entries_ + entryCount_;
+        const detail::BundleEntry* it = std::lower_bound(first, last, name,
+            [this](const detail::BundleEntry& e, char const* n) { return strcmp(name_of(e), n) < 0; });
+
+        if (it == last || strcmp(name_of(*it), name) != 0) return nullptr;
+        return it;
+    }
+
+    int load(lua_State* L, const detail::BundleEntry& entry) const
+    {
+        if (entry.dataOffset > size_ || entry.dataSize > size_ - entry.dataOffset) {
+            lua_pushfstring(L, "chunk '%s' is out of the bundle's bounds", name_of(entry));
+            return LUA_ERRFILE;
+        }
+
+        // Source chunks get the same kind of name BundleWriter::compile() gives bytecode.
+        char chunkName[LUA_IDSIZE];
+        snprintf(chunkName, sizeof(chunkName), "=%s", name_of(entry));
+
+        detail::BundleSlice slice;
+        slice.data = data_ + entry.dataOffset;
+        slice.size = (std::size_t)entry.dataSize;
+        bool bytecode = (entry.flags & detail::BUNDLE_ENTRY_BYTECODE) != 0;
+        return lua_load(L, &detail::bundle_reader, &slice, chunkName, bytecode ? "b" : "t");
+    }
+
+    // upvalue 1: the bundle
+    static int searcher(lua_State* L)
+    {
+        const Bundle* bundle = (const Bundle*)lua_touserdata(L, lua_upvalueindex(1));
+        char const* name = luaL_checkstring(L, 1);
+
+        const detail::BundleEntry* entry = bundle->find(name);
+        if (!entry) {
+            lua_pushfstring(L, "\n\tno chunk '%s' in bundle", name);
+            return 1;
+        }
+
+        if (bundle->load(L, *entry) != LUA_OK)
+            return luaL_error(L, "error loading module '%s' from bundle:\n\t%s", name, lua_tostring(L, -1));
+
+        lua_pushvalue(L, 1);
+        return 2;
+    }
+
+#if defined(_WIN32)
+    bool map(char const* path)
+    {
+        file_ = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file_ == INVALID_HANDLE_VALUE) return false;
+
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(file_, &fileSize) || fileSize.QuadPart == 0) return false;
+
+        mapping_ = CreateFileMappingA(file_, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (!mapping_) return false;
+
+        data_ = (char const*)MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0);
+        size_ = (std::size_t)fileSize.QuadPart;
+        return data_ != nullptr;
+    }
+
+    void unmap()
+    {
+        if (data_) UnmapViewOfFile(data_);
+        if (mapping_) CloseHandle(mapping_);
+        if (file_ != INVALID_HANDLE_VALUE) CloseHandle(file_);
+        mapping_ = nullptr;
+        file_ = INVALID_HANDLE_VALUE;
+    }
+#else
+    bool map(char const* path)
+    {
+        int fd = ::open(path, O_RDONLY);
+        if (fd < 0) return false;
+
+        struct stat info;
+        if (fstat(fd, &info) != 0 || info.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+
+        // The mapping keeps the file alive, so the descriptor isn't needed after this.
+        void* data = mmap(nullptr, (std::size_t)info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) return false;
+
+        data_ = (char const*)data;
+        size_ = (std::size_t)info.st_size;
+        return true;
+    }
+
+    void unmap()
+    {
+        if (data_) munmap((void*)data_, size_);
+    }
+#endif
+
+private:
+    char const* data_;
+    std::size_t size_;
+    const detail::BundleEntry* entries_;
+    std::size_t entryCount_;
+#if defined(_WIN32)
+    HANDLE file_;
+    HANDLE mapping_;
+#endif
+};
+
+} // namespace lc
+
+#endif // LC_BUNDLE_HPP
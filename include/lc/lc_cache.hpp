@@ -0,0 +1,238 @@
+#ifndef LC_CACHE_HPP
+#define LC_CACHE_HPP
+
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <lc/detail/lc_common.hpp>
+
+#if defined(_WIN32)
+    #include <process.h>
+#else
+    #include <unistd.h>
+#endif
+
+//! \file
+//! \brief On-disk cache of precompiled chunks.
+//!
+//! Chunks are stored in a cache directory as "<key>-<Lua version>.luac", with a small header that
+//! is checked before the bytecode is loaded. The key is a hash of the script's contents and path:
+//! an edited script just misses the cache and gets compiled again, and scripts with the same
+//! contents get entries of their own, since the bytecode has the path in its debug info. Entries
+//! that fail the header check or fail to load are rebuilt in place. Nothing is ever deleted, so
+//! clearing out old entries is up to whoever owns the directory.
+//!
+
+namespace lc
+{
+
+namespace detail
+{
+
+//! 64-bit FNV-1a. Plenty for telling scripts apart; this isn't about security.
+inline uint64_t fnv1a(const void* data, std::size_t size, uint64_t hash = 0xcbf29ce484222325ull)
+{
+    const Byte* bytes = (const Byte*)data;
+    for (std::size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+//! Reads an entire file into out.
+//! \returns false if the file couldn't be opened or read.
+//!
+inline bool read_file(char const* path, std::string& out)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file) return false;
+
+    out.clear();
+    char buffer[4096];
+    std::size_t numRead = 0;
+    while ((numRead = fread(buffer, 1, sizeof(buffer), file)) > 0)
+        out.append(buffer, numRead);
+
+    bool ok = !ferror(file);
+    fclose(file);
+    return ok;
+}
+
+inline int string_writer(lua_State*, const void* p, size_t size, void* userData)
+{
+    ((std::string*)userData)->append((char const*)p, size);
+    return 0;
+}
+
+//! Header at the start of every cache entry.
+struct CacheEntryHeader
+{
+    char magic[4];
+    uint32_t luaVersion;
+    uint64_t sourceHash;
+    uint64_t sourceSize;
+    uint64_t key;        // sourceHash, with the chunk name hashed in.
+};
+
+//! A name for a temporary file that no other process or thread is writing to.
+inline std::string unique_temp_path(const std::string& path)
+{
+    static std::atomic<unsigned> counter(0);
+#if defined(_WIN32)
+    int pid = _getpid();
+#else
+    int pid = (int)getpid();
+#endif
+    char suffix[48];
+    snprintf(suffix, sizeof(suffix), ".%d-%u.tmp", pid, counter++);
+    return path + suffix;
+}
+
+} // namespace detail
+
+class BytecodeCache
+{
+public:
+    //! \param directory An existing, writable directory. It isn't created for you.
+    explicit BytecodeCache(char const* directory)
+        : directory_(directory ? directory : ".")
+    {}
+
+    char const* directory() const { return directory_.c_str(); }
+
+    //! Loads the script at path like luaL_loadfile, but from the cache when it can.
+    //! On success, the compiled chunk is pushed; otherwise, an error message is.
+    //!
+    //! \returns A Lua status code.
+    //!
+    int load(lua_State* L, char const* path) const
+    {
+        std::string source;
+        if (!detail::read_file(path, source)) {
+            lua_pushfstring(L, "cannot read '%s'", path);
+            return LUA_ERRFILE;
+        }
+
+        // Error messages and debug info refer to the script, not the cache entry. The chunk name
+        // is part of the key, because the bytecode keeps the name it was compiled with.
+        std::string chunkName = "@";
+        chunkName += path;
+
+        detail::CacheEntryHeader header;
+        memcpy(header.magic, "LCBC", sizeof(header.magic));
+        header.luaVersion = LUA_VERSION_NUM;
+        header.sourceHash = detail::fnv1a(source.data(), source.size());
+        header.sourceSize = source.size();
+        header.key = detail::fnv1a(chunkName.data(), chunkName.size(), header.sourceHash);
+
+        std::string entryPath = entry_path(header.key);
+        std::string entry;
+        if (detail::read_file(entryPath.c_str(), entry) && entry.size() > sizeof(header)
+            && memcmp(entry.data(), &header, sizeof(header)) == 0) {
+            int status = luaL_loadbufferx(L, entry.data() + sizeof(header), entry.size() - sizeof(header),
+                                          chunkName.c_str(), "b");
+            if (status == LUA_OK) return LUA_OK;
+            lua_pop(L, 1); // Probably truncated. Rebuild it.
+        }
+
+        int status = luaL_loadbufferx(L, source.data(), source.size(), chunkName.c_str(), "t");
+        if (status != LUA_OK) return status;
+
+        entry.assign((char const*)&header, sizeof(header));
+        lua_dump(L, &detail::string_writer, &entry, 0);
+        write_entry(entryPath, entry);
+        return LUA_OK;
+    }
+
+    //! Same as luaL_dofile, but loads through the cache.
+    int do_file(lua_State* L, char const* path) const
+    {
+        int status = load(L, path);
+        if (status != LUA_OK) return status;
+        return lua_pcall(L, 0, LUA_MULTRET, 0);
+    }
+
+    //! Routes require() through the cache by putting a searcher in front of
+    //! the standard Lua file searcher. Searches package.path, like the standard one.
+    //! The cache has to outlive the state.
+    //!
+    void export_to(lua_State* L) const
+    {
+        lua_getglobal(L, "package");
+        if (!lua_istable(L, -1)) {
+            lua_pop(L, 1);
+            return;
+        }
+
+        // [-1]: package
+        lua_getfield(L, -1, "searchers");
+        lua_pushlightuserdata(L, (void*)this);
+        lua_pushvalue(L, -3);
+        lua_pushcclosure(L, &searcher, 2);
+        // [-3]: package
+        // [-2]: package.searchers
+        // [-1]: our searcher
+        for (lua_Integer i = (lua_Integer)lua_rawlen(L, -2); i >= 2; i--) {
+            lua_rawgeti(L, -2, i);
+            lua_rawseti(L, -3, i + 1);
+        }
+        lua_rawseti(L, -2, 2);
+        lua_pop(L, 2);
+    }
+
+private:
+    std::string entry_path(uint64_t key) const
+    {
+        char name[64];
+        snprintf(name, sizeof(name), "/%016llx-%d.luac", (unsigned long long)key, (int)LUA_VERSION_NUM);
+        return directory_ + name;
+    }
+
+    static void write_entry(const std::string& entryPath, const std::string& entry)
+    {
+        // Write to a temporary first so that other processes never see half of an entry. Each writer
+        // has one of its own, so that two processes compiling the same script don't write into the same file.
+        std::string tempPath = detail::unique_temp_path(entryPath);
+        FILE* file = fopen(tempPath.c_str(), "wb");
+        if (!file) return;
+
+        bool ok = fwrite(entry.data(), 1, entry.size(), file) == entry.size();
+        ok = (fclose(file) == 0) && ok;
+        if (!ok || std::rename(tempPath.c_str(), entryPath.c_str()) != 0)
+            std::remove(tempPath.c_str());
+    }
+
+    // upvalue 1: the cache
+    // upvalue 2: the package table
+    static int searcher(lua_State* L)
+    {
+        const BytecodeCache* cache = (const BytecodeCache*)lua_touserdata(L, lua_upvalueindex(1));
+        char const* name = luaL_checkstring(L, 1);
+
+        lua_getfield(L, lua_upvalueindex(2), "searchpath");
+        lua_pushvalue(L, 1);
+        lua_getfield(L, lua_upvalueindex(2), "path");
+        lua_call(L, 2, 2);
+        // [-2]: file name, or nil
+        // [-1]: nil, or the list of files tried
+        if (lua_isnil(L, -2)) return 1;
+
+        char const* path = lua_tostring(L, -2);
+        if (cache->load(L, path) != LUA_OK)
+            return luaL_error(L, "error loading module '%s' from file '%s':\n\t%s", name, path, lua_tostring(L, -1));
+
+        // Same as the standard searcher; the file name is passed to the chunk.
+        lua_pushvalue(L, -3);
+        return 2;
+    }
+
+private:
+    std::string directory_;
+};
+
+} // namespace lc
+
+#endif // LC_CACHE_HPP
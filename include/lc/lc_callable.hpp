@@ -0,0 +1,221 @@
+#ifndef LC_CALLABLE_HPP
+#define LC_CALLABLE_HPP
+
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <lc/lc.hpp>
+#include <lc/lc_range.hpp>
+
+//! \file
+//! \brief Methods implemented by lambdas and other callable objects.
+//!
+//! lc::Method only takes member function pointers, as template arguments. Anything with state,
+//! like a lambda with captures, can be added with lc::callable_method instead. It's called with
+//! the instance as its first parameter, as a pointer or a reference:
+//!
+//!     float scale = 2.0f;
+//!     types.at<Foo>().add_methods(
+//!         LC_METHOD("get", &Foo::get),
+//!         lc::callable_method("scaled", [scale](Foo& foo, float x) { return foo.get() * x * scale; })
+//!     );
+//!
+//! The callable is copied into a userdata when the API is exported, and the method is a C closure
+//! with that userdata as its upvalue. The userdata gets a __gc that destroys the callable only if
+//! it has a destructor to run. So a call allocates nothing: it finds the callable in the upvalue
+//! and calls it directly, with the same argument checks and conversions as a member function.
+//!
+//! The first parameter has to be the class that the method is added to. Callables aren't recorded
+//! by LC_RECORD_CALLS.
+//!
+
+namespace lc
+{
+
+namespace detail
+{
+
+//! What Lua aligns userdata to (LUAI_MAXALIGN).
+union LuaMaxAlign
+{
+    lua_Number n;
+    double u;
+    void* s;
+    lua_Integer i;
+    long l;
+};
+
+//! Converts the instance pointer to what a callable's first parameter is.
+template <typename Self_>
+struct SelfArg
+{
+    static_assert(TypeDependentFalse<Self_>::value, "(LC): A callable method's first parameter has to be its class, by pointer or reference.");
+};
+
+template <typename Class_>
+struct SelfArg<Class_*>
+{
+    using Class = typename std::remove_cv<Class_>::type;
+    static LC_FORCE_INLINE Class_* get(Class* instance) { return instance; }
+};
+
+template <typename Class_>
+struct SelfArg<Class_&>
+{
+    using Class = typename std::remove_cv<Class_>::type;
+    static LC_FORCE_INLINE Class_& get(Class* instance) { return *instance; }
+};
+
+template <ApiId ApiId_,
+          TypeId ClassId_,
+          typename TypeSet_,
+          typename Callable_,
+          typename Result_,
+          typename Self_,
+          typename... Args_>
+struct CallableCallWrapper
+{
+    using Class = typename SelfArg<Self_>::Class;
+    using Base = MethodCallWrapperBase<ApiId_, ClassId_, Class, sizeof...(Args_), is_handle_type<Class*, TypeSet_>::value>;
+    using Fused = FusedArgs<TypeSet_, ApiId_, Args_...>;
+
+    static constexpr bool uses_scratch() { return args_use_scratch<TypeSet_, ApiId_, Args_...>::value; }
+
+    static_assert(TypeSet_::template index_of<Class>() == ClassId_ ||
+                  TypeSet_::template index_of<HandleTag<Class>>() == ClassId_,
+                  "(LC): A callable method's first parameter has to be the class it's added to.");
+
+    // upvalue 1: the callable
+    static int call(lua_State* L)
+    {
+        return call_impl(L, typename detail::BuildIndexSequence<sizeof...(Args_)>::Type{});
+    }
+
+    template <std::size_t... Indices_>
+    static LC_FORCE_INLINE int call_impl(lua_State* L, detail::IndexSequence<Indices_...> indices)
+    {
+        Class* instance = Base::instance(L);
+        Callable_& callable = *(Callable_*)lua_touserdata(L, lua_upvalueindex(1));
+        ArgSlot slots[sizeof...(Args_) + 1];
+        Fused::read(L, slots, indices);
+        return StackManager<Result_, TypeSet_, ApiId_>::push(L, callable(SelfArg<Self_>::get(instance),
+               detail::FusedArg<Args_, TypeSet_, ApiId_>::template get<Indices_ + 2>(L, slots[Indices_])...));
+    }
+};
+
+template <ApiId ApiId_,
+          TypeId ClassId_,
+          typename TypeSet_,
+          typename Callable_,
+          typename Self_,
+          typename... Args_>
+struct CallableCallWrapper<ApiId_, ClassId_, TypeSet_, Callable_, void, Self_, Args_...>
+{
+    using Class = typename SelfArg<Self_>::Class;
+    using Base = MethodCallWrapperBase<ApiId_, ClassId_, Class, sizeof...(Args_), is_handle_type<Class*, TypeSet_>::value>;
+    using Fused = FusedArgs<TypeSet_, ApiId_, Args_...>;
+
+    static constexpr bool uses_scratch() { return args_use_scratch<TypeSet_, ApiId_, Args_...>::value; }
+
+    static_assert(TypeSet_::template index_of<Class>() == ClassId_ ||
+                  TypeSet_::template index_of<HandleTag<Class>>() == ClassId_,
+                  "(LC): A callable method's first parameter has to be the class it's added to.");
+
+    // upvalue 1: the callable
+    static int call(lua_State* L)
+    {
+        call_impl(L, typename detail::BuildIndexSequence<sizeof...(Args_)>::Type{});
+        return 0;
+    }
+
+    template <std::size_t... Indices_>
+    static LC_FORCE_INLINE void call_impl(lua_State* L, detail::IndexSequence<Indices_...> indices)
+    {
+        Class* instance = Base::instance(L);
+        Callable_& callable = *(Callable_*)lua_touserdata(L, lua_upvalueindex(1));
+        ArgSlot slots[sizeof...(Args_) + 1];
+        Fused::read(L, slots, indices);
+        callable(SelfArg<Self_>::get(instance),
+                 detail::FusedArg<Args_, TypeSet_, ApiId_>::template get<Indices_ + 2>(L, slots[Indices_])...);
+    }
+};
+
+//! Picks the wrapper from the callable's operator(), const (lambdas) or not (mutable lambdas).
+template <ApiId ApiId_, TypeId ClassId_, typename TypeSet_, typename Callable_,
+          typename Signature_ = decltype(&Callable_::operator())>
+struct CallableWrapper
+{
+    static_assert(TypeDependentFalse<Callable_>::value, "(LC): Callable methods need exactly one, non-template operator().");
+};
+
+template <ApiId ApiId_, TypeId ClassId_, typename TypeSet_, typename Callable_,
+          typename Result_, typename Self_, typename... Args_>
+struct CallableWrapper<ApiId_, ClassId_, TypeSet_, Callable_, Result_(Callable_::*)(Self_, Args_...) const>
+       : CallableCallWrapper<ApiId_, ClassId_, TypeSet_, Callable_, Result_, Self_, Args_...> {};
+
+template <ApiId ApiId_, TypeId ClassId_, typename TypeSet_, typename Callable_,
+          typename Result_, typename Self_, typename... Args_>
+struct CallableWrapper<ApiId_, ClassId_, TypeSet_, Callable_, Result_(Callable_::*)(Self_, Args_...)>
+       : CallableCallWrapper<ApiId_, ClassId_, TypeSet_, Callable_, Result_, Self_, Args_...> {};
+
+} // namespace detail
+
+template <typename Callable_>
+class CallableMethod
+{
+public:
+    static_assert(alignof(Callable_) <= alignof(detail::LuaMaxAlign), "(LC): Callables can't be aligned more strictly than Lua's userdata.");
+
+    CallableMethod(char const* name, Callable_ callable)
+        : name_(name), callable_(std::make_shared<const Callable_>(std::move(callable)))
+    {}
+
+    char const* name() const { return name_; }
+    const std::shared_ptr<const Callable_>& callable() const { return callable_; }
+
+    //! \param data The callable, which is copied into the closure's upvalue.
+    template <ApiId ApiId_, TypeId TypeId_, typename TypeSet_>
+    static void export_to(lua_State* L, char const* name, const void* data)
+    {
+        using Wrapper = detail::CallableWrapper<ApiId_, TypeId_, TypeSet_, Callable_>;
+
+        Callable_ callable(*(const Callable_*)data);
+        detail::IterationState<Callable_>::push(L, std::move(callable));
+        lua_pushcclosure(L, (detail::ScratchCall<Wrapper::uses_scratch(), &Wrapper::call>::function()), 1);
+        lua_setfield(L, -2, name);
+    }
+
+private:
+    char const* name_;
+    std::shared_ptr<const Callable_> callable_;
+};
+
+//! A method implemented by a lambda or another callable object. See the top of the file.
+template <typename Callable_>
+CallableMethod<typename std::decay<Callable_>::type> callable_method(char const* name, Callable_&& callable)
+{
+    return CallableMethod<typename std::decay<Callable_>::type>(name, std::forward<Callable_>(callable));
+}
+
+namespace detail
+{
+
+template <typename Callable_>
+struct MethodExport<CallableMethod<Callable_>>
+{
+    template <ApiId ApiId_, TypeId TypeId_, typename TypeSet_>
+    static MethodExportPair pair(const CallableMethod<Callable_>& method)
+    {
+        MethodExportPair result;
+        result.name = method.name();
+        result.dataExporter = &CallableMethod<Callable_>::template export_to<ApiId_, TypeId_, TypeSet_>;
+        result.data = method.callable();
+        return result;
+    }
+};
+
+} // namespace detail
+
+} // namespace lc
+
+#endif // LC_CALLABLE_HPP
@@ -0,0 +1,405 @@
+#ifndef LC_CHANNEL_HPP
+#define LC_CHANNEL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <lc/detail/lc_stack.hpp>
+
+//! \file
+//! \brief Bounded queues for passing values between lua_States on different threads.
+//!
+//! A channel is a fixed-size ring of messages. Any number of threads can send, but only one
+//! can receive at a time (it's an MPSC queue), so a channel usually belongs to the state that
+//! reads from it. Sending never blocks or allocates, except to copy long strings, and to wake up
+//! a receiver that's waiting.
+//!
+//! Values are moved without going through text:
+//! - nil, booleans, integers, numbers and strings are copied.
+//! - Enum class values are copied, as long as their API is exported to the receiving state.
+//! - Class instances are moved: the sender's userdata is left empty (calling methods on it is
+//!   an error and its __gc does nothing) and the receiver gets a new userdata with its own
+//!   instance metatable, which frees the instance from then on.
+//!
+//! Tables, functions and everything else have to be sent some other way, e.g. as snapshots.
+//!
+
+namespace lc
+{
+
+namespace detail
+{
+
+enum ChannelValueType : uint8_t
+{
+    CHANNEL_NIL,
+    CHANNEL_BOOLEAN,
+    CHANNEL_INTEGER,
+    CHANNEL_NUMBER,
+    CHANNEL_STRING,
+    CHANNEL_ENUM,
+    CHANNEL_INSTANCE
+};
+
+struct ChannelMessage
+{
+    //! Strings up to this size are stored in the message itself.
+    static constexpr std::size_t INLINE_STRING_SIZE = 16;
+
+    ChannelValueType type = CHANNEL_NIL;
+    ApiId apiId = 0;
+    TypeId typeId = 0;
+    std::size_t size = 0; // Strings only.
+    union
+    {
+        bool boolean;
+        lua_Integer integer;
+        lua_Number number;
+        void* instance;
+        char* string;
+        char inlineString[INLINE_STRING_SIZE];
+    };
+
+    char const* string_data() const { return size > INLINE_STRING_SIZE ? string : inlineString; }
+};
+
+} // namespace detail
+
+class Channel
+{
+private:
+    struct Cell
+    {
+        std::atomic<std::size_t> sequence;
+        detail::ChannelMessage message;
+    };
+
+    // Keeps the producers' and the consumer's positions on separate cache lines.
+    static constexpr std::size_t CACHE_LINE_SIZE = 64;
+
+public:
+    //! \param name The name of the global that export_to() sets.
+    //! \param capacity Rounded up to a power of two.
+    //!
+    Channel(char const* name, std::size_t capacity)
+        : name_(name), mask_(1), cells_(nullptr), enqueuePos_(0), dequeuePos_(0), waiting_(false)
+    {
+        while (mask_ + 1 < capacity) mask_ = (mask_ << 1) | 1;
+
+        cells_ = new Cell[mask_ + 1];
+        for (std::size_t i = 0; i <= mask_; i++)
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    //! Instances still in the channel are leaked, since only their states know how to free them.
+    ~Channel()
+    {
+        for (std::size_t i = dequeuePos_; i != enqueuePos_.load(std::memory_order_relaxed); i++) {
+            detail::ChannelMessage& message = cells_[i & mask_].message;
+            if (message.type == detail::CHANNEL_STRING) free_string(message);
+        }
+
+        delete[] cells_;
+    }
+
+    Channel(const Channel&) = delete;
+    Channel& operator=(const Channel&) = delete;
+
+    char const* name() const { return name_; }
+    std::size_t capacity() const { return mask_ + 1; }
+
+    //! Moves the value at index into the channel. Safe to call from any thread.
+    //! Like luaL_check* functions, this raises a Lua error if the value can't be sent.
+    //!
+    //! \returns false if the channel is full, in which case nothing is moved.
+    //!
+    bool send(lua_State* L, int index)
+    {
+        index = lua_absindex(L, index);
+        detail::ChannelMessage message;
+        char const* string = describe(L, index, message);
+        if (message.type == detail::CHANNEL_STRING && message.size > detail::ChannelMessage::INLINE_STRING_SIZE) {
+            message.string = (char*)malloc(message.size);
+            if (!message.string) luaL_error(L, "not enough memory");
+        }
+
+        // Everything that can fail has been checked by now; once a cell is claimed, it has to be published.
+        std::size_t pos = enqueuePos_.load(std::memory_order_relaxed);
+        Cell* cell = nullptr;
+        for (;;) {
+            cell = &cells_[pos & mask_];
+            std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            std::ptrdiff_t diff = (std::ptrdiff_t)sequence - (std::ptrdiff_t)pos;
+            if (diff == 0) {
+                if (enqueuePos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+            }
+            else if (diff < 0) {
+                if (message.type == detail::CHANNEL_STRING) free_string(message); // Full.
+                return false;
+            }
+            else {
+                pos = enqueuePos_.load(std::memory_order_relaxed);
+            }
+        }
+
+        if (message.type == detail::CHANNEL_STRING) {
+            memcpy((char*)message.string_data(), string, message.size);
+        }
+        else if (message.type == detail::CHANNEL_INSTANCE) {
+            // The receiver owns it now, memory and all.
+            ((detail::UserDataContents*)lua_touserdata(L, index))->instance = nullptr;
+            lua_getmetatable(L, index);
+            detail::remove_native_memory(L, detail::native_size(L, -1, message.instance));
+            lua_pop(L, 1);
+        }
+
+        cell->message = message;
+        cell->sequence.store(pos + 1, std::memory_order_release);
+
+        // Pairs with the fence in wait(): either the receiver sees this message, or this sees that it's waiting.
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiting_.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(waitMutex_);
+            waitCondition_.notify_one();
+        }
+        return true;
+    }
+
+    //! Pushes the oldest value in the channel. Only one thread may receive at a time.
+    //! Raises a Lua error if the value is from an API that isn't exported to L; the value stays in the channel.
+    //!
+    //! \returns false, pushing nothing, if the channel is empty.
+    //!
+    bool receive(lua_State* L)
+    {
+        Cell& cell = cells_[dequeuePos_ & mask_];
+        if (cell.sequence.load(std::memory_order_acquire) != dequeuePos_ + 1) return false;
+
+        bool isInstance = cell.message.type == detail::CHANNEL_INSTANCE;
+        push(L, cell.message);
+        cell.sequence.store(dequeuePos_ + mask_ + 1, std::memory_order_release);
+        dequeuePos_++;
+
+        // Only once the message is gone, since this can run finalizers (and they can fail).
+        if (isInstance) {
+            lua_getmetatable(L, -1);
+            std::size_t size = detail::native_size(L, -1, ((detail::UserDataContents*)lua_touserdata(L, -2))->instance);
+            lua_pop(L, 1);
+            detail::add_native_memory(L, size);
+        }
+        return true;
+    }
+
+    //! Blocks until the channel isn't empty. Only the thread that receives may wait.
+    void wait()
+    {
+        if (ready()) return;
+
+        std::unique_lock<std::mutex> lock(waitMutex_);
+        waiting_.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while (!ready()) waitCondition_.wait(lock);
+        waiting_.store(false, std::memory_order_relaxed);
+    }
+
+    //! Sets a global named after the channel with the following functions, called with ':':
+    //! - send(value): returns false if the channel is full.
+    //! - try_receive(): returns true and the value, or false if the channel is empty.
+    //! - receive(): returns the next value. When the channel is empty, it yields if it's called
+    //!   from a coroutine (an lc::Scheduler task, say) and tries again when resumed. Otherwise, it blocks
+    //!   the thread until something is sent.
+    //!
+    //! The channel has to outlive the state.
+    //!
+    void export_to(lua_State* L) const
+    {
+        lua_createtable(L, 0, 3);
+        lua_pushlightuserdata(L, (void*)this);
+        lua_pushcclosure(L, &send_function, 1);
+        lua_setfield(L, -2, "send");
+        lua_pushlightuserdata(L, (void*)this);
+        lua_pushcclosure(L, &try_receive_function, 1);
+        lua_setfield(L, -2, "try_receive");
+        lua_pushlightuserdata(L, (void*)this);
+        lua_pushcclosure(L, &receive_function, 1);
+        lua_setfield(L, -2, "receive");
+        lua_setglobal(L, name_);
+    }
+
+private:
+    //! Fills out everything but a string's contents, which are returned so they're copied later.
+    static char const* describe(lua_State* L, int index, detail::ChannelMessage& message)
+    {
+        switch (lua_type(L, index)) {
+        case LUA_TNIL:
+            message.type = detail::CHANNEL_NIL;
+            return nullptr;
+        case LUA_TBOOLEAN:
+            message.type = detail::CHANNEL_BOOLEAN;
+            message.boolean = lua_toboolean(L, index) != 0;
+            return nullptr;
+        case LUA_TNUMBER:
+            if (lua_isinteger(L, index)) {
+                message.type = detail::CHANNEL_INTEGER;
+                message.integer = lua_tointeger(L, index);
+            }
+            else {
+                message.type = detail::CHANNEL_NUMBER;
+                message.number = lua_tonumber(L, index);
+            }
+            return nullptr;
+        case LUA_TSTRING:
+            message.type = detail::CHANNEL_STRING;
+            return lua_tolstring(L, index, &message.size);
+        case LUA_TUSERDATA:
+            describe_userdata(L, index, message);
+            return nullptr;
+        default:
+            luaL_error(L, "can't send a value of type '%s' through a channel", luaL_typename(L, index));
+            return nullptr;
+        }
+    }
+
+    static void describe_userdata(lua_State* L, int index, detail::ChannelMessage& message)
+    {
+        detail::ApiUserDataKind kind = detail::api_userdata_kind(L, index, message.apiId, message.typeId);
+        if (kind == detail::API_USERDATA_FOREIGN) luaL_error(L, "can't send foreign userdata through a channel");
+
+        if (kind == detail::API_USERDATA_ENUM_CLASS) {
+            message.type = detail::CHANNEL_ENUM;
+            message.integer = ((const detail::EnumClassContents*)lua_touserdata(L, index))->value;
+            return;
+        }
+
+        // The receiver frees what it gets, so C++ can't be the owner.
+        detail::push_type_registry(L, message.apiId);
+        lua_rawgeti(L, -1, (lua_Integer)message.typeId + 1);
+        lua_getmetatable(L, index);
+        bool owned = lua_rawequal(L, -1, -2) != 0;
+        lua_pop(L, 3);
+        if (!owned) luaL_error(L, "can't send a borrowed instance through a channel");
+
+        const detail::UserDataContents* contents = (const detail::UserDataContents*)lua_touserdata(L, index);
+        if (!contents->instance) luaL_error(L, "can't send an instance that was moved");
+        message.type = detail::CHANNEL_INSTANCE;
+        message.instance = contents->instance;
+    }
+
+    static void free_string(detail::ChannelMessage& message)
+    {
+        if (message.size > detail::ChannelMessage::INLINE_STRING_SIZE) free(message.string);
+    }
+
+    static void push(lua_State* L, detail::ChannelMessage& message)
+    {
+        switch (message.type) {
+        case detail::CHANNEL_NIL: lua_pushnil(L); break;
+        case detail::CHANNEL_BOOLEAN: lua_pushboolean(L, message.boolean); break;
+        case detail::CHANNEL_INTEGER: lua_pushinteger(L, message.integer); break;
+        case detail::CHANNEL_NUMBER: lua_pushnumber(L, message.number); break;
+        case detail::CHANNEL_STRING:
+            lua_pushlstring(L, message.string_data(), message.size);
+            free_string(message);
+            break;
+        case detail::CHANNEL_ENUM:
+        case detail::CHANNEL_INSTANCE:
+            push_user_value(L, message);
+            break;
+        }
+    }
+
+    static void push_user_value(lua_State* L, const detail::ChannelMessage& message)
+    {
+        detail::push_type_registry(L, message.apiId);
+        if (!lua_istable(L, -1)) luaL_error(L, "received a value from an API that isn't exported to this state");
+
+        // [-1]: type registry
+        if (message.type == detail::CHANNEL_ENUM) {
+            lua_pop(L, 1);
+            detail::EnumClassContents* contents = (detail::EnumClassContents*)detail::new_userdata(L, sizeof(*contents), 0);
+            contents->apiId = message.apiId;
+            contents->typeId = message.typeId;
+            contents->value = message.integer;
+            return;
+        }
+
+        if (lua_rawgeti(L, -1, (lua_Integer)message.typeId + 1) != LUA_TTABLE)
+            luaL_error(L, "received an instance of a class that isn't exported to this state");
+
+        // [-2]: type registry
+        // [-1]: instance metatable
+        detail::UserDataContents* contents = (detail::UserDataContents*)lua_newuserdata(L, sizeof(*contents));
+        contents->apiId = message.apiId;
+        contents->typeId = message.typeId;
+        contents->instance = message.instance;
+        lua_insert(L, -2);
+        lua_setmetatable(L, -2);
+        lua_remove(L, -2);
+    }
+
+    // upvalue 1: the channel
+    static int send_function(lua_State* L)
+    {
+        Channel* channel = (Channel*)lua_touserdata(L, lua_upvalueindex(1));
+        lua_settop(L, 2);
+        lua_pushboolean(L, channel->send(L, 2));
+        return 1;
+    }
+
+    // upvalue 1: the channel
+    static int try_receive_function(lua_State* L)
+    {
+        Channel* channel = (Channel*)lua_touserdata(L, lua_upvalueindex(1));
+        if (!channel->receive(L)) {
+            lua_pushboolean(L, 0);
+            return 1;
+        }
+
+        lua_pushboolean(L, 1);
+        lua_insert(L, -2);
+        return 2;
+    }
+
+    // upvalue 1: the channel
+    static int receive_function(lua_State* L)
+    {
+        return receive_continuation(L, LUA_OK, 0);
+    }
+
+    static int receive_continuation(lua_State* L, int, lua_KContext)
+    {
+        Channel* channel = (Channel*)lua_touserdata(L, lua_upvalueindex(1));
+        while (!channel->receive(L)) {
+            // Nothing was pushed; whatever the resumer passed in is dropped.
+            if (lua_isyieldable(L)) return lua_yieldk(L, 0, 0, &receive_continuation);
+            channel->wait();
+        }
+
+        return 1;
+    }
+
+private:
+    bool ready() const
+    {
+        return cells_[dequeuePos_ & mask_].sequence.load(std::memory_order_acquire) == dequeuePos_ + 1;
+    }
+
+private:
+    char const* name_;
+    std::size_t mask_;
+    Cell* cells_;
+
+    char producerPadding_[CACHE_LINE_SIZE];
+    std::atomic<std::size_t> enqueuePos_;
+    char consumerPadding_[CACHE_LINE_SIZE];
+    std::size_t dequeuePos_;
+    std::atomic<bool> waiting_;
+    std::mutex waitMutex_;
+    std::condition_variable waitCondition_;
+};
+
+} // namespace lc
+
+#endif // LC_CHANNEL_HPP
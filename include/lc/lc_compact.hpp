@@ -0,0 +1,292 @@
+#ifndef LC_COMPACT_HPP
+#define LC_COMPACT_HPP
+
+#include <lc/lc.hpp>
+
+//! \file
+//! \brief Method wrappers that share their argument checking and conversion code.
+//!
+//! An lc::Method wrapper inlines the stack managers of every argument, so each binding carries
+//! its own copy of the arity check, the instance checks and every conversion. An lc::CompactMethod
+//! describes its signature with a constant table instead, and hands it to detail::decode_args(),
+//! which is compiled once and shared by every compact method. All that's left per method is
+//! reading the decoded arguments back out and the call itself.
+//!
+//! Booleans, numbers, pointers to API classes and API enum classes are decoded by the shared code.
+//! Anything else (structs, strings, containers, ...) is converted by the wrapper with its stack
+//! manager, as usual. Error messages are the same as lc::Method's.
+//!
+//! Use LC_COMPACT_METHOD() for individual methods, or define LC_COMPACT_BINDINGS before including
+//! lc.hpp to make LC_METHOD() compact everywhere. Compact wrappers are smaller, and usually faster
+//! in big APIs where the inlined wrappers don't fit in the instruction cache; inlined ones are
+//! faster in tight loops over a few methods. bench/call_bench.cpp compares the two.
+//!
+
+#define LC_COMPACT_METHOD(name, ptr) lc::CompactMethod<decltype(ptr), ptr>(name)
+
+namespace lc
+{
+namespace detail
+{
+
+struct ArgDescriptor
+{
+    ArgKind kind;
+    TypeId typeId;             // Classes and enum classes.
+    const bool* derived;       // Classes: whether each API type derives from this one, by type ID.
+    std::size_t numDerived;
+};
+
+struct SignatureDescriptor
+{
+    ApiId apiId;
+    TypeId classId;
+    int numArgs; // Not counting the instance.
+    const ArgDescriptor* args;
+};
+
+template <typename T_, typename TypeSet_, ApiId ApiId_, ArgKind Kind_ = ArgKindOf<T_, TypeSet_, ApiId_>::value>
+struct CompactArg
+{
+    static constexpr ArgDescriptor descriptor() { return ArgDescriptor{ARG_KIND_INLINE, 0, nullptr, 0}; }
+
+    template <std::size_t Index_>
+    static LC_FORCE_INLINE T_ get(lua_State* L, const ArgSlot&) { return StackManager<T_, TypeSet_, ApiId_>::template at<Index_>(L); }
+};
+
+template <typename T_, typename TypeSet_, ApiId ApiId_>
+struct CompactArg<T_, TypeSet_, ApiId_, ARG_KIND_BOOLEAN>
+{
+    static constexpr ArgDescriptor descriptor() { return ArgDescriptor{ARG_KIND_BOOLEAN, 0, nullptr, 0}; }
+
+    template <std::size_t>
+    static LC_FORCE_INLINE T_ get(lua_State*, const ArgSlot& slot) { return slot.boolean; }
+};
+
+template <typename T_, typename TypeSet_, ApiId ApiId_>
+struct CompactArg<T_, TypeSet_, ApiId_, ARG_KIND_INTEGER>
+{
+    static constexpr ArgDescriptor descriptor() { return ArgDescriptor{ARG_KIND_INTEGER, 0, nullptr, 0}; }
+
+    template <std::size_t>
+    static LC_FORCE_INLINE T_ get(lua_State*, const ArgSlot& slot) { return (T_)slot.integer; }
+};
+
+template <typename T_, typename TypeSet_, ApiId ApiId_>
+struct CompactArg<T_, TypeSet_, ApiId_, ARG_KIND_NUMBER>
+{
+    static constexpr ArgDescriptor descriptor() { return ArgDescriptor{ARG_KIND_NUMBER, 0, nullptr, 0}; }
+
+    template <std::size_t>
+    static LC_FORCE_INLINE T_ get(lua_State*, const ArgSlot& slot) { return (T_)slot.number; }
+};
+
+template <typename T_, typename TypeSet_, ApiId ApiId_>
+struct CompactArg<T_, TypeSet_, ApiId_, ARG_KIND_CLASS>
+{
+    using Class = typename unqualified_type<T_>::type;
+    using Derived = DerivedTable<Class, TypeSet_>;
+
+    static constexpr ArgDescriptor descriptor()
+    {
+        return ArgDescriptor{ARG_KIND_CLASS, (TypeId)std::integral_constant<int, TypeSet_::template index_of<Class>()>::value,
+                             Derived::flags.values, sizeof(Derived::flags.values) - 1};
+    }
+
+    template <std::size_t>
+    static LC_FORCE_INLINE T_ get(lua_State*, const ArgSlot& slot) { return (T_)slot.pointer; }
+};
+
+template <typename T_, typename TypeSet_, ApiId ApiId_>
+struct CompactArg<T_, TypeSet_, ApiId_, ARG_KIND_ENUM_CLASS>
+{
+    using Enum = typename unqualified_type<T_>::type;
+
+    static constexpr ArgDescriptor descriptor()
+    {
+        return ArgDescriptor{ARG_KIND_ENUM_CLASS, (TypeId)std::integral_constant<int, TypeSet_::template index_of<Enum>()>::value,
+                             nullptr, 0};
+    }
+
+    template <std::size_t>
+    static LC_FORCE_INLINE T_ get(lua_State*, const ArgSlot& slot) { return (T_)slot.integer; }
+};
+
+//! The descriptor of a signature, shared by every compact method of a class with that signature.
+template <ApiId ApiId_, TypeId ClassId_, typename TypeSet_, typename... Args_>
+struct CompactSignature
+{
+    // The trailing entry keeps the array from being empty.
+    static constexpr ArgDescriptor args[sizeof...(Args_) + 1] = {
+        CompactArg<Args_, TypeSet_, ApiId_>::descriptor()..., ArgDescriptor{ARG_KIND_INLINE, 0, nullptr, 0}
+    };
+    static constexpr SignatureDescriptor value = {ApiId_, ClassId_, (int)sizeof...(Args_), args};
+};
+
+template <ApiId ApiId_, TypeId ClassId_, typename TypeSet_, typename... Args_>
+constexpr ArgDescriptor CompactSignature<ApiId_, ClassId_, TypeSet_, Args_...>::args[sizeof...(Args_) + 1];
+
+template <ApiId ApiId_, TypeId ClassId_, typename TypeSet_, typename... Args_>
+constexpr SignatureDescriptor CompactSignature<ApiId_, ClassId_, TypeSet_, Args_...>::value;
+
+//! Checks the argument count and the instance, and decodes every argument that isn't ARG_KIND_INLINE
+//! into slots (see ArgSlot). The checks are the same as MethodCallWrapperBase's and the stack managers'.
+//!
+//! \returns The instance.
+//!
+LC_NOINLINE inline void* decode_args(lua_State* L, const SignatureDescriptor& signature, ArgSlot* slots)
+{
+    int numArgs = lua_gettop(L);
+    if (numArgs != signature.numArgs + 1) luaL_error(L, "In function '%s': expected %d arguments(including self), got %d",
+                                                     function_name(L), signature.numArgs + 1, numArgs);
+    if (lua_type(L, 1) != LUA_TUSERDATA) luaL_argerror(L, 1, "expected instance. Did you forget to call with ':'?");
+
+    UserDataContents* self = (UserDataContents*)lua_touserdata(L, 1);
+    if (self->apiId != signature.apiId) luaL_argerror(L, 1, "invalid instance(bad API ID)");
+    if (self->typeId != signature.classId) luaL_argerror(L, 1, "invalid instance(bad type ID)");
+    if (!self->instance) luaL_argerror(L, 1, "invalid instance(moved)");
+
+    for (int i = 0; i < signature.numArgs; i++) {
+        const ArgDescriptor& arg = signature.args[i];
+        int index = i + 2;
+
+        switch (arg.kind) {
+        case ARG_KIND_INLINE:
+            break;
+        case ARG_KIND_BOOLEAN:
+            slots[i].boolean = lua_toboolean(L, index) != 0;
+            break;
+        case ARG_KIND_INTEGER:
+            slots[i].integer = luaL_checkinteger(L, index);
+            break;
+        case ARG_KIND_NUMBER:
+            slots[i].number = luaL_checknumber(L, index);
+            break;
+        case ARG_KIND_CLASS: {
+            if (lua_type(L, index) != LUA_TUSERDATA) luaL_argerror(L, index, "class instance expected");
+            UserDataContents* contents = (UserDataContents*)lua_touserdata(L, index);
+            if (contents->apiId != signature.apiId) luaL_argerror(L, index, "type isn't from this API");
+
+            TypeId typeId = contents->typeId;
+            if (typeId != arg.typeId && !(typeId < arg.numDerived && arg.derived[typeId])) luaL_argerror(L, index, "wrong type");
+            if (!contents->instance) luaL_argerror(L, index, "instance was moved");
+
+            slots[i].pointer = contents->instance;
+            break;
+        }
+        case ARG_KIND_ENUM_CLASS: {
+            if (lua_type(L, index) != LUA_TUSERDATA) luaL_argerror(L, index, "enum class expected");
+            EnumClassContents* contents = (EnumClassContents*)lua_touserdata(L, index);
+            if (contents->apiId != signature.apiId) luaL_argerror(L, index, "type isn't from this API");
+            if (contents->typeId != arg.typeId) luaL_argerror(L, index, "wrong type");
+
+            slots[i].integer = contents->value;
+            break;
+        }
+        }
+    }
+
+    return self->instance;
+}
+
+template <ApiId ApiId_,
+          TypeId ClassId_,
+          typename TypeSet_,
+          typename Result_,
+          typename Class_,
+          typename... Args_>
+struct CompactMethodCallWrapper
+{
+    using Pointer = Result_(Class_::*)(Args_...);
+    using Signature = CompactSignature<ApiId_, ClassId_, TypeSet_, Args_...>;
+
+    template <Pointer Func_>
+    static int call(lua_State* L)
+    {
+        return call_impl<Func_>(L, typename detail::BuildIndexSequence<sizeof...(Args_)>::Type{});
+    }
+
+    template <Pointer Func_, std::size_t... Indices_>
+    static LC_FORCE_INLINE int call_impl(lua_State* L, detail::IndexSequence<Indices_...>)
+    {
+        ArgSlot slots[sizeof...(Args_) + 1];
+        Class_* instance = (Class_*)decode_args(L, Signature::value, slots);
+        return StackManager<Result_, TypeSet_, ApiId_>::push(L, (instance->*Func_)(
+               CompactArg<Args_, TypeSet_, ApiId_>::template get<Indices_ + 2>(L, slots[Indices_])...));
+    }
+};
+
+template <ApiId ApiId_,
+          TypeId ClassId_,
+          typename TypeSet_,
+          typename Class_,
+          typename... Args_>
+struct CompactMethodCallWrapper<ApiId_, ClassId_, TypeSet_, void, Class_, Args_...>
+{
+    using Pointer = void(Class_::*)(Args_...);
+    using Signature = CompactSignature<ApiId_, ClassId_, TypeSet_, Args_...>;
+
+    template <Pointer Func_>
+    static int call(lua_State* L)
+    {
+        call_impl<Func_>(L, typename detail::BuildIndexSequence<sizeof...(Args_)>::Type{});
+        return 0;
+    }
+
+    template <Pointer Func_, std::size_t... Indices_>
+    static LC_FORCE_INLINE void call_impl(lua_State* L, detail::IndexSequence<Indices_...>)
+    {
+        ArgSlot slots[sizeof...(Args_) + 1];
+        Class_* instance = (Class_*)decode_args(L, Signature::value, slots);
+        (instance->*Func_)(CompactArg<Args_, TypeSet_, ApiId_>::template get<Indices_ + 2>(L, slots[Indices_])...);
+    }
+};
+
+template <ApiId ApiId_,
+          TypeId ClassId_,
+          typename TypeSet_,
+          typename Result_,
+          typename Class_,
+          typename... Args_>
+auto make_compact_call_wrapper(Result_(Class_::*)(Args_...))
+    -> CompactMethodCallWrapper<ApiId_, ClassId_, TypeSet_, Result_, Class_, Args_...>
+{
+    return CompactMethodCallWrapper<ApiId_, ClassId_, TypeSet_, Result_, Class_, Args_...>{};
+}
+
+} // namespace detail
+
+//! A method whose wrapper decodes its arguments with the shared decoder. Added to classes with
+//! TypeExporter::add_methods(), like lc::Method.
+//!
+template <typename PointerType_, PointerType_ Pointer_>
+class CompactMethod
+{
+public:
+    explicit CompactMethod(char const* name)
+        : name_(name)
+    {}
+
+    char const* name() const { return name_; }
+
+    template <ApiId ApiId_, TypeId TypeId_, typename TypeSet_>
+    static void export_to(lua_State* L, char const* name)
+    {
+        // The shared decoder only knows about instances in userdata, so classes bound as handles
+        // (see lc_handle.hpp) get the usual wrappers.
+        using Wrapper = typename std::conditional<detail::is_handle_type<typename detail::MemberPointerTraits<PointerType_>::Class*,
+                                                                         TypeSet_>::value,
+                        decltype(detail::make_call_wrapper<ApiId_, TypeId_, TypeSet_>(Pointer_)),
+                        decltype(detail::make_compact_call_wrapper<ApiId_, TypeId_, TypeSet_>(Pointer_))>::type;
+
+        detail::push_method<ApiId_, TypeId_, TypeSet_, PointerType_, &Wrapper::template call<Pointer_>>(L, name);
+        lua_setfield(L, -2, name);
+    }
+
+private:
+    char const* name_;
+};
+
+} // namespace lc
+
+#endif // LC_COMPACT_HPP
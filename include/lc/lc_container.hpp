@@ -0,0 +1,294 @@
+#ifndef LC_CONTAINER_HPP
+#define LC_CONTAINER_HPP
+
+#include <lc/detail/lc_stack.hpp>
+
+//! \file
+//! \brief Exposes C++ containers to Lua by reference instead of copying them into tables.
+//!
+//! A bound method that returns an lc::ContainerView gives scripts a userdata that reads and writes
+//! the container directly, converting one element at a time with the usual stack managers:
+//!
+//!     lc::ContainerView<std::vector<Bar*>> bars() { return lc::view(bars_); }
+//!
+//! Sequences (anything with size() and operator[], like std::vector, std::deque or std::array)
+//! are indexed from 1. #view, view[i], view[i] = v, ipairs(view) and pairs(view) all work.
+//! Assigning to an index past the end is an error.
+//!
+//! Maps (anything with a mapped_type, like std::map or std::unordered_map) support view[key],
+//! view[key] = v, view[key] = nil (which erases the key), #view and pairs(view). Erasing the key
+//! that pairs() is on in the middle of a loop is an error.
+//!
+//! Views don't keep their containers alive, so a script must not hold on to one longer than the
+//! container lives. Elements that point to API classes are pushed as borrowed instances, which Lua
+//! never frees; the same goes for them.
+//!
+
+namespace lc
+{
+
+template <typename Container_>
+class ContainerView
+{
+public:
+    using Container = Container_;
+
+    explicit ContainerView(Container_& container)
+        : container_(&container)
+    {}
+
+    Container_& container() const { return *container_; }
+
+private:
+    Container_* container_;
+};
+
+template <typename Container_>
+ContainerView<Container_> view(Container_& container)
+{
+    return ContainerView<Container_>(container);
+}
+
+namespace detail
+{
+
+template <typename>
+struct VoidType { using type = void; };
+
+template <typename Container_, typename = void>
+struct IsMap : std::false_type {};
+
+template <typename Container_>
+struct IsMap<Container_, typename VoidType<typename Container_::mapped_type>::type> : std::true_type {};
+
+template <typename Container_, typename ApiTypeList_, ApiId ApiId_>
+struct ContainerViewMetatable
+{
+    static void* key()
+    {
+        static char key;
+        return &key;
+    }
+
+    //! Whether the value at index is a view of a Container_, i.e. a userdata with this metatable.
+    static bool is_view(lua_State* L, int index)
+    {
+        if (lua_type(L, index) != LUA_TUSERDATA || !lua_getmetatable(L, index)) return false;
+        lua_rawgetp(L, LUA_REGISTRYINDEX, key());
+        bool result = lua_rawequal(L, -1, -2) != 0;
+        lua_pop(L, 2);
+        return result;
+    }
+
+    //! The container of the view in the first argument. The metamethods check it, since the iterator
+    //! that __pairs returns can be called with anything.
+    //!
+    static Container_& self(lua_State* L)
+    {
+        if (!is_view(L, 1)) luaL_argerror(L, 1, "container view expected");
+        return **(Container_**)lua_touserdata(L, 1);
+    }
+
+    static void check_writable(lua_State* L)
+    {
+        if (std::is_const<Container_>::value) luaL_error(L, "attempt to modify a read-only container");
+    }
+};
+
+//! Metamethods for sequences.
+template <typename Container_, typename ApiTypeList_, ApiId ApiId_, bool IsMap_ = IsMap<Container_>::value>
+struct ContainerViewMetamethods : ContainerViewMetatable<Container_, ApiTypeList_, ApiId_>
+{
+    using Base = ContainerViewMetatable<Container_, ApiTypeList_, ApiId_>;
+    using Element = typename std::remove_cv<typename std::remove_reference<
+                    decltype(std::declval<Container_&>()[0])>::type>::type;
+
+    static int index(lua_State* L)
+    {
+        Container_& c = Base::self(L);
+        int isInteger = 0;
+        lua_Integer i = lua_tointegerx(L, 2, &isInteger);
+        if (!isInteger || i < 1 || (std::size_t)i > c.size()) return 0;
+
+        ElementPusher<Element, ApiTypeList_, ApiId_>::push(L, c[(std::size_t)i - 1]);
+        return 1;
+    }
+
+    static int newindex(lua_State* L)
+    {
+        Base::check_writable(L);
+        Container_& c = Base::self(L);
+        lua_Integer i = luaL_checkinteger(L, 2);
+        if (i < 1 || (std::size_t)i > c.size()) luaL_argerror(L, 2, "index out of range");
+
+        assign(c[(std::size_t)i - 1], L);
+        return 0;
+    }
+
+    static int len(lua_State* L)
+    {
+        lua_pushinteger(L, (lua_Integer)Base::self(L).size());
+        return 1;
+    }
+
+    // The control variable is the index of the previous element, so iterating allocates nothing.
+    static int next(lua_State* L)
+    {
+        Container_& c = Base::self(L);
+        lua_Integer i = luaL_checkinteger(L, 2) + 1;
+        if (i < 1 || (std::size_t)i > c.size()) return 0;
+
+        lua_pushinteger(L, i);
+        ElementPusher<Element, ApiTypeList_, ApiId_>::push(L, c[(std::size_t)i - 1]);
+        return 2;
+    }
+
+    static int pairs(lua_State* L)
+    {
+        lua_pushcfunction(L, &next);
+        lua_pushvalue(L, 1);
+        lua_pushinteger(L, 0);
+        return 3;
+    }
+
+private:
+    template <typename T_>
+    static void assign(T_& element, lua_State* L) { element = StackManager<Element, ApiTypeList_, ApiId_>::at(L, 3); }
+
+    template <typename T_>
+    static void assign(const T_&, lua_State* L) { luaL_error(L, "attempt to modify a read-only container"); }
+};
+
+//! Metamethods for maps.
+template <typename Container_, typename ApiTypeList_, ApiId ApiId_>
+struct ContainerViewMetamethods<Container_, ApiTypeList_, ApiId_, true> : ContainerViewMetatable<Container_, ApiTypeList_, ApiId_>
+{
+    using Base = ContainerViewMetatable<Container_, ApiTypeList_, ApiId_>;
+    using Key = typename Container_::key_type;
+    using Mapped = typename Container_::mapped_type;
+    using KeyManager = StackManager<Key, ApiTypeList_, ApiId_>;
+
+    static int index(lua_State* L)
+    {
+        Container_& c = Base::self(L);
+        auto it = c.find(KeyManager::at(L, 2));
+        if (it == c.end()) return 0;
+
+        ElementPusher<Mapped, ApiTypeList_, ApiId_>::push(L, it->second);
+        return 1;
+    }
+
+    static int newindex(lua_State* L)
+    {
+        Base::check_writable(L);
+        modify(Base::self(L), L);
+        return 0;
+    }
+
+    static int len(lua_State* L)
+    {
+        lua_pushinteger(L, (lua_Integer)Base::self(L).size());
+        return 1;
+    }
+
+    // The control variable is the previous key, which is looked up again to find the next one.
+    static int next(lua_State* L)
+    {
+        Container_& c = Base::self(L);
+        auto it = c.begin();
+        if (!lua_isnil(L, 2)) {
+            it = c.find(KeyManager::at(L, 2));
+            if (it == c.end()) luaL_error(L, "container key was removed during iteration");
+            ++it;
+        }
+        if (it == c.end()) return 0;
+
+        ElementPusher<Key, ApiTypeList_, ApiId_>::push(L, it->first);
+        ElementPusher<Mapped, ApiTypeList_, ApiId_>::push(L, it->second);
+        return 2;
+    }
+
+    static int pairs(lua_State* L)
+    {
+        lua_pushcfunction(L, &next);
+        lua_pushvalue(L, 1);
+        lua_pushnil(L);
+        return 3;
+    }
+
+private:
+    template <typename T_>
+    static void modify(T_& c, lua_State* L)
+    {
+        Key key = KeyManager::at(L, 2);
+        if (lua_isnil(L, 3)) {
+            c.erase(key);
+            return;
+        }
+
+        Mapped value = StackManager<Mapped, ApiTypeList_, ApiId_>::at(L, 3);
+        auto it = c.find(key);
+        if (it == c.end()) c.emplace(key, value);
+        else it->second = value;
+    }
+
+    template <typename T_>
+    static void modify(const T_&, lua_State* L) { luaL_error(L, "attempt to modify a read-only container"); }
+};
+
+template <typename Container_, typename ApiTypeList_, ApiId ApiId_>
+class ContainerViewStackManager
+{
+private:
+    using Metamethods = ContainerViewMetamethods<Container_, ApiTypeList_, ApiId_>;
+
+    //! Pushes the view metatable, making it the first time a view of this container type is pushed to L.
+    static void push_metatable(lua_State* L)
+    {
+        if (lua_rawgetp(L, LUA_REGISTRYINDEX, Metamethods::key()) == LUA_TTABLE) return;
+
+        lua_pop(L, 1);
+        lua_createtable(L, 0, 5);
+        lua_pushcfunction(L, &Metamethods::index);
+        lua_setfield(L, -2, "__index");
+        lua_pushcfunction(L, &Metamethods::newindex);
+        lua_setfield(L, -2, "__newindex");
+        lua_pushcfunction(L, &Metamethods::len);
+        lua_setfield(L, -2, "__len");
+        lua_pushcfunction(L, &Metamethods::pairs);
+        lua_setfield(L, -2, "__pairs");
+        lua_pushboolean(L, 0); // Keeps scripts from calling the metamethods on other values.
+        lua_setfield(L, -2, "__metatable");
+        lua_pushvalue(L, -1);
+        lua_rawsetp(L, LUA_REGISTRYINDEX, Metamethods::key());
+    }
+
+public:
+    static int push(lua_State* L, ContainerView<Container_> val)
+    {
+        Container_** contents = (Container_**)new_userdata(L, sizeof(Container_*), 0);
+        *contents = &val.container();
+        push_metatable(L);
+        lua_setmetatable(L, -2);
+        return 1;
+    }
+
+    template <std::size_t Index_>
+    static LC_FORCE_INLINE ContainerView<Container_> at(lua_State* L) { return at(L, (int)Index_); }
+
+    static ContainerView<Container_> at(lua_State* L, int index)
+    {
+        if (!Metamethods::is_view(L, index)) luaL_argerror(L, index, "container view expected");
+        return ContainerView<Container_>(**(Container_**)lua_touserdata(L, index));
+    }
+};
+
+template <typename Container_, typename ApiTypeList_, ApiId ApiId_>
+struct StackManager<ContainerView<Container_>, ApiTypeList_, ApiId_>
+       : ContainerViewStackManager<Container_, ApiTypeList_, ApiId_> {};
+
+} // namespace detail
+
+} // namespace lc
+
+#endif // LC_CONTAINER_HPP
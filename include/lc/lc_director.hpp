@@ -0,0 +1,310 @@
+#ifndef LC_DIRECTOR_HPP
+#define LC_DIRECTOR_HPP
+
+#include <cstdint>
+#include <lc/lc.hpp>
+#include <lc/lc_container.hpp>
+
+//! \file
+//! \brief Virtual methods that scripts can override.
+//!
+//! A director is a C++ subclass whose overrides of virtual methods check whether the script has
+//! overridden them too, and call the script's function if so:
+//!
+//!     struct Types;
+//!
+//!     class ScriptedActor : public Actor, public lc::Director<Types>
+//!     {
+//!     public:
+//!         void update(float dt) override
+//!         {
+//!             if (!dispatch<0>("update", dt)) Actor::update(dt);
+//!         }
+//!
+//!         int score() const override
+//!         {
+//!             int result;
+//!             return dispatch_result<1>("score", result) ? result : Actor::score();
+//!         }
+//!     };
+//!
+//!     struct Types : lc::TypeSet<lc::Class<Actor>, lc::Class<ScriptedActor>> {};
+//!
+//! ScriptedActor is bound like any other class. Scripts override a method by assigning a function
+//! to it on an instance, and C++ code that calls update() through an Actor* ends up in the script:
+//!
+//!     local actor = Api.ScriptedActor()
+//!     function actor:update(dt) self.age = (self.age or 0) + dt end
+//!
+//! Each overridable method gets a slot number, below 32, that's unique within the class. Whether a
+//! slot is overridden is looked up once per instance and cached in a bitmask, until a script assigns
+//! a function (or nil) to a field of any director, so a call that isn't overridden costs a couple of
+//! compares. Only the first override of a slot pays for the lookup.
+//!
+//! - Overrides are called with the instance as self. Pointers to API classes are passed borrowed,
+//!   so the script can't free them. Results are read back with the usual stack managers.
+//! - If an override raises an error, it goes to the handler set with lc::set_director_error_handler,
+//!   and dispatch() returns false, so the C++ implementation runs instead.
+//! - Overrides live in the instance's fields, so they last as long as its userdata. A director keeps
+//!   the userdata it was first pushed with while that's alive, and pushing it again pushes the same one.
+//! - Overrides are called on the main thread of the state the director was pushed to. Directors that
+//!   were never pushed to Lua never call into it.
+//!
+
+namespace lc
+{
+
+//! Called with an override's error message on top of the stack, which it doesn't have to pop.
+using DirectorErrorHandler = void(*)(lua_State* L, void* userData);
+
+namespace detail
+{
+
+struct DirectorErrors
+{
+    DirectorErrorHandler handler = nullptr;
+    void* userData = nullptr;
+
+    static DirectorErrors& get()
+    {
+        static DirectorErrors errors;
+        return errors;
+    }
+};
+
+//! Registry key of the table mapping directors (light userdata) to their userdata. Its values are
+//! weak, so that the table doesn't keep instances alive.
+//!
+struct DirectorTableKey
+{
+    static void* value()
+    {
+        static char key;
+        return &key;
+    }
+};
+
+inline void push_director_table(lua_State* L)
+{
+    if (lua_rawgetp(L, LUA_REGISTRYINDEX, DirectorTableKey::value()) == LUA_TTABLE) return;
+
+    lua_pop(L, 1);
+    lua_newtable(L);
+    lua_createtable(L, 0, 1);
+    lua_pushliteral(L, "v");
+    lua_setfield(L, -2, "__mode");
+    lua_setmetatable(L, -2);
+    lua_pushvalue(L, -1);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, DirectorTableKey::value());
+}
+
+//! Calls an override that returns a value, and reads the value back, under lua_pcall:
+//! reading it raises an error if it has the wrong type.
+//!
+template <typename Result_, typename TypeSet_, ApiId ApiId_>
+int call_override_result(lua_State* L)
+{
+    // [1]: Result_* as light userdata
+    // [2]: override
+    // [3]: self
+    // [4...]: arguments
+    lua_call(L, lua_gettop(L) - 2, 1);
+    *(Result_*)lua_touserdata(L, 1) = StackManager<Result_, TypeSet_, ApiId_>::at(L, -1);
+    return 0;
+}
+
+}
+
+//! Sets what happens to errors raised by overrides. By default they're ignored.
+inline void set_director_error_handler(DirectorErrorHandler handler, void* userData = nullptr)
+{
+    detail::DirectorErrors::get().handler = handler;
+    detail::DirectorErrors::get().userData = userData;
+}
+
+//! What every director derives from, whatever its API. See lc::Director.
+class DirectorBase
+{
+public:
+    //! Number of overridable methods a director can have.
+    static constexpr unsigned max_slots() { return 32; }
+
+    //! The state that overrides are called in, or null if the director was never pushed to Lua.
+    lua_State* lua_state() const { return L_; }
+
+protected:
+    DirectorBase() : L_(nullptr), generation_(0), resolved_(0), overridden_(0) {}
+    DirectorBase(const DirectorBase&) : DirectorBase() {} // Copies aren't bound to anything.
+    DirectorBase& operator=(const DirectorBase&) { return *this; }
+    ~DirectorBase() = default;
+
+    //! Whether the script overrides the method in the given slot. It's only looked up the first time,
+    //! and again after scripts have changed some director's overrides.
+    //!
+    LC_FORCE_INLINE bool is_overridden(unsigned slot, char const* name) const
+    {
+        assert(slot < max_slots() && "(LC): Director method slots must be below 32.");
+        std::uint32_t bit = std::uint32_t(1) << slot;
+        if (generation_ != detail::override_generation()) {
+            generation_ = detail::override_generation();
+            resolved_ = 0;
+            overridden_ = 0;
+        }
+        if (!(resolved_ & bit)) resolve(bit, name);
+        return (overridden_ & bit) != 0;
+    }
+
+    //! Pushes the override of the method with the given name and the instance, as its self.
+    //! \returns False, having pushed nothing, if the instance's userdata has been collected since
+    //! is_overridden looked, or the override is gone.
+    //!
+    bool push_override(lua_State* L, char const* name) const
+    {
+        if (!detail::push_director(L, const_cast<DirectorBase*>(this))) return false;
+        if (lua_getuservalue(L, -1) != LUA_TTABLE || lua_getfield(L, -1, name) != LUA_TFUNCTION) {
+            lua_pop(L, 3);
+            return false;
+        }
+
+        // [-3]: self
+        // [-2]: fields table
+        // [-1]: override
+        lua_replace(L, -2);
+        lua_insert(L, -2);
+        return true;
+    }
+
+    //! lua_pcall that hands errors to the director error handler. Pops the error, if there is one.
+    static bool protected_call(lua_State* L, int numArgs, int numResults)
+    {
+        if (lua_pcall(L, numArgs, numResults, 0) == LUA_OK) return true;
+        detail::DirectorErrors& errors = detail::DirectorErrors::get();
+        if (errors.handler) errors.handler(L, errors.userData);
+        lua_pop(L, 1);
+        return false;
+    }
+
+private:
+    LC_NOINLINE void resolve(std::uint32_t bit, char const* name) const
+    {
+        resolved_ |= bit;
+        if (!L_) return;
+
+        int top = lua_gettop(L_);
+        if (detail::push_director(L_, const_cast<DirectorBase*>(this)) &&
+            lua_getuservalue(L_, -1) == LUA_TTABLE &&
+            lua_getfield(L_, -1, name) == LUA_TFUNCTION) {
+            overridden_ |= bit;
+        }
+        lua_settop(L_, top);
+    }
+
+    friend bool detail::push_director(lua_State* L, DirectorBase* director);
+    friend void detail::bind_director(lua_State* L, DirectorBase* director);
+
+private:
+    lua_State* L_;
+
+    // What is_overridden found out, and under which override generation.
+    mutable std::uint32_t generation_;
+    mutable std::uint32_t resolved_;
+    mutable std::uint32_t overridden_;
+};
+
+//! Base of classes whose virtual methods scripts can override. The type set and API ID are the
+//! ones the class is exported with; they're used to pass arguments and read results.
+//!
+template <typename TypeSet_, ApiId ApiId_ = 0>
+class Director : public DirectorBase
+{
+protected:
+    //! Calls the script's override of a method, if there is one.
+    //! \returns Whether the override was called and returned without an error.
+    //!
+    template <unsigned Slot_, typename... Args_>
+    LC_FORCE_INLINE bool dispatch(char const* name, const Args_&... args) const
+    {
+        static_assert(Slot_ < 32, "(LC): Director method slots must be below 32.");
+        return is_overridden(Slot_, name) && call(name, args...);
+    }
+
+    //! Calls the script's override of a method that returns a value, if there is one.
+    //! \returns Whether the override was called and returned a Result_, which is then in result.
+    //!
+    template <unsigned Slot_, typename Result_, typename... Args_>
+    LC_FORCE_INLINE bool dispatch_result(char const* name, Result_& result, const Args_&... args) const
+    {
+        static_assert(Slot_ < 32, "(LC): Director method slots must be below 32.");
+        return is_overridden(Slot_, name) && call_result(name, result, args...);
+    }
+
+private:
+    template <typename... Args_>
+    LC_NOINLINE bool call(char const* name, const Args_&... args) const
+    {
+        lua_State* L = lua_state();
+        if (!lua_checkstack(L, (int)sizeof...(Args_) + 3)) return false;
+        if (!push_override(L, name)) return false;
+
+        using Expand = int[];
+        (void)Expand{0, (detail::ElementPusher<Args_, TypeSet_, ApiId_>::push(L, args), 0)...};
+        return protected_call(L, (int)sizeof...(Args_) + 1, 0);
+    }
+
+    template <typename Result_, typename... Args_>
+    LC_NOINLINE bool call_result(char const* name, Result_& result, const Args_&... args) const
+    {
+        lua_State* L = lua_state();
+        if (!lua_checkstack(L, (int)sizeof...(Args_) + 4)) return false;
+        lua_pushcfunction(L, (&detail::call_override_result<Result_, TypeSet_, ApiId_>));
+        lua_pushlightuserdata(L, &result);
+        if (!push_override(L, name)) {
+            lua_pop(L, 2);
+            return false;
+        }
+
+        using Expand = int[];
+        (void)Expand{0, (detail::ElementPusher<Args_, TypeSet_, ApiId_>::push(L, args), 0)...};
+        return protected_call(L, (int)sizeof...(Args_) + 3, 0);
+    }
+};
+
+namespace detail
+{
+
+//! Pushes the userdata a director is bound to.
+//! \returns False, having pushed nothing, if it isn't bound to a live one in L.
+//!
+inline bool push_director(lua_State* L, DirectorBase* director)
+{
+    if (director->L_ == nullptr) return false;
+
+    push_director_table(L);
+    if (lua_rawgetp(L, -1, director) != LUA_TUSERDATA) {
+        lua_pop(L, 2);
+        return false;
+    }
+    lua_remove(L, -2);
+    return true;
+}
+
+//! Binds a director to the userdata on top of the stack, and to the main thread of its state,
+//! since the thread that happened to push it might be a coroutine that finishes before it does.
+//!
+inline void bind_director(lua_State* L, DirectorBase* director)
+{
+    push_director_table(L);
+    lua_pushvalue(L, -2);
+    lua_rawsetp(L, -2, director);
+    lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+    director->L_ = lua_tothread(L, -1);
+    lua_pop(L, 2);
+
+    director->generation_ = 0;
+}
+
+}
+
+}
+
+#endif // LC_DIRECTOR_HPP
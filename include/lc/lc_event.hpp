@@ -0,0 +1,440 @@
+#ifndef LC_EVENT_HPP
+#define LC_EVENT_HPP
+
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <lc/detail/lc_stack.hpp>
+
+//! \file
+//! \brief Events that C++ queues up and delivers to scripts in batches.
+//!
+//! Calling into Lua once per handler per event, pushing the arguments anew every time, adds up
+//! quickly when there are thousands of events a frame. An lc::EventBus queues events per type instead,
+//! and flush() calls each handler once with every event of a type that was posted since the last flush:
+//!
+//!     struct Damage { Actor* target; int amount; };  // registered with lc::Struct, Actor with lc::Class
+//!
+//!     lc::EventBus<Types> events("Events");
+//!     auto& damage = events.add_event<Damage>("damage");
+//!     events.export_to(L);
+//!
+//!     damage.post(Damage{target, 10});
+//!     ...
+//!     events.flush(L);
+//!
+//!     Events:subscribe("damage", function(batch)
+//!         for i = 1, #batch do
+//!             local event = batch[i]
+//!             event.target:hurt(event.amount)
+//!         end
+//!     end)
+//!
+//! Payloads can be any type the API can push. A batch doesn't make a value per event:
+//! - For classes, batch[i] is the same borrowed userdata every time, pointed at event i.
+//! - For lc::Struct types, it's the same table every time, with event i's fields. Fields that point
+//!   to API classes are borrowed instances, so the table never owns what they point to.
+//! - Pointers to API classes are borrowed instances too: posting one never hands the object to Lua.
+//! - Anything else (numbers, enum class values, handles) is pushed as usual.
+//!
+//! So a payload is only valid until the next batch[i], and scripts have to copy out whatever they
+//! want to keep. Once the flush is over, batches are empty, and class payloads are moved out.
+//!
+//! Flushing allocates nothing once the queues have grown to their usual size. Events posted while
+//! handlers are running are delivered by the next flush. A bus isn't thread-safe, and it's usually
+//! exported to one state: flush(L) hands the queued events to L's handlers only.
+//!
+
+namespace lc
+{
+
+namespace detail
+{
+
+//! Userdata that handlers get the events of a flush through. Its user value is the object that
+//! payloads are pushed in.
+//!
+struct EventBatch
+{
+    const void* events = nullptr;
+    std::size_t size = 0;
+    //! Pushes events[i]. The batch is at index 1.
+    void (*push)(lua_State* L, const EventBatch& batch, std::size_t i) = nullptr;
+    //! Called once a flush is over, with the index of the batch.
+    void (*release)(lua_State* L, int batch) = nullptr;
+};
+
+template <typename T_, typename TypeSet_, ApiId ApiId_,
+          bool IsStruct_ = is_struct_type<T_, TypeSet_>::value,
+          bool IsClass_ = std::is_class<T_>::value && TypeSet_::template contains<T_>()>
+struct EventPayload
+{
+    // ElementPusher borrows pointers to API classes.
+    static void push(lua_State* L, const EventBatch& batch, std::size_t i)
+    {
+        ElementPusher<T_, TypeSet_, ApiId_>::push(L, ((const T_*)batch.events)[i]);
+    }
+
+    static void release(lua_State*, int) {}
+};
+
+template <typename T_, typename TypeSet_, ApiId ApiId_>
+struct EventPayload<T_, TypeSet_, ApiId_, false, true>
+{
+    static void push(lua_State* L, const EventBatch& batch, std::size_t i)
+    {
+        T_* event = (T_*)batch.events + i;
+        if (lua_getuservalue(L, 1) == LUA_TUSERDATA) {
+            ((UserDataContents*)lua_touserdata(L, -1))->instance = event;
+            return;
+        }
+
+        lua_pop(L, 1);
+        ClassStackManager<T_, TypeSet_, ApiId_>::push_borrowed(L, event);
+        lua_pushvalue(L, -1);
+        lua_setuservalue(L, 1);
+    }
+
+    //! Events are gone after a flush, so scripts that kept a payload get "moved" errors instead.
+    static void release(lua_State* L, int batch)
+    {
+        if (lua_getuservalue(L, batch) == LUA_TUSERDATA)
+            ((UserDataContents*)lua_touserdata(L, -1))->instance = nullptr;
+        lua_pop(L, 1);
+    }
+};
+
+template <typename T_, typename TypeSet_, ApiId ApiId_>
+struct EventPayload<T_, TypeSet_, ApiId_, true, false>
+{
+    static void push(lua_State* L, const EventBatch& batch, std::size_t i)
+    {
+        if (lua_getuservalue(L, 1) != LUA_TTABLE) {
+            lua_pop(L, 1);
+            lua_newtable(L);
+            lua_pushvalue(L, -1);
+            lua_setuservalue(L, 1);
+        }
+
+        StructStackManager<T_, TypeSet_, ApiId_>::assign(L, -1, ((const T_*)batch.events)[i]);
+    }
+
+    static void release(lua_State*, int) {}
+};
+
+//! __index of batches. Out of range indices give nil, as they would for a table.
+inline int event_batch_index(lua_State* L)
+{
+    const EventBatch* batch = (const EventBatch*)lua_touserdata(L, 1);
+    lua_Integer i = luaL_checkinteger(L, 2);
+    if (i < 1 || (std::size_t)i > batch->size) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    batch->push(L, *batch, (std::size_t)i - 1);
+    return 1;
+}
+
+inline int event_batch_len(lua_State* L)
+{
+    lua_pushinteger(L, (lua_Integer)((const EventBatch*)lua_touserdata(L, 1))->size);
+    return 1;
+}
+
+struct EventBatchMetatableKey
+{
+    static void* value()
+    {
+        static char key;
+        return &key;
+    }
+};
+
+inline void push_event_batch_metatable(lua_State* L)
+{
+    if (lua_rawgetp(L, LUA_REGISTRYINDEX, EventBatchMetatableKey::value()) == LUA_TTABLE) return;
+
+    lua_pop(L, 1);
+    lua_createtable(L, 0, 3);
+    lua_pushcfunction(L, &event_batch_index);
+    lua_setfield(L, -2, "__index");
+    lua_pushcfunction(L, &event_batch_len);
+    lua_setfield(L, -2, "__len");
+    lua_pushliteral(L, "event batch");
+    lua_setfield(L, -2, "__metatable");
+    lua_pushvalue(L, -1);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, EventBatchMetatableKey::value());
+}
+
+class EventQueueBase
+{
+public:
+    virtual ~EventQueueBase() = default;
+
+    virtual std::size_t size() const = 0;
+
+    //! Sets the queued events aside for the batch, so that handlers can post more while they run.
+    virtual void begin_flush(EventBatch& batch) = 0;
+    virtual void end_flush(EventBatch& batch) = 0;
+};
+
+} // namespace detail
+
+//! The queue of one type of event on an lc::EventBus.
+template <typename T_>
+class EventQueue : public detail::EventQueueBase
+{
+public:
+    void post(const T_& event) { queued_.push_back(event); }
+    void post(T_&& event) { queued_.push_back(std::move(event)); }
+
+    template <typename... Args_>
+    void emplace(Args_&&... args) { queued_.emplace_back(std::forward<Args_>(args)...); }
+
+    //! Number of events waiting for the next flush.
+    std::size_t size() const override { return queued_.size(); }
+
+    //! Drops the events waiting for the next flush.
+    void clear() { queued_.clear(); }
+
+    //! Reserves room for this many events per flush, so that not even the first few flushes allocate.
+    void reserve(std::size_t capacity)
+    {
+        queued_.reserve(capacity);
+        flushing_.reserve(capacity);
+    }
+
+private:
+    // The two vectors trade places on every flush, and both keep their capacity.
+    void begin_flush(detail::EventBatch& batch) override
+    {
+        flushing_.swap(queued_);
+        batch.events = flushing_.data();
+        batch.size = flushing_.size();
+    }
+
+    void end_flush(detail::EventBatch& batch) override
+    {
+        batch.events = nullptr;
+        batch.size = 0;
+        flushing_.clear();
+    }
+
+private:
+    std::vector<T_> queued_;
+    std::vector<T_> flushing_;
+};
+
+template <typename TypeSet_, ApiId ApiId_ = 0>
+class EventBus
+{
+public:
+    //! Called with a handler's error message on top of the stack, which it doesn't have to pop.
+    using ErrorHandler = void(*)(lua_State* L, void* userData);
+
+public:
+    //! \param name The name of the global that export_to() sets.
+    explicit EventBus(char const* name)
+        : name_(name), errorHandler_(nullptr), errorUserData_(nullptr), flushing_(false)
+    {
+    }
+
+    EventBus(const EventBus&) = delete;
+    EventBus& operator=(const EventBus&) = delete;
+
+    char const* name() const { return name_; }
+
+    //! Adds a type of event, which scripts subscribe to by name. Has to be called before export_to().
+    //! The queue lives as long as the bus.
+    //!
+    template <typename T_>
+    EventQueue<T_>& add_event(char const* name)
+    {
+        using Payload = detail::EventPayload<T_, TypeSet_, ApiId_>;
+        EventQueue<T_>* queue = new EventQueue<T_>();
+        events_.push_back(Event{name, std::unique_ptr<detail::EventQueueBase>(queue), &Payload::push, &Payload::release});
+        return *queue;
+    }
+
+    //! Sets what happens to errors raised by handlers. By default they're ignored. Either way,
+    //! the rest of the handlers still get the batch.
+    //!
+    void set_error_handler(ErrorHandler handler, void* userData = nullptr)
+    {
+        errorHandler_ = handler;
+        errorUserData_ = userData;
+    }
+
+    //! Sets a global named after the bus with the following functions, called with ':':
+    //! - subscribe(event, handler): handler will be called with batches of the named event.
+    //!   Returns the handler.
+    //! - unsubscribe(event, handler): returns whether the handler was subscribed.
+    //!
+    //! The bus has to outlive the state.
+    //!
+    void export_to(lua_State* L) const
+    {
+        // Handlers and batches live in a table in the registry, keyed by the bus:
+        // ["name"]: the event's number, i, from 1
+        // [i]: array of handlers
+        // [-i]: batch
+        int numEvents = (int)events_.size();
+        lua_createtable(L, numEvents, numEvents);
+        for (int i = 0; i < numEvents; i++) {
+            lua_pushinteger(L, i + 1);
+            lua_setfield(L, -2, events_[i].name);
+            lua_newtable(L);
+            lua_rawseti(L, -2, i + 1);
+
+            detail::EventBatch* batch = (detail::EventBatch*)lua_newuserdata(L, sizeof(detail::EventBatch));
+            new (batch) detail::EventBatch();
+            batch->push = events_[i].push;
+            batch->release = events_[i].release;
+            detail::push_event_batch_metatable(L);
+            lua_setmetatable(L, -2);
+            lua_rawseti(L, -2, -(i + 1));
+        }
+
+        lua_pushvalue(L, -1);
+        lua_rawsetp(L, LUA_REGISTRYINDEX, this);
+
+        // [-1]: handlers table
+        lua_createtable(L, 0, 2);
+        lua_pushvalue(L, -2);
+        lua_pushcclosure(L, &subscribe_function, 1);
+        lua_setfield(L, -2, "subscribe");
+        lua_pushvalue(L, -2);
+        lua_pushcclosure(L, &unsubscribe_function, 1);
+        lua_setfield(L, -2, "unsubscribe");
+        lua_setglobal(L, name_);
+        lua_pop(L, 1);
+    }
+
+    //! Calls each of L's handlers once with the events of its type that were posted since the last flush,
+    //! and empties the queues. Events that no handler is subscribed to are dropped.
+    //! Flushing from a handler does nothing.
+    //!
+    void flush(lua_State* L)
+    {
+        if (flushing_) return;
+        if (lua_rawgetp(L, LUA_REGISTRYINDEX, this) != LUA_TTABLE) {
+            lua_pop(L, 1);
+            return;
+        }
+
+        flushing_ = true;
+        int handlers = lua_gettop(L);
+        for (std::size_t i = 0; i < events_.size(); i++) {
+            detail::EventQueueBase& queue = *events_[i].queue;
+            if (!queue.size()) continue;
+
+            lua_rawgeti(L, handlers, (lua_Integer)i + 1);
+            lua_rawgeti(L, handlers, -((lua_Integer)i + 1));
+            // [-2]: array of handlers. Subscribing makes a new one, so this one stays the same throughout.
+            // [-1]: batch
+            detail::EventBatch* batch = (detail::EventBatch*)lua_touserdata(L, -1);
+            int batchIndex = lua_gettop(L);
+            lua_Integer numHandlers = (lua_Integer)lua_rawlen(L, -2);
+
+            queue.begin_flush(*batch);
+            for (lua_Integer h = 1; h <= numHandlers; h++) {
+                lua_rawgeti(L, batchIndex - 1, h);
+                lua_pushvalue(L, batchIndex);
+                if (lua_pcall(L, 1, 0, 0) != LUA_OK) {
+                    if (errorHandler_) errorHandler_(L, errorUserData_);
+                    lua_pop(L, 1);
+                }
+            }
+
+            batch->release(L, batchIndex);
+            queue.end_flush(*batch);
+            lua_pop(L, 2);
+        }
+
+        flushing_ = false;
+        lua_pop(L, 1);
+    }
+
+private:
+    struct Event
+    {
+        char const* name;
+        std::unique_ptr<detail::EventQueueBase> queue;
+        void (*push)(lua_State* L, const detail::EventBatch& batch, std::size_t i);
+        void (*release)(lua_State* L, int batch);
+    };
+
+    //! Pushes the array of handlers of the event named at index 2. Upvalue 1 is the handlers table.
+    static lua_Integer check_event(lua_State* L)
+    {
+        char const* name = luaL_checkstring(L, 2);
+        lua_pushvalue(L, 2);
+        if (lua_rawget(L, lua_upvalueindex(1)) != LUA_TNUMBER)
+            luaL_argerror(L, 2, lua_pushfstring(L, "no event named '%s'", name));
+
+        lua_Integer event = lua_tointeger(L, -1);
+        lua_pop(L, 1);
+        lua_rawgeti(L, lua_upvalueindex(1), event);
+        return event;
+    }
+
+    // upvalue 1: the handlers table
+    static int subscribe_function(lua_State* L)
+    {
+        luaL_checktype(L, 3, LUA_TFUNCTION);
+        lua_settop(L, 3);
+        lua_Integer event = check_event(L);
+
+        // Handlers are copied on write, so that flush() can go through them while they change.
+        lua_Integer numHandlers = (lua_Integer)lua_rawlen(L, 4);
+        lua_createtable(L, (int)numHandlers + 1, 0);
+        for (lua_Integer i = 1; i <= numHandlers; i++) {
+            lua_rawgeti(L, 4, i);
+            lua_rawseti(L, -2, i);
+        }
+        lua_pushvalue(L, 3);
+        lua_rawseti(L, -2, numHandlers + 1);
+        lua_rawseti(L, lua_upvalueindex(1), event);
+
+        lua_pushvalue(L, 3);
+        return 1;
+    }
+
+    // upvalue 1: the handlers table
+    static int unsubscribe_function(lua_State* L)
+    {
+        lua_settop(L, 3);
+        lua_Integer event = check_event(L);
+
+        lua_Integer numHandlers = (lua_Integer)lua_rawlen(L, 4);
+        lua_createtable(L, (int)numHandlers, 0);
+        lua_Integer kept = 0;
+        for (lua_Integer i = 1; i <= numHandlers; i++) {
+            lua_rawgeti(L, 4, i);
+            if (kept + 1 == i && lua_rawequal(L, -1, 3)) {
+                lua_pop(L, 1); // Only the first subscription goes.
+                continue;
+            }
+            lua_rawseti(L, -2, ++kept);
+        }
+
+        bool found = kept < numHandlers;
+        if (found) lua_rawseti(L, lua_upvalueindex(1), event);
+        lua_pushboolean(L, found);
+        return 1;
+    }
+
+private:
+    char const* name_;
+    std::vector<Event> events_;
+    ErrorHandler errorHandler_;
+    void* errorUserData_;
+    bool flushing_;
+};
+
+} // namespace lc
+
+#endif // LC_EVENT_HPP
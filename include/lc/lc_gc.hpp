@@ -0,0 +1,200 @@
+#ifndef LC_GC_HPP
+#define LC_GC_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include <lc/detail/lc_common.hpp>
+
+//! \file
+//! \brief Runs the incremental collector in time-boxed slices, at points of the host's choosing.
+//!
+//! Between frames (or requests), call lc::GcController::step() with however much time is left.
+//! It runs collector steps until the budget is used up or a cycle finishes, and records how long
+//! each step took and how much memory it freed, so the budget and step size can be tuned from
+//! the pause percentiles.
+//!
+
+namespace lc
+{
+
+enum class GcMode
+{
+    INCREMENTAL,
+    GENERATIONAL // Lua 5.4 and later.
+};
+
+//! Switches L's collector to the given mode, keeping its current parameters. Generational mode
+//! collects young objects often and cheaply, which suits scripts that make lots of short-lived
+//! tables and userdata. Its steps are whole minor collections, so lc::GcController budgets are coarser.
+//!
+//! \returns Whether the collector is in that mode now. Lua 5.3 only has the incremental one.
+//!
+inline bool set_gc_mode(lua_State* L, GcMode mode)
+{
+#if LUA_VERSION_NUM >= 504
+    lua_gc(L, mode == GcMode::GENERATIONAL ? LUA_GCGEN : LUA_GCINC, 0, 0, 0);
+    return true;
+#else
+    (void)L;
+    return mode == GcMode::INCREMENTAL;
+#endif
+}
+
+//! Summary of the most recent collector steps.
+struct GcStats
+{
+    std::size_t steps = 0;          // Steps recorded since the last reset, including ones that fell out of the window.
+    std::size_t cycles = 0;         // Collection cycles finished during those steps.
+    double p50 = 0.0;               // Step pause percentiles over the window, in seconds.
+    double p99 = 0.0;
+    double max = 0.0;
+    std::size_t bytesReclaimed = 0; // Bytes freed by those steps; steps that grew the heap count as 0.
+    double bytesPerStep = 0.0;      // Mean net bytes freed per step over the window.
+};
+
+class GcController
+{
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Sample
+    {
+        double seconds;
+        long long bytesReclaimed; // Negative when finalizers or the step allocated more than was freed.
+    };
+
+    static void* registry_key()
+    {
+        static char key;
+        return &key;
+    }
+
+public:
+    //! \param manual Stop the automatic collector, so that it only runs in step(). This also keeps
+    //!        lc::NativeSize reports from driving the collector, since they only add debt to a running one.
+    //! \param window How many of the most recent steps the percentiles are taken over.
+    //!
+    //! There can be at most one controller per lua_State, and it has to be destroyed before the state is closed.
+    //!
+    explicit GcController(lua_State* L, bool manual = true, std::size_t window = 1024)
+        : L_(L), manual_(manual), stepSize_(0), samples_(window ? window : 1), nextSample_(0), numSamples_(0)
+    {
+        lua_pushlightuserdata(L, this);
+        lua_rawsetp(L, LUA_REGISTRYINDEX, registry_key());
+        if (manual_) lua_gc(L, LUA_GCSTOP, 0);
+    }
+
+    ~GcController()
+    {
+        if (manual_) lua_gc(L_, LUA_GCRESTART, 0);
+        lua_pushnil(L_);
+        lua_rawsetp(L_, LUA_REGISTRYINDEX, registry_key());
+    }
+
+    GcController(const GcController&) = delete;
+    GcController& operator=(const GcController&) = delete;
+
+    //! Returns the controller attached to L's main state, or nullptr.
+    static GcController* from(lua_State* L)
+    {
+        lua_rawgetp(L, LUA_REGISTRYINDEX, registry_key());
+        GcController* result = (GcController*)lua_touserdata(L, -1);
+        lua_pop(L, 1);
+        return result;
+    }
+
+    //! How much work each step does, as for lua_gc(L, LUA_GCSTEP, kb). 0 does one basic step.
+    //! Smaller steps stick to the budget more closely but have more overhead.
+    //!
+    void set_step_size(int kb) { stepSize_ = kb > 0 ? kb : 0; }
+
+    //! Runs collector steps until budgetSeconds have passed or a cycle finishes.
+    //! The last step can overshoot the budget by up to one step's pause.
+    //!
+    //! \returns Whether a cycle finished.
+    //!
+    bool step(double budgetSeconds)
+    {
+        Clock::time_point start = Clock::now();
+        Clock::time_point now = start;
+        bool finished = false;
+        while (!finished && std::chrono::duration<double>(now - start).count() < budgetSeconds) {
+            long long before = bytes_in_use();
+            finished = lua_gc(L_, LUA_GCSTEP, stepSize_) != 0;
+            long long after = bytes_in_use();
+
+            Clock::time_point stepEnd = Clock::now();
+            record(std::chrono::duration<double>(stepEnd - now).count(), before - after, finished);
+            now = stepEnd;
+        }
+
+        return finished;
+    }
+
+    GcStats stats() const
+    {
+        GcStats result = stats_;
+        if (numSamples_ == 0) return result;
+
+        std::vector<double> pauses(numSamples_);
+        long long windowBytes = 0;
+        for (std::size_t i = 0; i < numSamples_; i++) {
+            pauses[i] = samples_[i].seconds;
+            windowBytes += samples_[i].bytesReclaimed;
+        }
+
+        result.bytesPerStep = (double)windowBytes / (double)numSamples_;
+        result.p50 = percentile(pauses, 0.50);
+        result.p99 = percentile(pauses, 0.99);
+        result.max = *std::max_element(pauses.begin(), pauses.end());
+        return result;
+    }
+
+    void reset_stats()
+    {
+        stats_ = GcStats();
+        nextSample_ = 0;
+        numSamples_ = 0;
+    }
+
+private:
+    long long bytes_in_use() const
+    {
+        return (long long)lua_gc(L_, LUA_GCCOUNT, 0) * 1024 + lua_gc(L_, LUA_GCCOUNTB, 0);
+    }
+
+    void record(double seconds, long long bytesReclaimed, bool finished)
+    {
+        Sample& s = samples_[nextSample_];
+        s.seconds = seconds;
+        s.bytesReclaimed = bytesReclaimed;
+        nextSample_ = (nextSample_ + 1) % samples_.size();
+        if (numSamples_ < samples_.size()) numSamples_++;
+
+        stats_.steps++;
+        if (finished) stats_.cycles++;
+        if (bytesReclaimed > 0) stats_.bytesReclaimed += (std::size_t)bytesReclaimed;
+    }
+
+    //! Nearest-rank percentile; reorders values.
+    static double percentile(std::vector<double>& values, double p)
+    {
+        std::size_t rank = (std::size_t)(p * (double)(values.size() - 1) + 0.5);
+        std::nth_element(values.begin(), values.begin() + rank, values.end());
+        return values[rank];
+    }
+
+private:
+    lua_State* L_;
+    bool manual_;
+    int stepSize_;
+    std::vector<Sample> samples_;
+    std::size_t nextSample_;
+    std::size_t numSamples_;
+    GcStats stats_;
+};
+
+} // namespace lc
+
+#endif // LC_GC_HPP
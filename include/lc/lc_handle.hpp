@@ -0,0 +1,456 @@
+#ifndef LC_HANDLE_HPP
+#define LC_HANDLE_HPP
+
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <lc/lc.hpp>
+
+//! \file
+//! \brief Classes whose instances live in a dense C++ store and are passed to Lua as handles.
+//!
+//! Instances of classes bound with lc::Class are each wrapped in a userdata, which Lua allocates,
+//! collects and frees. That's too much for something like a world of a million entities that C++
+//! owns anyway. Classes bound with lc::HandleClass live in an lc::SlotMap instead, and Lua only
+//! ever sees light userdata that pack a slot index, the slot's generation and the type and API IDs:
+//!
+//!     lc::SlotMap<Entity> entities(1 << 20);
+//!
+//!     auto& types = api.set_types(lc::HandleClass<Entity>("Entity"), ...);
+//!     types.at<Entity>().set_store(entities);
+//!     types.at<Entity>().add_methods(LC_METHOD("position", &Entity::position));
+//!
+//! - Pushing an instance (returning an Entity* from a method, say) never allocates.
+//! - Reading one back costs a bounds check and one generation compare. Once an element is erased,
+//!   its slot's generation changes, so every handle to it fails with "stale handle" instead of dangling.
+//!   Generations are 16 bits, so a slot can be used 32768 times. After that it's retired rather than
+//!   reused, which makes the map's capacity shrink by one; churning through a slot map that many times
+//!   per slot calls for a bigger one.
+//! - Handles to the same element are equal in Lua, and can be used as table keys.
+//! - C++ owns the elements: Lua never frees them, so there's no __gc and nothing for the collector to do.
+//!
+//! Light userdata share one metatable per state, which LuaCat sets up the first time a handle class
+//! is exported (unless something else already has). Its __index finds a handle's methods by the
+//! IDs in the handle. Handles need 64-bit pointers, and handle classes can't have base classes in the API.
+//!
+
+namespace lc
+{
+
+//! Refers to an element of an lc::SlotMap.
+struct Handle
+{
+    uint32_t slot = 0;
+    uint16_t generation = 0; // Odd while the slot is in use, so default constructed handles are never valid.
+};
+
+//! Fixed-capacity storage with generational handles. Elements never move, so pointers to them
+//! stay valid until they're erased, and nothing is allocated after construction.
+//!
+template <typename T_>
+class SlotMap
+{
+public:
+    //! Slot indices get 24 bits in a packed handle.
+    static constexpr uint32_t max_capacity() { return 1u << 24; }
+
+public:
+    explicit SlotMap(uint32_t capacity)
+        : slots_(new Slot[capacity]), capacity_(capacity), size_(0), used_(0)
+    {
+        assert(capacity <= max_capacity() && "(LC): SlotMap capacity is too big to pack in a handle.");
+        freeList_.reserve(capacity);
+    }
+
+    ~SlotMap()
+    {
+        for (uint32_t i = 0; i < used_; i++)
+            if (slots_[i].generation & 1) element(i)->~T_();
+        delete[] slots_;
+    }
+
+    SlotMap(const SlotMap&) = delete;
+    SlotMap& operator=(const SlotMap&) = delete;
+
+    //! \returns The new element, or nullptr if the map is full.
+    template <typename... Args_>
+    T_* emplace(Args_&&... args)
+    {
+        uint32_t slot;
+        if (!freeList_.empty()) {
+            slot = freeList_.back();
+            freeList_.pop_back();
+        }
+        else if (used_ < capacity_) {
+            slot = used_++;
+        }
+        else {
+            return nullptr;
+        }
+
+        T_* result = new (&slots_[slot].storage) T_(std::forward<Args_>(args)...);
+        slots_[slot].generation++;
+        size_++;
+        return result;
+    }
+
+    //! Destroys an element of this map. Every handle to it is stale from then on.
+    void erase(T_* element)
+    {
+        Handle handle = handle_of(element);
+        if (handle.generation) erase(handle);
+    }
+
+    //! \returns false if the handle was already stale.
+    bool erase(Handle handle)
+    {
+        T_* target = get(handle);
+        if (!target) return false;
+
+        target->~T_();
+        size_--;
+
+        // Wrapping around would make handles to its first element valid again, so the slot is retired.
+        if (++slots_[handle.slot].generation == 0) return true;
+        freeList_.push_back(handle.slot);
+        return true;
+    }
+
+    //! \returns The element, or nullptr if the handle is stale.
+    LC_FORCE_INLINE T_* get(Handle handle) const
+    {
+        // Even generations are free slots, including ones that were never used.
+        if (handle.slot >= capacity_ || !(handle.generation & 1) || slots_[handle.slot].generation != handle.generation) return nullptr;
+        return element(handle.slot);
+    }
+
+    //! \returns A handle to an element of this map, or a default constructed one if element isn't one.
+    LC_FORCE_INLINE Handle handle_of(const T_* element) const
+    {
+        Handle result;
+        const Slot* slot = (const Slot*)(const void*)element;
+        if (slot < slots_ || slot >= slots_ + capacity_ || !(slot->generation & 1)) return result;
+
+        result.slot = (uint32_t)(slot - slots_);
+        result.generation = slot->generation;
+        return result;
+    }
+
+    uint32_t size() const { return size_; }
+    uint32_t capacity() const { return capacity_; }
+
+private:
+    struct Slot
+    {
+        // Has to stay first, so that element pointers are slot pointers.
+        typename std::aligned_storage<sizeof(T_), alignof(T_)>::type storage;
+        uint16_t generation = 0;
+    };
+
+    T_* element(uint32_t slot) const { return (T_*)(void*)&slots_[slot].storage; }
+
+private:
+    Slot* slots_;
+    uint32_t capacity_;
+    uint32_t size_;
+    uint32_t used_; // Slots past this have never been used, so they aren't in the free list.
+    std::vector<uint32_t> freeList_;
+};
+
+//! A class whose instances live in an lc::SlotMap and are passed to Lua as handles.
+//! Pass it to lc::Api::set_types() like lc::Class.
+//!
+template <class Type_>
+class HandleClass
+{
+public:
+    using Type = Type_;
+    using Factory = NullFactory;
+    using ListType = detail::HandleTag<Type_>;
+
+public:
+    explicit HandleClass(char const* name)
+        : name_(name)
+    {}
+
+    char const* name() const { return name_; }
+
+private:
+    char const* name_;
+};
+
+namespace detail
+{
+
+//! The store of a handle class, per API. Set by TypeExporter::set_store().
+template <ApiId ApiId_, typename T_>
+struct HandleStore
+{
+    static SlotMap<T_>* value;
+};
+
+template <ApiId ApiId_, typename T_>
+SlotMap<T_>* HandleStore<ApiId_, T_>::value = nullptr;
+
+// Packed handles, from the high bits down:
+// [63..40]: slot, [39..24]: generation, [23..8]: type ID, [7..0]: API ID
+// The low 24 bits say which store a handle belongs to, and are compared in one go.
+
+constexpr uint64_t handle_type_bits(ApiId apiId, TypeId typeId) { return (uint64_t)typeId << 8 | apiId; }
+
+inline void* pack_handle(ApiId apiId, TypeId typeId, Handle handle)
+{
+    static_assert(sizeof(void*) >= sizeof(uint64_t), "(LC): Handle classes need 64-bit pointers.");
+    return (void*)(uintptr_t)((uint64_t)handle.slot << 40 | (uint64_t)handle.generation << 24 | handle_type_bits(apiId, typeId));
+}
+
+inline Handle unpack_handle(uint64_t bits)
+{
+    Handle result;
+    result.slot = (uint32_t)(bits >> 40);
+    result.generation = (uint16_t)(bits >> 24);
+    return result;
+}
+
+//! Reads a handle to a T_ from the stack.
+//! \returns nullptr if the value isn't one, with *error set to the reason.
+//!
+template <ApiId ApiId_, typename T_>
+LC_FORCE_INLINE T_* handle_at(lua_State* L, int index, TypeId typeId, char const** error)
+{
+    if (lua_type(L, index) != LUA_TLIGHTUSERDATA) {
+        *error = "handle expected";
+        return nullptr;
+    }
+
+    uint64_t bits = (uint64_t)(uintptr_t)lua_touserdata(L, index);
+    if ((bits & 0xFFFFFF) != handle_type_bits(ApiId_, typeId)) {
+        *error = "wrong type";
+        return nullptr;
+    }
+
+    T_* result = HandleStore<ApiId_, T_>::value->get(unpack_handle(bits));
+    if (!result) *error = "stale handle";
+    return result;
+}
+
+//! __index of the metatable shared by all light userdata. Upvalue 1 is the table of every exported
+//! API's type registry, where each handle class has its methods table instead of an instance metatable.
+//!
+inline int handle_index(lua_State* L)
+{
+    uint64_t bits = (uint64_t)(uintptr_t)lua_touserdata(L, 1);
+    if (lua_rawgeti(L, lua_upvalueindex(1), (lua_Integer)(bits & 0xFF) + 1) != LUA_TTABLE
+        || lua_rawgeti(L, -1, (lua_Integer)((bits >> 8) & 0xFFFF) + 1) != LUA_TTABLE) {
+        lua_pushnil(L);
+        return 1;
+    }
+
+    lua_pushvalue(L, 2);
+    lua_rawget(L, -2);
+    return 1;
+}
+
+inline void install_handle_metatable(lua_State* L)
+{
+    lua_pushlightuserdata(L, nullptr);
+    if (lua_getmetatable(L, -1)) {
+        lua_pop(L, 2);
+        return;
+    }
+
+    lua_createtable(L, 0, 1);
+    push_api_registry(L);
+    lua_pushcclosure(L, &handle_index, 1);
+    lua_setfield(L, -2, "__index");
+    lua_setmetatable(L, -2);
+    lua_pop(L, 1);
+}
+
+//! Kept out of the exporter templates, like check_class_export().
+inline void check_handle_export(char const* name, bool hasStore)
+{
+    assert(name && *name && "Attempted to export a handle class without a name.");
+    assert(hasStore && "Attempted to export a handle class without a store. Call set_store() first.");
+    (void)name;
+    (void)hasStore;
+}
+
+template <typename T_, typename ApiTypeList_, ApiId ApiId_>
+class HandleStackManager
+{
+private:
+    static constexpr TypeId type_id() { return (TypeId)std::integral_constant<int, ApiTypeList_::template index_of<HandleTag<T_>>()>::value; }
+
+public:
+    //! Pushes nil if val isn't in the class's store.
+    static LC_FORCE_INLINE int push(lua_State* L, T_* val)
+    {
+        SlotMap<T_>* store = HandleStore<ApiId_, T_>::value;
+        Handle handle = store ? store->handle_of(val) : Handle();
+        if (handle.generation) lua_pushlightuserdata(L, pack_handle(ApiId_, type_id(), handle));
+        else lua_pushnil(L);
+        return 1;
+    }
+
+    template <std::size_t Index_>
+    static LC_FORCE_INLINE T_* at(lua_State* L) { return at(L, (int)Index_); }
+
+    static LC_FORCE_INLINE T_* at(lua_State* L, int index)
+    {
+        char const* error = nullptr;
+        T_* result = handle_at<ApiId_, T_>(L, index, type_id(), &error);
+        if (!result) luaL_argerror(L, index, error);
+        return result;
+    }
+};
+
+template <ApiId ApiId_,
+          TypeId ClassId_,
+          typename Class_,
+          size_t NumArgs_>
+struct MethodCallWrapperBase<ApiId_, ClassId_, Class_, NumArgs_, true>
+{
+    static constexpr size_t num_expanded_args() { return NumArgs_ + 1; } // +1 for the handle.
+
+    static LC_FORCE_INLINE Class_* instance(lua_State* L)
+    {
+        int numArgs = lua_gettop(L);
+        if (numArgs != (int)num_expanded_args()) luaL_error(L, "In function '%s': expected %d arguments(including self), got %d",
+                                                            function_name(L), num_expanded_args(), numArgs);
+
+        char const* error = nullptr;
+        Class_* result = handle_at<ApiId_, Class_>(L, 1, ClassId_, &error);
+        if (!result) luaL_argerror(L, 1, error);
+        return result;
+    }
+};
+
+} // namespace detail
+
+//! Type exporter for handle classes.
+template <ApiId ApiId_,
+          TypeId TypeId_,
+          typename Type_,
+          typename Factory_,
+          typename TypeSet_>
+class TypeExporter<ApiId_, TypeId_, Type_, Factory_, TypeSet_, lc::HandleClass<Type_>>
+{
+public:
+    using Type = Type_;
+    using Factory = Factory_;
+    using Wrapper = lc::HandleClass<Type_>;
+    using TypeSet = TypeSet_;
+
+    static constexpr ApiId api_id() { return ApiId_; }
+    static constexpr TypeId type_id() { return TypeId_; }
+
+private:
+    using Store = detail::HandleStore<ApiId_, Type_>;
+
+    //! __call metamethod of the class table: emplaces a new element in the store.
+    template <typename... Args_>
+    struct Constructor
+    {
+        static int construct(lua_State* L)
+        {
+            return construct_impl(L, typename detail::BuildIndexSequence<sizeof...(Args_)>::Type{});
+        }
+
+        template <std::size_t... Indices_>
+        static int construct_impl(lua_State* L, detail::IndexSequence<Indices_...>)
+        {
+            int numArgs = lua_gettop(L);
+            if (numArgs != (int)sizeof...(Args_) + 1) luaL_error(L, "In constructor for type '%s': expected %d arguments, got %d",
+                                                                 detail::function_name(L), (int)sizeof...(Args_), numArgs - 1);
+            Type_* instance = Store::value->emplace(detail::StackManager<Args_, TypeSet_, ApiId_>::template at<Indices_ + 2>(L)...);
+            if (!instance) return luaL_error(L, "Store is full(API ID: %u, Type ID: %u).", ApiId_, TypeId_);
+
+            lua_pushlightuserdata(L, detail::pack_handle(ApiId_, TypeId_, Store::value->handle_of(instance)));
+            return 1;
+        }
+    };
+
+public:
+    explicit TypeExporter(char const* name)
+        : name_(name), constructor_(nullptr), methodsTable_(LUA_NOREF)
+    {}
+
+    char const* name() const { return name_; }
+
+    //! The store that every instance of this class in this API lives in. It has to outlive every
+    //! state the API is exported to.
+    //!
+    void set_store(SlotMap<Type_>& store)
+    {
+        Store::value = &store;
+    }
+
+    //! Optional. Lets scripts emplace new elements in the store.
+    template <typename... Args_>
+    void set_constructor(lc::Constructor<Args_...>)
+    {
+        constructor_ = &Constructor<Args_...>::construct;
+    }
+
+    template <typename... Methods_>
+    void add_methods(Methods_... methods)
+    {
+        methodExportPairs_.reserve(methodExportPairs_.size() + sizeof...(Methods_));
+        LC_EXPAND_PUSH_BACK(methodExportPairs_, (detail::MethodExport<Methods_>::template pair<ApiId_, TypeId_, TypeSet_>(methods)));
+    }
+
+    detail::RuntimeTypeInfo runtime_type_info() const
+    {
+        detail::RuntimeTypeInfo result;
+        result.name = name_;
+        result.kind = detail::TYPE_KIND_HANDLE;
+        return result;
+    }
+
+    void export_meta(lua_State* L, int typeRegistry) const
+    {
+        detail::check_handle_export(name_, Store::value != nullptr);
+        detail::install_handle_metatable(L);
+
+        // [1]: API table
+        lua_newtable(L); // class table
+        if (constructor_) {
+            lua_createtable(L, 0, 1);
+            lua_pushcfunction(L, constructor_);
+            lua_setfield(L, -2, "__call");
+            lua_setmetatable(L, -2);
+        }
+
+        // The methods table goes where instance metatables usually go, for handle_index().
+        lua_newtable(L);
+        lua_pushvalue(L, -1);
+        methodsTable_ = luaL_ref(L, LUA_REGISTRYINDEX);
+        lua_rawseti(L, typeRegistry, (lua_Integer)TypeId_ + 1);
+
+        // [1]: API table
+        // [2]: class table
+        lua_setfield(L, -2, name_);
+    }
+
+    void export_other(lua_State* L, int) const
+    {
+        // Like lc::Class, with the class table under the methods table.
+        lua_getfield(L, -1, name_);
+        lua_rawgeti(L, LUA_REGISTRYINDEX, methodsTable_);
+        for (const detail::MethodExportPair& p : methodExportPairs_)
+            p.export_to(L);
+        lua_pop(L, 2);
+    }
+
+private:
+    char const* name_;
+    lua_CFunction constructor_;
+    std::vector<detail::MethodExportPair> methodExportPairs_;
+    mutable lua_Integer methodsTable_;
+};
+
+} // namespace lc
+
+#endif // LC_HANDLE_HPP
@@ -0,0 +1,282 @@
+#ifndef LC_RANGE_HPP
+#define LC_RANGE_HPP
+
+#include <iterator>
+#include <new>
+#include <utility>
+#include <lc/lc_container.hpp>
+
+//! \file
+//! \brief Lets bound methods return iterator ranges and generators to Lua's generic for.
+//!
+//! A method that returns an lc::Range or an lc::Generator returns an iterator triple, so
+//!
+//!     lc::Range<std::vector<Bar*>::iterator> bars() { return lc::range(bars_); }
+//!
+//! can be looped over with "for i, bar in obj:bars() do ... end". The iterator function is a plain
+//! C function and the loop state is one small userdata, so a loop allocates that userdata once
+//! and each step allocates nothing (besides whatever its element converts to, e.g. a string).
+//!
+//! - Ranges over values loop as (index, value), starting at 1. Ranges with random access iterators
+//!   are truly stateless: the index is the control variable, and the state is never modified.
+//! - Ranges over pairs (e.g. over a std::map) loop as (first, second).
+//! - Generators loop as (index, value), for as long as their functor keeps returning true.
+//!
+//! Like ContainerView, ranges don't keep their containers alive, and class pointers in ranges are
+//! pushed as borrowed instances. Generators push their values with the usual stack managers, so
+//! yielding a class pointer from a generator hands it over to Lua, like returning it from a method.
+//!
+
+namespace lc
+{
+
+template <typename Iterator_>
+class Range
+{
+public:
+    using Iterator = Iterator_;
+
+    Range(Iterator_ begin, Iterator_ end)
+        : begin_(begin), end_(end)
+    {}
+
+    Iterator_ begin() const { return begin_; }
+    Iterator_ end() const { return end_; }
+
+private:
+    Iterator_ begin_;
+    Iterator_ end_;
+};
+
+template <typename Iterator_>
+Range<Iterator_> range(Iterator_ begin, Iterator_ end)
+{
+    return Range<Iterator_>(begin, end);
+}
+
+template <typename Container_>
+auto range(Container_& container) -> Range<decltype(std::begin(container))>
+{
+    return Range<decltype(std::begin(container))>(std::begin(container), std::end(container));
+}
+
+//! Produces values with a functor that's called like bool(Value_& out) until it returns false.
+template <typename Value_, typename Functor_>
+class Generator
+{
+public:
+    using Value = Value_;
+    using Functor = Functor_;
+
+    explicit Generator(Functor_ functor)
+        : functor_(std::move(functor))
+    {}
+
+    Functor_& functor() { return functor_; }
+
+private:
+    Functor_ functor_;
+};
+
+template <typename Value_, typename Functor_>
+Generator<Value_, Functor_> generate(Functor_ functor)
+{
+    return Generator<Value_, Functor_>(std::move(functor));
+}
+
+namespace detail
+{
+
+//! Keeps State_ in a userdata with a metatable of its own, so that iterator functions, which scripts
+//! can call with anything, can check their state. The metatable has __gc only if State_ needs to be destroyed.
+//!
+template <typename State_>
+struct IterationState
+{
+    static void* metatable_key()
+    {
+        static char key;
+        return &key;
+    }
+
+    static State_* push(lua_State* L, State_&& state)
+    {
+        State_* result = new (new_userdata(L, sizeof(State_), 0)) State_(std::move(state));
+
+        if (lua_rawgetp(L, LUA_REGISTRYINDEX, metatable_key()) == LUA_TNIL) {
+            lua_pop(L, 1);
+            lua_createtable(L, 0, 2);
+            if (!std::is_trivially_destructible<State_>::value) {
+                lua_pushcfunction(L, &gc_metamethod);
+                lua_setfield(L, -2, "__gc");
+            }
+            lua_pushboolean(L, 0); // Keeps scripts from calling __gc on other values.
+            lua_setfield(L, -2, "__metatable");
+            lua_pushvalue(L, -1);
+            lua_rawsetp(L, LUA_REGISTRYINDEX, metatable_key());
+        }
+        lua_setmetatable(L, -2);
+
+        return result;
+    }
+
+    //! The state at index, which must have been pushed by push().
+    static LC_FORCE_INLINE State_* at(lua_State* L, int index)
+    {
+        bool ours = lua_type(L, index) == LUA_TUSERDATA && lua_getmetatable(L, index);
+        if (ours) {
+            lua_rawgetp(L, LUA_REGISTRYINDEX, metatable_key());
+            ours = lua_rawequal(L, -1, -2) != 0;
+            lua_pop(L, 2);
+        }
+        if (!ours) luaL_argerror(L, index, "iteration state expected");
+
+        return (State_*)lua_touserdata(L, index);
+    }
+
+    static int gc_metamethod(lua_State* L)
+    {
+        ((State_*)lua_touserdata(L, 1))->~State_();
+        return 0;
+    }
+};
+
+template <typename T_>
+struct IsPair : std::false_type {};
+
+template <typename First_, typename Second_>
+struct IsPair<std::pair<First_, Second_>> : std::true_type {};
+
+template <typename Iterator_, typename ApiTypeList_, ApiId ApiId_,
+          bool IsPair_ = IsPair<typename std::remove_cv<typename std::iterator_traits<Iterator_>::value_type>::type>::value,
+          bool IsRandomAccess_ = std::is_base_of<std::random_access_iterator_tag,
+                                                 typename std::iterator_traits<Iterator_>::iterator_category>::value>
+struct RangeIterator
+{
+    using Value = typename std::remove_cv<typename std::iterator_traits<Iterator_>::value_type>::type;
+
+    struct State
+    {
+        Iterator_ current;
+        Iterator_ end;
+    };
+
+    static LC_FORCE_INLINE void push_state(lua_State* L, const Range<Iterator_>& range)
+    {
+        IterationState<State>::push(L, State{range.begin(), range.end()});
+        lua_pushinteger(L, 0);
+    }
+
+    static int next(lua_State* L)
+    {
+        State* state = IterationState<State>::at(L, 1);
+        if (state->current == state->end) return 0;
+
+        lua_pushinteger(L, lua_tointeger(L, 2) + 1);
+        ElementPusher<Value, ApiTypeList_, ApiId_>::push(L, *state->current);
+        ++state->current;
+        return 2;
+    }
+};
+
+template <typename Iterator_, typename ApiTypeList_, ApiId ApiId_>
+struct RangeIterator<Iterator_, ApiTypeList_, ApiId_, false, true>
+{
+    using Value = typename std::remove_cv<typename std::iterator_traits<Iterator_>::value_type>::type;
+
+    struct State
+    {
+        Iterator_ begin;
+        lua_Integer size;
+    };
+
+    static LC_FORCE_INLINE void push_state(lua_State* L, const Range<Iterator_>& range)
+    {
+        IterationState<State>::push(L, State{range.begin(), (lua_Integer)(range.end() - range.begin())});
+        lua_pushinteger(L, 0);
+    }
+
+    static int next(lua_State* L)
+    {
+        const State* state = IterationState<State>::at(L, 1);
+        lua_Integer i = lua_tointeger(L, 2);
+        if (i < 0 || i >= state->size) return 0;
+
+        lua_pushinteger(L, i + 1);
+        ElementPusher<Value, ApiTypeList_, ApiId_>::push(L, state->begin[i]);
+        return 2;
+    }
+};
+
+template <typename Iterator_, typename ApiTypeList_, ApiId ApiId_, bool IsRandomAccess_>
+struct RangeIterator<Iterator_, ApiTypeList_, ApiId_, true, IsRandomAccess_>
+{
+    using Value = typename std::remove_cv<typename std::iterator_traits<Iterator_>::value_type>::type;
+    using First = typename std::remove_cv<typename Value::first_type>::type;
+    using Second = typename std::remove_cv<typename Value::second_type>::type;
+
+    struct State
+    {
+        Iterator_ current;
+        Iterator_ end;
+    };
+
+    static LC_FORCE_INLINE void push_state(lua_State* L, const Range<Iterator_>& range)
+    {
+        IterationState<State>::push(L, State{range.begin(), range.end()});
+        lua_pushnil(L);
+    }
+
+    static int next(lua_State* L)
+    {
+        State* state = IterationState<State>::at(L, 1);
+        if (state->current == state->end) return 0;
+
+        ElementPusher<First, ApiTypeList_, ApiId_>::push(L, state->current->first);
+        ElementPusher<Second, ApiTypeList_, ApiId_>::push(L, state->current->second);
+        ++state->current;
+        return 2;
+    }
+};
+
+template <typename Iterator_, typename ApiTypeList_, ApiId ApiId_>
+struct StackManager<Range<Iterator_>, ApiTypeList_, ApiId_>
+{
+    using Iteration = RangeIterator<Iterator_, ApiTypeList_, ApiId_>;
+
+    static int push(lua_State* L, const Range<Iterator_>& val)
+    {
+        lua_pushcfunction(L, &Iteration::next);
+        Iteration::push_state(L, val);
+        return 3;
+    }
+};
+
+template <typename Value_, typename Functor_, typename ApiTypeList_, ApiId ApiId_>
+struct StackManager<Generator<Value_, Functor_>, ApiTypeList_, ApiId_>
+{
+    static int push(lua_State* L, Generator<Value_, Functor_> val)
+    {
+        lua_pushcfunction(L, &next);
+        IterationState<Functor_>::push(L, std::move(val.functor()));
+        lua_pushinteger(L, 0);
+        return 3;
+    }
+
+    static int next(lua_State* L)
+    {
+        Functor_* functor = IterationState<Functor_>::at(L, 1);
+        Value_ value;
+        if (!(*functor)(value)) return 0;
+
+        lua_pushinteger(L, lua_tointeger(L, 2) + 1);
+        StackManager<Value_, ApiTypeList_, ApiId_>::push(L, value);
+        return 2;
+    }
+};
+
+} // namespace detail
+
+} // namespace lc
+
+#endif // LC_RANGE_HPP
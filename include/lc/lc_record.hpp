@@ -0,0 +1,578 @@
+#ifndef LC_RECORD_HPP
+#define LC_RECORD_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <lc/detail/lc_stack.hpp>
+
+//! \file
+//! \brief Records the calls that scripts make to bound methods, and replays them later.
+//!
+//! With LC_RECORD_CALLS defined before including lc.hpp, every method wrapper (lc::Method and
+//! lc::CompactMethod, so LC_METHOD() either way) reports its calls to the lc::CallRecorder attached
+//! to the state, if any. A recorder keeps the last N calls in a ring buffer of fixed-size records:
+//! the method, a timestamp, and the arguments. Numbers, booleans and enum class values are kept as is;
+//! instances of classes as their type and an object number, given out in the order the instances
+//! are first seen; anything else as its Lua type only.
+//!
+//!     lc::CallRecorder recorder(1 << 20);
+//!     recorder.attach(L);
+//!     ... run the game ...
+//!     recorder.dump("calls.lcr");
+//!
+//! lc::CallLog loads a dump and replays it in another state that the same API was exported to, which
+//! doesn't need LC_RECORD_CALLS. Each recorded object gets an instance of its own, made by calling its
+//! class with no arguments (or by a function of your own), and the calls are made through the methods
+//! table by name, like a script would, with the recorded arguments:
+//!
+//!     lc::CallLog log;
+//!     if (log.load("calls.lcr")) {
+//!         lc::ReplayStats stats = log.replay(L, api);
+//!         printf("%.1f ns/call\n", stats.seconds * 1e9 / stats.calls);
+//!     }
+//!
+//! Calls whose arguments can't be reproduced (tables, strings, handles, ...) fail in the replay, and
+//! are counted as such. Calls on instances that couldn't be made are skipped. Calls that fail when
+//! recorded are recorded anyway. Dumps are in native byte order, for replaying on the same kind of machine.
+//!
+
+#ifndef LC_RECORD_MAX_ARGS
+    //! Arguments kept per recorded call, counting the instance. Records have a fixed size, so this is their size.
+    #define LC_RECORD_MAX_ARGS 6
+#endif
+
+namespace lc
+{
+
+namespace detail
+{
+
+//! How a recorded value was kept. The first ones match ArgKind.
+enum RecordedKind : uint8_t
+{
+    RECORDED_SHAPE,       // Only its Lua type.
+    RECORDED_BOOLEAN,
+    RECORDED_INTEGER,
+    RECORDED_NUMBER,
+    RECORDED_INSTANCE,    // Type ID and object number.
+    RECORDED_ENUM_CLASS   // Type ID and value.
+};
+
+struct RecordedValue
+{
+    uint8_t kind;
+    int8_t luaType;
+    TypeId typeId;
+    uint32_t object;
+    union
+    {
+        lua_Integer integer;
+        lua_Number number;
+    };
+};
+
+struct CallRecord
+{
+    uint64_t time;     // Nanoseconds since the recorder was made.
+    uint32_t method;   // Index in the method table, from 1.
+    uint32_t numArgs;  // Counting the instance. Only the first LC_RECORD_MAX_ARGS are in args.
+    RecordedValue args[LC_RECORD_MAX_ARGS];
+};
+
+struct RecordedMethod
+{
+    ApiId apiId;
+    TypeId typeId;
+    char const* name;
+};
+
+//! Every method that's been exported since the program started, with recording on. Method numbers
+//! are indices in here, from 1, so they're the same for every state.
+//!
+inline std::vector<RecordedMethod>& recorded_methods()
+{
+    static std::vector<RecordedMethod> methods;
+    return methods;
+}
+
+//! The method number of a wrapper, given out the first time it's exported.
+template <lua_CFunction Call_>
+struct RecordedMethodId
+{
+    static uint32_t value;
+};
+
+template <lua_CFunction Call_>
+uint32_t RecordedMethodId<Call_>::value = 0;
+
+struct CallRecorderKey
+{
+    static void* value()
+    {
+        static char key;
+        return &key;
+    }
+};
+
+struct CallLogHeader
+{
+    char magic[4];
+    uint32_t formatVersion;
+    uint32_t methodCount;
+    uint32_t recordCount;
+    uint32_t recordSize;
+};
+
+struct CallLogMethod
+{
+    ApiId apiId;
+    uint8_t padding;
+    TypeId typeId;
+    uint32_t nameSize;
+};
+
+constexpr uint32_t call_log_format_version() { return 1; }
+
+} // namespace detail
+
+//! Keeps the last calls made to bound methods in one state. See the top of this file.
+class CallRecorder
+{
+public:
+    //! \param capacity How many calls to keep. Older ones are overwritten.
+    explicit CallRecorder(std::size_t capacity)
+        : records_(capacity ? capacity : 1), next_(0), count_(0), nextObject_(1), start_(std::chrono::steady_clock::now())
+    {}
+
+    CallRecorder(const CallRecorder&) = delete;
+    CallRecorder& operator=(const CallRecorder&) = delete;
+
+    //! Starts recording the calls made in L, and in its coroutines. Only one recorder can be attached to a state.
+    void attach(lua_State* L)
+    {
+        lua_pushlightuserdata(L, this);
+        lua_rawsetp(L, LUA_REGISTRYINDEX, detail::CallRecorderKey::value());
+    }
+
+    void detach(lua_State* L)
+    {
+        lua_pushnil(L);
+        lua_rawsetp(L, LUA_REGISTRYINDEX, detail::CallRecorderKey::value());
+    }
+
+    //! Forgets every call recorded so far, and the object numbers given out.
+    void clear()
+    {
+        next_ = 0;
+        count_ = 0;
+        nextObject_ = 1;
+        objects_.clear();
+    }
+
+    //! Called when Lua frees an instance, so that another object at the same address gets a number of its own.
+    void forget(const void* instance)
+    {
+        objects_.erase(instance);
+    }
+
+    std::size_t size() const { return count_; }
+    std::size_t capacity() const { return records_.size(); }
+
+    //! Writes the recorded calls, oldest first, along with the names of every method they refer to.
+    //! \returns false if the file couldn't be written.
+    //!
+    bool dump(char const* path) const
+    {
+        const std::vector<detail::RecordedMethod>& methods = detail::recorded_methods();
+
+        detail::CallLogHeader header;
+        memcpy(header.magic, "LCRC", sizeof(header.magic));
+        header.formatVersion = detail::call_log_format_version();
+        header.methodCount = (uint32_t)methods.size();
+        header.recordCount = (uint32_t)count_;
+        header.recordSize = (uint32_t)sizeof(detail::CallRecord);
+
+        FILE* file = fopen(path, "wb");
+        if (!file) return false;
+
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+        for (const detail::RecordedMethod& m : methods) {
+            detail::CallLogMethod entry;
+            entry.apiId = m.apiId;
+            entry.padding = 0;
+            entry.typeId = m.typeId;
+            entry.nameSize = (uint32_t)strlen(m.name);
+            ok = ok && fwrite(&entry, sizeof(entry), 1, file) == 1;
+            ok = ok && fwrite(m.name, 1, entry.nameSize, file) == entry.nameSize;
+        }
+
+        // The oldest record is the next one to be overwritten, once the buffer has wrapped around.
+        std::size_t first = count_ < records_.size() ? 0 : next_;
+        std::size_t numFirst = std::min(count_, records_.size() - first);
+        ok = ok && fwrite(&records_[first], sizeof(detail::CallRecord), numFirst, file) == numFirst;
+        ok = ok && fwrite(&records_[0], sizeof(detail::CallRecord), count_ - numFirst, file) == count_ - numFirst;
+
+        ok = (fclose(file) == 0) && ok;
+        return ok;
+    }
+
+    //! Called by the method wrappers before each call. Arguments start at stack index 1, with the instance.
+    void record(lua_State* L, uint32_t method, const detail::ArgKind* kinds, int numArgs)
+    {
+        detail::CallRecord& r = records_[next_];
+        next_ = next_ + 1 < records_.size() ? next_ + 1 : 0;
+        count_ = count_ < records_.size() ? count_ + 1 : count_;
+
+        r.time = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_).count();
+        r.method = method;
+        r.numArgs = (uint32_t)lua_gettop(L);
+
+        const std::vector<detail::RecordedMethod>& methods = detail::recorded_methods();
+        ApiId apiId = method && method <= methods.size() ? methods[method - 1].apiId : 0;
+
+        int numRecorded = std::min((int)r.numArgs, LC_RECORD_MAX_ARGS);
+        for (int i = 0; i < numRecorded; i++) {
+            // The instance is recorded like an argument that's a class pointer.
+            detail::ArgKind kind = i == 0 ? detail::ARG_KIND_CLASS : i <= numArgs ? kinds[i - 1] : detail::ARG_KIND_INLINE;
+            record_value(L, i + 1, apiId, kind, r.args[i]);
+        }
+    }
+
+private:
+    void record_value(lua_State* L, int index, ApiId apiId, detail::ArgKind kind, detail::RecordedValue& value)
+    {
+        value.kind = detail::RECORDED_SHAPE;
+        value.luaType = (int8_t)lua_type(L, index);
+        value.typeId = 0;
+        value.object = 0;
+        value.integer = 0;
+
+        int isNum = 0;
+        switch (kind) {
+        case detail::ARG_KIND_BOOLEAN:
+            value.kind = detail::RECORDED_BOOLEAN;
+            value.integer = lua_toboolean(L, index);
+            break;
+        case detail::ARG_KIND_INTEGER:
+            value.integer = lua_tointegerx(L, index, &isNum);
+            if (isNum) value.kind = detail::RECORDED_INTEGER;
+            break;
+        case detail::ARG_KIND_NUMBER:
+            value.number = lua_tonumberx(L, index, &isNum);
+            if (isNum) value.kind = detail::RECORDED_NUMBER;
+            break;
+        case detail::ARG_KIND_CLASS:
+            if (is_api_userdata(L, index, apiId, detail::API_USERDATA_INSTANCE)) {
+                const detail::UserDataContents* contents = (const detail::UserDataContents*)lua_touserdata(L, index);
+                value.kind = detail::RECORDED_INSTANCE;
+                value.typeId = contents->typeId;
+                value.object = object_number(contents->instance);
+            }
+            break;
+        case detail::ARG_KIND_ENUM_CLASS:
+            if (is_api_userdata(L, index, apiId, detail::API_USERDATA_ENUM_CLASS)) {
+                const detail::EnumClassContents* contents = (const detail::EnumClassContents*)lua_touserdata(L, index);
+                value.kind = detail::RECORDED_ENUM_CLASS;
+                value.typeId = contents->typeId;
+                value.integer = contents->value;
+            }
+            break;
+        default:
+            break;
+        }
+    }
+
+    //! Whether the value at index is an instance of one of the API's classes (or one of its enum class
+    //! values), so that its contents can be read. Calls are recorded before their arguments are checked,
+    //! and other userdata (container views, say) can be smaller, or hold anything at the same offsets.
+    //!
+    static bool is_api_userdata(lua_State* L, int index, ApiId apiId, detail::ApiUserDataKind kind)
+    {
+        ApiId valueApiId = 0;
+        TypeId typeId = 0;
+        return detail::api_userdata_kind(L, index, valueApiId, typeId) == kind && valueApiId == apiId;
+    }
+
+    //! Numbers are never given out twice. Borrowed instances aren't forgotten when they're freed, so the
+    //! numbers start over once there are more objects than the buffer can refer to; objects that are still
+    //! in the buffer get new numbers then, and are replayed as separate objects from that point on.
+    //!
+    uint32_t object_number(const void* instance)
+    {
+        if (objects_.size() >= records_.size() * LC_RECORD_MAX_ARGS) objects_.clear();
+        auto inserted = objects_.insert(std::make_pair(instance, nextObject_));
+        if (inserted.second) nextObject_++;
+        return inserted.first->second;
+    }
+
+private:
+    std::vector<detail::CallRecord> records_;
+    std::size_t next_;
+    std::size_t count_;
+    uint32_t nextObject_;
+    std::chrono::steady_clock::time_point start_;
+    std::unordered_map<const void*, uint32_t> objects_;
+};
+
+namespace detail
+{
+
+//! Reports a call to the recorder attached to L, if there is one.
+LC_NOINLINE inline void record_call(lua_State* L, uint32_t method, const ArgKind* kinds, int numArgs)
+{
+    if (lua_rawgetp(L, LUA_REGISTRYINDEX, CallRecorderKey::value()) != LUA_TLIGHTUSERDATA) {
+        lua_pop(L, 1);
+        return;
+    }
+
+    CallRecorder* recorder = (CallRecorder*)lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    recorder->record(L, method, kinds, numArgs);
+}
+
+//! Tells the recorder attached to L, if there is one, that an instance was freed.
+LC_NOINLINE inline void record_free(lua_State* L, const void* instance)
+{
+    if (lua_rawgetp(L, LUA_REGISTRYINDEX, CallRecorderKey::value()) != LUA_TLIGHTUSERDATA) {
+        lua_pop(L, 1);
+        return;
+    }
+
+    CallRecorder* recorder = (CallRecorder*)lua_touserdata(L, -1);
+    lua_pop(L, 1);
+    recorder->forget(instance);
+}
+
+template <typename TypeSet_, ApiId ApiId_, typename Pointer_>
+struct RecordedSignature;
+
+template <typename TypeSet_, ApiId ApiId_, typename Result_, typename Class_, typename... Args_>
+struct RecordedSignature<TypeSet_, ApiId_, Result_(Class_::*)(Args_...)>
+{
+    using Fused = FusedArgs<TypeSet_, ApiId_, Args_...>;
+    static constexpr int num_args() { return (int)sizeof...(Args_); }
+};
+
+template <typename Signature_, lua_CFunction Call_>
+int recorded_call(lua_State* L)
+{
+    record_call(L, RecordedMethodId<Call_>::value, Signature_::Fused::kinds, Signature_::num_args());
+    return Call_(L);
+}
+
+#if defined(LC_RECORD_CALLS)
+
+//! Pushes a method's wrapper, wrapped again in one that records its calls.
+template <ApiId ApiId_, TypeId TypeId_, typename TypeSet_, typename Pointer_, lua_CFunction Call_>
+void push_method(lua_State* L, char const* name)
+{
+    uint32_t& id = RecordedMethodId<Call_>::value;
+    if (!id) {
+        recorded_methods().push_back(RecordedMethod{ApiId_, TypeId_, name});
+        id = (uint32_t)recorded_methods().size();
+    }
+
+    lua_pushcfunction(L, (ScratchCall<method_uses_scratch<TypeSet_, ApiId_, Pointer_>::value,
+                                      &recorded_call<RecordedSignature<TypeSet_, ApiId_, Pointer_>, Call_>>::function()));
+}
+
+#endif
+
+} // namespace detail
+
+struct ReplayStats
+{
+    std::size_t calls = 0;   // Calls made, including ones that failed.
+    std::size_t failed = 0;
+    std::size_t skipped = 0; // Calls to methods of other APIs, or that aren't in the state.
+    double seconds = 0.0;    // Spent in the calls, not in setting them up.
+};
+
+//! Calls recorded by an lc::CallRecorder, loaded from a dump. See the top of this file.
+class CallLog
+{
+public:
+    //! Makes the instance that stands for a recorded object, given its type, and pushes it.
+    //! \returns false if it couldn't, with nothing pushed.
+    //!
+    using MakeInstance = bool(*)(lua_State* L, TypeId typeId, void* userData);
+
+public:
+    //! \returns false if the file couldn't be read or isn't a call log from this build's format.
+    bool load(char const* path)
+    {
+        methods_.clear();
+        records_.clear();
+
+        FILE* file = fopen(path, "rb");
+        if (!file) return false;
+
+        detail::CallLogHeader header;
+        bool ok = fread(&header, sizeof(header), 1, file) == 1
+                  && memcmp(header.magic, "LCRC", sizeof(header.magic)) == 0
+                  && header.formatVersion == detail::call_log_format_version()
+                  && header.recordSize == sizeof(detail::CallRecord);
+
+        for (uint32_t i = 0; ok && i < header.methodCount; i++) {
+            detail::CallLogMethod entry;
+            ok = fread(&entry, sizeof(entry), 1, file) == 1;
+            if (!ok) break;
+
+            Method m;
+            m.apiId = entry.apiId;
+            m.typeId = entry.typeId;
+            m.name.resize(entry.nameSize);
+            ok = !entry.nameSize || fread(&m.name[0], 1, entry.nameSize, file) == entry.nameSize;
+            methods_.push_back(std::move(m));
+        }
+
+        if (ok) {
+            records_.resize(header.recordCount);
+            ok = records_.empty() || fread(&records_[0], sizeof(detail::CallRecord), records_.size(), file) == records_.size();
+        }
+
+        fclose(file);
+        if (!ok) {
+            methods_.clear();
+            records_.clear();
+        }
+        return ok;
+    }
+
+    std::size_t size() const { return records_.size(); }
+
+    //! Makes every recorded call to api's methods again, in L, which api must have been exported to.
+    //! \param make Makes the instances of recorded objects. By default, classes are called with no arguments.
+    //!
+    template <typename Api_>
+    ReplayStats replay(lua_State* L, const Api_& api, MakeInstance make = nullptr, void* userData = nullptr) const
+    {
+        ReplayStats stats;
+        int top = lua_gettop(L);
+
+        // [top + 1]: instances, by object number
+        // [top + 2]: API table
+        int instances = top + 1;
+        lua_newtable(L);
+        if (api.name() && *api.name()) lua_getglobal(L, api.name());
+        else lua_pushglobaltable(L);
+
+        for (const detail::CallRecord& r : records_) {
+            const Method* method = r.method && r.method <= methods_.size() ? &methods_[r.method - 1] : nullptr;
+            int numArgs = std::min((int)r.numArgs, LC_RECORD_MAX_ARGS);
+            if (!method || method->apiId != Api_::id() || !numArgs) {
+                stats.skipped++;
+                continue;
+            }
+
+            // The method, looked up on the instance like a script would.
+            push_value(L, api, instances, r.args[0], make, userData);
+            if (lua_type(L, -1) != LUA_TUSERDATA || lua_getfield(L, -1, method->name.c_str()) != LUA_TFUNCTION) {
+                lua_settop(L, top + 2);
+                stats.skipped++;
+                continue;
+            }
+
+            lua_insert(L, -2);
+            for (int i = 1; i < numArgs; i++)
+                push_value(L, api, instances, r.args[i], make, userData);
+
+            auto start = std::chrono::steady_clock::now();
+            int status = lua_pcall(L, numArgs, 0, 0);
+            stats.seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+            stats.calls++;
+            if (status != LUA_OK) stats.failed++;
+            lua_settop(L, top + 2);
+        }
+
+        lua_settop(L, top);
+        return stats;
+    }
+
+private:
+    struct Method
+    {
+        ApiId apiId;
+        TypeId typeId;
+        std::string name;
+    };
+
+    //! Pushes the stand-in for a recorded value, which is nil if there's none.
+    template <typename Api_>
+    static void push_value(lua_State* L, const Api_& api, int instances, const detail::RecordedValue& value,
+                           MakeInstance make, void* userData)
+    {
+        switch (value.kind) {
+        case detail::RECORDED_BOOLEAN:
+            lua_pushboolean(L, (int)value.integer);
+            return;
+        case detail::RECORDED_INTEGER:
+            lua_pushinteger(L, value.integer);
+            return;
+        case detail::RECORDED_NUMBER:
+            lua_pushnumber(L, value.number);
+            return;
+        case detail::RECORDED_ENUM_CLASS: {
+            detail::EnumClassContents* contents = (detail::EnumClassContents*)detail::new_userdata(L, sizeof(detail::EnumClassContents), 0);
+            contents->value = value.integer;
+            contents->typeId = value.typeId;
+            contents->apiId = Api_::id();
+            return;
+        }
+        case detail::RECORDED_INSTANCE:
+            push_instance(L, api, instances, value, make, userData);
+            return;
+        default:
+            if (value.luaType == LUA_TTABLE) lua_newtable(L);
+            else lua_pushnil(L);
+            return;
+        }
+    }
+
+    //! Instances are made the first time their object comes up, and kept in the table at instances.
+    //! The API table is right above it.
+    //!
+    template <typename Api_>
+    static void push_instance(lua_State* L, const Api_& api, int instances, const detail::RecordedValue& value,
+                              MakeInstance make, void* userData)
+    {
+        if (lua_rawgeti(L, instances, value.object) != LUA_TNIL) return;
+        lua_pop(L, 1);
+
+        bool made = false;
+        if (make) {
+            made = make(L, value.typeId, userData);
+        }
+        else {
+            auto info = api.type_info(value.typeId);
+            if (info && info->name) {
+                if (lua_getfield(L, instances + 1, info->name) != LUA_TNIL) {
+                    made = lua_pcall(L, 0, 1, 0) == LUA_OK && lua_type(L, -1) == LUA_TUSERDATA;
+                }
+                if (!made) lua_pop(L, 1);
+            }
+        }
+
+        if (!made) {
+            lua_pushnil(L);
+            return;
+        }
+
+        lua_pushvalue(L, -1);
+        lua_rawseti(L, instances, value.object);
+    }
+
+private:
+    std::vector<Method> methods_;
+    std::vector<detail::CallRecord> records_;
+};
+
+} // namespace lc
+
+#endif // LC_RECORD_HPP
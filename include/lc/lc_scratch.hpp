@@ -0,0 +1,150 @@
+#ifndef LC_SCRATCH_HPP
+#define LC_SCRATCH_HPP
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <lc/lc.hpp>
+
+//! \file
+//! \brief Array arguments that are converted without allocating.
+//!
+//! A method that takes an lc::ScratchArray<T> is called with a Lua sequence, whose elements are
+//! converted with T's stack manager into memory from a per-state arena, not the heap:
+//!
+//!     void Path::set_points(lc::ScratchArray<Vec2> points);  // Vec2 being a registered struct
+//!
+//!     path:set_points({{x = 0, y = 0}, {x = 1, y = 2}})
+//!
+//! The memory is given back when the method returns, so the array must not be kept past the call.
+//! If an error longjmps out of the method instead, it's given back by the next method call made
+//! from as deep as the failed one or shallower, i.e. normally the next one. The arena keeps its
+//! blocks, so after the first few calls, calls don't allocate at all. lc::reserve_scratch() sizes
+//! it up front, and lc::scratch_stats() says how big calls have got.
+//!
+//! - Elements are read with their stack managers, so anything that can be an argument can be an
+//!   element: numbers, registered structs, enum classes, pointers to API classes. Since nothing
+//!   destroys them, they have to be trivially destructible.
+//! - Scratch arrays can only be method arguments; reading one anywhere else raises an error.
+//!   Returning one from a method pushes a new table. Batch methods can't take them, since tables
+//!   are what they're batched over.
+//!
+
+namespace lc
+{
+
+//! Elements converted from a Lua sequence, valid until the method they were passed to returns.
+template <typename T_>
+class ScratchArray
+{
+public:
+    static_assert(std::is_trivially_destructible<T_>::value, "(LC): Scratch array elements are never destroyed, so they must be trivially destructible.");
+
+    ScratchArray() : data_(nullptr), size_(0) {}
+    ScratchArray(T_* data, std::size_t size) : data_(data), size_(size) {}
+
+    T_* data() const { return data_; }
+    std::size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+
+    T_* begin() const { return data_; }
+    T_* end() const { return data_ + size_; }
+
+    T_& operator[](std::size_t index) const { return data_[index]; }
+
+private:
+    T_* data_;
+    std::size_t size_;
+};
+
+struct ScratchStats
+{
+    std::size_t inUse = 0;         // By calls that haven't returned yet; 0 outside of bound methods.
+    std::size_t highWaterMark = 0; // The most that was in use at once, alignment included.
+    std::size_t capacity = 0;      // Allocated for the arena. Calls that need more than this allocate.
+};
+
+//! \returns Zeros if no method that takes scratch arrays has been called in L yet.
+inline ScratchStats scratch_stats(lua_State* L)
+{
+    ScratchStats stats;
+    detail::ScratchArena* arena = detail::scratch_arena(L, false);
+    if (!arena) return stats;
+
+    stats.inUse = arena->used();
+    stats.highWaterMark = arena->high_water_mark();
+    stats.capacity = arena->capacity();
+    return stats;
+}
+
+//! Starts measuring the high water mark again, e.g. after loading a level.
+inline void reset_scratch_high_water_mark(lua_State* L)
+{
+    detail::ScratchArena* arena = detail::scratch_arena(L, false);
+    if (arena) arena->reset_high_water_mark();
+}
+
+//! Makes the arena big enough for calls that need up to the given number of bytes, so that not
+//! even the first ones allocate. It also grows by itself, and calls that needed more than one
+//! block leave it as a single block that fits them.
+//!
+inline void reserve_scratch(lua_State* L, std::size_t bytes)
+{
+    detail::scratch_arena(L, true)->reserve(bytes);
+}
+
+namespace detail
+{
+
+template <typename T_, typename ApiTypeList_, ApiId ApiId_>
+class ScratchArrayStackManager : public ScratchStackManager
+{
+public:
+    static int push(lua_State* L, ScratchArray<T_> val)
+    {
+        lua_createtable(L, (int)val.size(), 0);
+        for (std::size_t i = 0; i < val.size(); i++) {
+            StackManager<T_, ApiTypeList_, ApiId_>::push(L, val[i]);
+            lua_rawseti(L, -2, (lua_Integer)i + 1);
+        }
+        return 1;
+    }
+
+    template <std::size_t Index_>
+    static LC_FORCE_INLINE ScratchArray<T_> at(lua_State* L) { return at(L, (int)Index_); }
+
+    static ScratchArray<T_> at(lua_State* L, int index)
+    {
+        luaL_checktype(L, index, LUA_TTABLE);
+        index = lua_absindex(L, index);
+
+        ScratchArena* arena = scratch_arena(L, false);
+        if (!arena || !arena->in_scope()) luaL_error(L, "scratch arrays can only be method arguments");
+
+        std::size_t size = (std::size_t)lua_rawlen(L, index);
+        if (size == 0) return ScratchArray<T_>();
+
+        T_* data = (T_*)arena->allocate(size * sizeof(T_), alignof(T_));
+        if (!data) luaL_error(L, "not enough memory");
+
+        luaL_checkstack(L, 1, nullptr);
+        for (std::size_t i = 0; i < size; i++) {
+            lua_rawgeti(L, index, (lua_Integer)i + 1);
+            char const* expected = ElementCheck<T_, ApiTypeList_, ApiId_>::expected(L);
+            if (expected) element_error(L, index, (lua_Integer)i + 1, expected);
+            new (data + i) T_(StackManager<T_, ApiTypeList_, ApiId_>::at(L, -1));
+            lua_pop(L, 1);
+        }
+        return ScratchArray<T_>(data, size);
+    }
+};
+
+template <typename T_, typename ApiTypeList_, ApiId ApiId_>
+struct StackManager<ScratchArray<T_>, ApiTypeList_, ApiId_>
+       : ScratchArrayStackManager<T_, ApiTypeList_, ApiId_> {};
+
+} // namespace detail
+
+} // namespace lc
+
+#endif // LC_SCRATCH_HPP
@@ -0,0 +1,560 @@
+#ifndef LC_SNAPSHOT_HPP
+#define LC_SNAPSHOT_HPP
+
+#include <cstring>
+#include <string>
+#include <lc/lc.hpp>
+
+//! \file
+//! \brief Binary snapshots of Lua values, including instances of API types.
+//!
+//! A snapshot holds one value and everything reachable from it through tables: nil, booleans,
+//! numbers, strings, tables, enum class values, and instances of classes with serializers
+//! (see TypeExporter::set_serializer()). Anything else (functions, threads, foreign userdata)
+//! fails the snapshot. Metatables of plain tables aren't saved.
+//!
+//! Strings, tables, and instances are written once and referred to by ID afterwards, which
+//! takes care of cycles and shared references. Tables are written breadth-first: the root value
+//! comes first, then the contents of each table in the order the tables were first seen.
+//! Neither side recurses, so arbitrarily deep graphs only need a constant amount of Lua stack.
+//!
+
+namespace lc
+{
+
+namespace detail
+{
+
+enum SnapshotTag : uint8_t
+{
+    SNAPSHOT_END,       // End of a table's contents.
+    SNAPSHOT_NIL,
+    SNAPSHOT_FALSE,
+    SNAPSHOT_TRUE,
+    SNAPSHOT_INTEGER,   // zigzag varint
+    SNAPSHOT_NUMBER,    // 8 bytes
+    SNAPSHOT_STRING,    // varint size, bytes. Gets the next ID.
+    SNAPSHOT_TABLE,     // Gets the next ID. Its contents come later.
+    SNAPSHOT_ENUM,      // varint type ID, zigzag varint value
+    SNAPSHOT_INSTANCE,  // varint type ID, whatever the type's save hook wrote. Gets the next ID.
+    SNAPSHOT_REF        // varint ID of a string, table, or instance that was already written.
+};
+
+constexpr uint8_t snapshot_format_version() { return 1; }
+
+} // namespace detail
+
+//! Buffered, streaming writer for snapshots. Also what class save hooks write their instances with.
+class SnapshotWriter
+{
+public:
+    //! Receives the snapshot in chunks. Returns false to abort the snapshot.
+    using Sink = bool(*)(const void* data, std::size_t size, void* userData);
+
+    SnapshotWriter(Sink sink, void* userData)
+        : sink_(sink), userData_(userData), size_(0), failed_(false)
+    {}
+
+    ~SnapshotWriter() { flush(); }
+
+    SnapshotWriter(const SnapshotWriter&) = delete;
+    SnapshotWriter& operator=(const SnapshotWriter&) = delete;
+
+    //! Sink for writing snapshots into a std::string.
+    static bool string_sink(const void* data, std::size_t size, void* userData)
+    {
+        ((std::string*)userData)->append((char const*)data, size);
+        return true;
+    }
+
+    bool failed() const { return failed_; }
+
+    //! Hands everything written so far to the sink.
+    bool flush()
+    {
+        if (size_ && !failed_) failed_ = !sink_(buffer_, size_, userData_);
+        size_ = 0;
+        return !failed_;
+    }
+
+    LC_FORCE_INLINE void write_u8(uint8_t value)
+    {
+        if (size_ == sizeof(buffer_)) flush();
+        buffer_[size_++] = value;
+    }
+
+    LC_FORCE_INLINE void write_bool(bool value) { write_u8(value ? 1 : 0); }
+
+    //! LEB128.
+    LC_FORCE_INLINE void write_varint(uint64_t value)
+    {
+        if (sizeof(buffer_) - size_ < 10) flush();
+        while (value >= 0x80) {
+            buffer_[size_++] = (Byte)(value | 0x80);
+            value >>= 7;
+        }
+        buffer_[size_++] = (Byte)value;
+    }
+
+    //! Zigzag encoded, so small negative numbers stay small.
+    LC_FORCE_INLINE void write_integer(int64_t value)
+    {
+        write_varint(((uint64_t)value << 1) ^ (uint64_t)(value >> 63));
+    }
+
+    LC_FORCE_INLINE void write_number(double value) { write_bytes(&value, sizeof(value)); }
+
+    void write_bytes(const void* data, std::size_t size)
+    {
+        if (sizeof(buffer_) - size_ < size) {
+            flush();
+            if (size >= sizeof(buffer_)) {
+                if (!failed_) failed_ = !sink_(data, size, userData_);
+                return;
+            }
+        }
+
+        memcpy(buffer_ + size_, data, size);
+        size_ += size;
+    }
+
+    void write_string(char const* data, std::size_t size)
+    {
+        write_varint(size);
+        write_bytes(data, size);
+    }
+
+private:
+    Sink sink_;
+    void* userData_;
+    std::size_t size_;
+    bool failed_;
+    Byte buffer_[64 * 1024];
+};
+
+//! Reads snapshots out of memory. Also what class load hooks read their instances with.
+//! Reading past the end sets failed() and returns zeros instead of crashing.
+//!
+class SnapshotReader
+{
+public:
+    SnapshotReader(const void* data, std::size_t size)
+        : cursor_((const Byte*)data), end_((const Byte*)data + size), failed_(false)
+    {}
+
+    bool failed() const { return failed_; }
+    std::size_t remaining() const { return (std::size_t)(end_ - cursor_); }
+
+    LC_FORCE_INLINE uint8_t read_u8()
+    {
+        if (cursor_ == end_) return fail();
+        return *cursor_++;
+    }
+
+    LC_FORCE_INLINE bool read_bool() { return read_u8() != 0; }
+
+    LC_FORCE_INLINE uint64_t read_varint()
+    {
+        uint64_t result = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            if (cursor_ == end_) return fail();
+
+            Byte b = *cursor_++;
+            result |= (uint64_t)(b & 0x7f) << shift;
+            if (!(b & 0x80)) return result;
+        }
+
+        return fail();
+    }
+
+    LC_FORCE_INLINE int64_t read_integer()
+    {
+        uint64_t value = read_varint();
+        return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+    }
+
+    LC_FORCE_INLINE double read_number()
+    {
+        double result = 0;
+        read_bytes(&result, sizeof(result));
+        return result;
+    }
+
+    void read_bytes(void* out, std::size_t size)
+    {
+        const void* data = read_view(size);
+        if (data) memcpy(out, data, size);
+    }
+
+    //! Returns a pointer to the next size bytes, which stays valid as long as the snapshot's memory does.
+    const void* read_view(std::size_t size)
+    {
+        if (remaining() < size) {
+            fail();
+            return nullptr;
+        }
+
+        const void* result = cursor_;
+        cursor_ += size;
+        return result;
+    }
+
+private:
+    uint8_t fail()
+    {
+        failed_ = true;
+        cursor_ = end_;
+        return 0;
+    }
+
+private:
+    const Byte* cursor_;
+    const Byte* end_;
+    bool failed_;
+};
+
+namespace detail
+{
+
+template <ApiId ApiId_>
+class SnapshotSaver
+{
+public:
+    SnapshotSaver(lua_State* L, const Api<ApiId_>& api, SnapshotWriter& writer)
+        : L_(L), api_(api), writer_(writer), seen_(0), queue_(0), nextId_(0), queueSize_(0)
+    {}
+
+    int save(int index)
+    {
+        index = lua_absindex(L_, index);
+        luaL_checkstack(L_, 8, "saving a snapshot");
+
+        int top = lua_gettop(L_);
+        lua_newtable(L_);
+        seen_ = lua_gettop(L_);
+        lua_newtable(L_);
+        queue_ = lua_gettop(L_);
+
+        writer_.write_bytes("LCSN", 4);
+        writer_.write_u8(snapshot_format_version());
+
+        bool ok = write_value(index);
+        for (lua_Integer i = 1; ok && i <= queueSize_; i++) {
+            lua_rawgeti(L_, queue_, i);
+            int table = lua_gettop(L_);
+
+            lua_pushnil(L_);
+            while (lua_next(L_, table)) {
+                ok = write_value(table + 1) && write_value(table + 2);
+                if (!ok) break;
+                lua_pop(L_, 1);
+            }
+
+            if (!ok) break;
+            writer_.write_u8(SNAPSHOT_END);
+            lua_settop(L_, queue_);
+        }
+
+        if (ok && !writer_.flush()) ok = error("the snapshot sink failed");
+
+        // On failure, keep the message.
+        if (!ok) lua_replace(L_, top + 1);
+        lua_settop(L_, ok ? top : top + 1);
+        return ok ? LUA_OK : LUA_ERRRUN;
+    }
+
+private:
+    bool write_value(int index)
+    {
+        switch (lua_type(L_, index)) {
+        case LUA_TNIL:
+            writer_.write_u8(SNAPSHOT_NIL);
+            return true;
+        case LUA_TBOOLEAN:
+            writer_.write_u8(lua_toboolean(L_, index) ? SNAPSHOT_TRUE : SNAPSHOT_FALSE);
+            return true;
+        case LUA_TNUMBER:
+            if (lua_isinteger(L_, index)) {
+                writer_.write_u8(SNAPSHOT_INTEGER);
+                writer_.write_integer(lua_tointeger(L_, index));
+            }
+            else {
+                writer_.write_u8(SNAPSHOT_NUMBER);
+                writer_.write_number(lua_tonumber(L_, index));
+            }
+            return true;
+        case LUA_TSTRING:
+            if (write_ref(index)) return true;
+            {
+                size_t size = 0;
+                char const* data = lua_tolstring(L_, index, &size);
+                writer_.write_u8(SNAPSHOT_STRING);
+                writer_.write_string(data, size);
+            }
+            return true;
+        case LUA_TTABLE:
+            if (write_ref(index)) return true;
+            writer_.write_u8(SNAPSHOT_TABLE);
+            lua_pushvalue(L_, index);
+            lua_rawseti(L_, queue_, ++queueSize_);
+            return true;
+        case LUA_TUSERDATA:
+            return write_userdata(index);
+        default:
+            return error("can't save a value of type '%s'", luaL_typename(L_, index));
+        }
+    }
+
+    bool write_userdata(int index)
+    {
+        ApiId apiId = 0;
+        TypeId typeId = 0;
+        ApiUserDataKind kind = api_userdata_kind(L_, index, apiId, typeId);
+        if (kind == API_USERDATA_FOREIGN) return error("can't save foreign userdata");
+
+        const RuntimeTypeInfo* info = api_.type_info(typeId);
+        if (apiId != ApiId_ || !info) return error("can't save userdata from another API");
+        if ((info->kind == TYPE_KIND_ENUM) != (kind == API_USERDATA_ENUM_CLASS)) return error("can't save foreign userdata");
+
+        if (kind == API_USERDATA_ENUM_CLASS) {
+            writer_.write_u8(SNAPSHOT_ENUM);
+            writer_.write_varint(typeId);
+            writer_.write_integer(((const EnumClassContents*)lua_touserdata(L_, index))->value);
+            return true;
+        }
+
+        const UserDataContents* contents = (const UserDataContents*)lua_touserdata(L_, index);
+        if (!info->save) return error("type '%s' has no serializer", info->name);
+        if (!contents->instance) return error("can't save an instance that was moved");
+        if (write_ref(index)) return true;
+
+        writer_.write_u8(SNAPSHOT_INSTANCE);
+        writer_.write_varint(contents->typeId);
+        info->save(info->exporter, contents->instance, writer_);
+        return true;
+    }
+
+    //! Writes a reference if the value at index was written before. Otherwise, gives it the next ID.
+    bool write_ref(int index)
+    {
+        lua_pushvalue(L_, index);
+        if (lua_rawget(L_, seen_) == LUA_TNUMBER) {
+            writer_.write_u8(SNAPSHOT_REF);
+            writer_.write_varint((uint64_t)lua_tointeger(L_, -1));
+            lua_pop(L_, 1);
+            return true;
+        }
+
+        lua_pop(L_, 1);
+        lua_pushvalue(L_, index);
+        lua_pushinteger(L_, ++nextId_);
+        lua_rawset(L_, seen_);
+        return false;
+    }
+
+    template <typename... Args_>
+    bool error(char const* format, Args_... args)
+    {
+        lua_pushfstring(L_, format, args...);
+        return false;
+    }
+
+private:
+    lua_State* L_;
+    const Api<ApiId_>& api_;
+    SnapshotWriter& writer_;
+    int seen_;          // value -> ID
+    int queue_;         // tables whose contents haven't been written yet
+    lua_Integer nextId_;
+    lua_Integer queueSize_;
+};
+
+template <ApiId ApiId_>
+class SnapshotLoader
+{
+public:
+    SnapshotLoader(lua_State* L, const Api<ApiId_>& api, SnapshotReader& reader)
+        : L_(L), api_(api), reader_(reader), objects_(0), queue_(0), nextId_(0), queueSize_(0)
+    {}
+
+    int load()
+    {
+        luaL_checkstack(L_, 8, "loading a snapshot");
+
+        int top = lua_gettop(L_);
+        lua_newtable(L_);
+        objects_ = lua_gettop(L_);
+        lua_newtable(L_);
+        queue_ = lua_gettop(L_);
+
+        char magic[4] = {};
+        reader_.read_bytes(magic, sizeof(magic));
+        bool ok = memcmp(magic, "LCSN", sizeof(magic)) == 0 && reader_.read_u8() == snapshot_format_version();
+        if (!ok) error("not a snapshot, or from an incompatible version");
+
+        // [top + 3]: the root value
+        ok = ok && read_value();
+        for (lua_Integer i = 1; ok && i <= queueSize_; i++) {
+            lua_rawgeti(L_, queue_, i);
+            int table = lua_gettop(L_);
+
+            for (;;) {
+                uint8_t tag = reader_.read_u8();
+                if (tag == SNAPSHOT_END || reader_.failed()) break;
+
+                ok = read_value(tag) && read_value();
+                if (!ok) break;
+                if (lua_isnil(L_, -2) || (lua_type(L_, -2) == LUA_TNUMBER && lua_tonumber(L_, -2) != lua_tonumber(L_, -2))) {
+                    ok = error("nil or NaN table key");
+                    break;
+                }
+                lua_rawset(L_, table);
+            }
+
+            if (ok) lua_settop(L_, table - 1);
+        }
+
+        if (ok && reader_.failed()) ok = error("truncated snapshot");
+
+        // Leave either the root value or the error message.
+        lua_replace(L_, top + 1);
+        lua_settop(L_, top + 1);
+        return ok ? LUA_OK : LUA_ERRRUN;
+    }
+
+private:
+    bool read_value() { return read_value(reader_.read_u8()); }
+
+    bool read_value(uint8_t tag)
+    {
+        switch (tag) {
+        case SNAPSHOT_NIL:
+            lua_pushnil(L_);
+            return true;
+        case SNAPSHOT_FALSE:
+        case SNAPSHOT_TRUE:
+            lua_pushboolean(L_, tag == SNAPSHOT_TRUE);
+            return true;
+        case SNAPSHOT_INTEGER:
+            lua_pushinteger(L_, (lua_Integer)reader_.read_integer());
+            return true;
+        case SNAPSHOT_NUMBER:
+            lua_pushnumber(L_, (lua_Number)reader_.read_number());
+            return true;
+        case SNAPSHOT_STRING: {
+            std::size_t size = (std::size_t)reader_.read_varint();
+            char const* data = (char const*)reader_.read_view(size);
+            if (!data) return error("truncated snapshot");
+            lua_pushlstring(L_, data, size);
+            return add_object();
+        }
+        case SNAPSHOT_TABLE:
+            lua_newtable(L_);
+            lua_pushvalue(L_, -1);
+            lua_rawseti(L_, queue_, ++queueSize_);
+            return add_object();
+        case SNAPSHOT_ENUM:
+            return read_enum();
+        case SNAPSHOT_INSTANCE:
+            return read_instance();
+        case SNAPSHOT_REF: {
+            lua_Integer id = (lua_Integer)reader_.read_varint();
+            if (id < 1 || id > nextId_) return error("bad reference in snapshot");
+            lua_rawgeti(L_, objects_, id);
+            return true;
+        }
+        default:
+            return error(reader_.failed() ? "truncated snapshot" : "corrupt snapshot");
+        }
+    }
+
+    bool read_enum()
+    {
+        TypeId typeId = (TypeId)reader_.read_varint();
+        lua_Integer value = (lua_Integer)reader_.read_integer();
+        const RuntimeTypeInfo* info = api_.type_info(typeId);
+        if (!info || info->kind != TYPE_KIND_ENUM) return error("bad enum type in snapshot");
+
+        EnumClassContents* contents = (EnumClassContents*)detail::new_userdata(L_, sizeof(EnumClassContents), 0);
+        contents->apiId = ApiId_;
+        contents->typeId = typeId;
+        contents->value = value;
+        return true;
+    }
+
+    bool read_instance()
+    {
+        TypeId typeId = (TypeId)reader_.read_varint();
+        const RuntimeTypeInfo* info = api_.type_info(typeId);
+        if (!info || info->kind != TYPE_KIND_CLASS) return error("bad class type in snapshot");
+        if (!info->load) return error("type '%s' has no serializer", info->name);
+
+        void* instance = info->load(info->exporter, reader_);
+        if (!instance) return error("failed to load an instance of '%s'", info->name);
+
+        UserDataContents* contents = (UserDataContents*)lua_newuserdata(L_, sizeof(UserDataContents));
+        contents->apiId = ApiId_;
+        contents->typeId = typeId;
+        contents->instance = instance;
+        push_metatable<ApiId_>(L_, contents->typeId);
+        std::size_t nativeSize = native_size(L_, -1, instance);
+        lua_setmetatable(L_, -2);
+        add_native_memory(L_, nativeSize);
+
+        // Set the metatable first, so that __gc frees the instance even if the snapshot turns out to be bad.
+        if (reader_.failed()) return error("truncated snapshot");
+        return add_object();
+    }
+
+    //! Gives the value on top of the stack the next ID.
+    bool add_object()
+    {
+        lua_pushvalue(L_, -1);
+        lua_rawseti(L_, objects_, ++nextId_);
+        return true;
+    }
+
+    template <typename... Args_>
+    bool error(char const* format, Args_... args)
+    {
+        lua_pushfstring(L_, format, args...);
+        return false;
+    }
+
+private:
+    lua_State* L_;
+    const Api<ApiId_>& api_;
+    SnapshotReader& reader_;
+    int objects_;       // ID -> value
+    int queue_;         // tables whose contents haven't been read yet
+    lua_Integer nextId_;
+    lua_Integer queueSize_;
+};
+
+} // namespace detail
+
+//! Writes the value at index, and everything reachable from it, to writer.
+//! api has to have been exported to L. On failure, an error message is pushed.
+//!
+//! \returns A Lua status code.
+//!
+template <ApiId ApiId_>
+int save_snapshot(lua_State* L, int index, const Api<ApiId_>& api, SnapshotWriter& writer)
+{
+    return detail::SnapshotSaver<ApiId_>(L, api, writer).save(index);
+}
+
+//! Pushes the value stored in a snapshot. api has to have been exported to L.
+//! On failure, an error message is pushed instead.
+//!
+//! \returns A Lua status code.
+//!
+template <ApiId ApiId_>
+int restore_snapshot(lua_State* L, const Api<ApiId_>& api, SnapshotReader& reader)
+{
+    return detail::SnapshotLoader<ApiId_>(L, api, reader).load();
+}
+
+} // namespace lc
+
+#endif // LC_SNAPSHOT_HPP
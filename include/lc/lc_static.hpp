@@ -0,0 +1,283 @@
+#ifndef LC_STATIC_HPP
+#define LC_STATIC_HPP
+
+#include <lc/lc.hpp>
+
+//! \file
+//! \brief Describes a whole API with constexpr tables, for registration without heap allocations.
+//!
+//! lc::Api builds its exporters at runtime, which allocates. This is an alternative for when that's
+//! not an option (embedded targets, static initialization): every name, method, constructor and
+//! enum value lives in constant tables, and exporting only creates the Lua tables, presized.
+//!
+//!     using MyApi = lc::StaticApi<0, Foo, Color>;
+//!
+//!     constexpr lc::StaticMethod fooMethods[] = {
+//!         LC_STATIC_METHOD(MyApi, Foo, "get", &Foo::get),
+//!     };
+//!     constexpr lc::StaticEnumValue colorValues[] = {
+//!         lc::static_value("Red", Color::Red),
+//!     };
+//!     constexpr lc::StaticType myTypes[] = {
+//!         lc::static_class<MyApi, Foo>("Foo", fooMethods, lc::Constructor<>{}),
+//!         lc::static_enum<MyApi, Color>("Color", colorValues),
+//!     };
+//!
+//! Instances behave like those of lc::Api classes: scripts can set fields on them, directors can be
+//! overridden (lc_director.hpp), and wrapping a class in lc::enable_close() is the same as calling
+//! enable_close() on its lc::Api exporter.
+//!     constexpr lc::StaticApiInfo myApi = lc::static_api<MyApi>("api", myTypes);
+//!
+//!     lc::export_static_api(L, myApi);
+//!
+//! Static APIs are interchangeable with lc::Api as far as pushing instances goes (lc::push, the
+//! stack managers and channels all work), but they don't support structs or snapshots.
+//!
+
+#define LC_STATIC_METHOD(Api, Class, name, ptr) lc::static_method<Api, Class, decltype(ptr), ptr>(name)
+
+namespace lc
+{
+
+//! The type list of a static API. Type IDs are indices in Types_, as with lc::Api::set_types().
+template <ApiId ApiId_, typename... Types_>
+struct StaticApi
+{
+    using TypeSet = detail::TypeList<Types_...>;
+
+    static constexpr ApiId id() { return ApiId_; }
+
+    template <typename T_>
+    static constexpr TypeId type_id() { return (TypeId)TypeSet::template index_of<T_>(); }
+};
+
+//! Same layout as luaL_Reg.
+struct StaticMethod
+{
+    char const* name;
+    lua_CFunction function;
+};
+
+struct StaticEnumValue
+{
+    char const* name;
+    lua_Integer value;
+};
+
+struct StaticType
+{
+    char const* name;
+    detail::TypeKind kind;
+    TypeId typeId;
+    void* (*typeKey)();
+
+    // Classes
+    lua_CFunction constructor; // Called with the instance metatable as upvalue 1. Null if there isn't one.
+    lua_CFunction gc;
+    lua_CFunction close;
+    lua_CFunction newindex; // Called with the methods table as upvalue 1.
+    bool closeable;
+    const detail::NativeSizeHook* (*nativeSizeHook)(); // Null unless the class has an lc::NativeSize.
+    const StaticMethod* methods;
+    std::size_t numMethods;
+
+    // Enums
+    const StaticEnumValue* values;
+    std::size_t numValues;
+};
+
+struct StaticApiInfo
+{
+    char const* name;
+    ApiId id;
+    void* (*registryKey)();
+    const StaticType* types;
+    std::size_t numTypes;
+};
+
+namespace detail
+{
+
+template <typename T_, bool Enabled_ = NativeSize<T_>::enabled>
+struct StaticNativeSizeHook { static constexpr const NativeSizeHook* (*value)() = nullptr; };
+
+template <typename T_>
+struct StaticNativeSizeHook<T_, true> { static constexpr const NativeSizeHook* (*value)() = &native_size_hook<T_>; };
+
+template <typename Api_, typename Class_, typename Factory_, typename... CtorArgs_>
+constexpr lua_CFunction static_constructor(Constructor<CtorArgs_...>)
+{
+    return &ClassLifecycle<Api_::id(), Api_::template type_id<Class_>(), Class_, Factory_,
+                           typename Api_::TypeSet>::template construct<CtorArgs_...>;
+}
+
+} // namespace detail
+
+template <typename Api_, typename Class_, typename Pointer_, Pointer_ Pointer>
+constexpr StaticMethod static_method(char const* name)
+{
+    using Wrapper = decltype(detail::make_call_wrapper<Api_::id(), Api_::template type_id<Class_>(),
+                                                       typename Api_::TypeSet>(Pointer));
+    return StaticMethod{name, detail::ScratchCall<detail::method_uses_scratch<typename Api_::TypeSet, Api_::id(), Pointer_>::value,
+                                                  &Wrapper::template call<Pointer>>::function()};
+}
+
+template <typename T_>
+constexpr StaticEnumValue static_value(char const* name, T_ value)
+{
+    return StaticEnumValue{name, (lua_Integer)value};
+}
+
+template <typename Api_, typename Class_, typename Factory_ = HeapFactory<Class_>, std::size_t NumMethods_, typename... CtorArgs_>
+constexpr StaticType static_class(char const* name, const StaticMethod (&methods)[NumMethods_],
+                                  Constructor<CtorArgs_...> constructor)
+{
+    return StaticType{name, detail::TYPE_KIND_CLASS, Api_::template type_id<Class_>(), &detail::TypeKey<Class_>::value,
+                      detail::static_constructor<Api_, Class_, Factory_>(constructor),
+                      &detail::ClassLifecycle<Api_::id(), Api_::template type_id<Class_>(), Class_, Factory_,
+                                              typename Api_::TypeSet>::gc,
+                      &detail::ClassLifecycle<Api_::id(), Api_::template type_id<Class_>(), Class_, Factory_,
+                                              typename Api_::TypeSet>::close,
+                      &detail::instance_newindex<std::is_base_of<DirectorBase, Class_>::value>,
+                      false,
+                      detail::StaticNativeSizeHook<Class_>::value,
+                      methods, NumMethods_,
+                      nullptr, 0};
+}
+
+//! A class that can't be constructed from Lua, only pushed from C++.
+template <typename Api_, typename Class_, typename Factory_ = HeapFactory<Class_>, std::size_t NumMethods_>
+constexpr StaticType static_class(char const* name, const StaticMethod (&methods)[NumMethods_])
+{
+    return StaticType{name, detail::TYPE_KIND_CLASS, Api_::template type_id<Class_>(), &detail::TypeKey<Class_>::value,
+                      nullptr,
+                      &detail::ClassLifecycle<Api_::id(), Api_::template type_id<Class_>(), Class_, Factory_,
+                                              typename Api_::TypeSet>::gc,
+                      &detail::ClassLifecycle<Api_::id(), Api_::template type_id<Class_>(), Class_, Factory_,
+                                              typename Api_::TypeSet>::close,
+                      &detail::instance_newindex<std::is_base_of<DirectorBase, Class_>::value>,
+                      false,
+                      detail::StaticNativeSizeHook<Class_>::value,
+                      methods, NumMethods_,
+                      nullptr, 0};
+}
+
+template <typename Api_, typename Enum_, std::size_t NumValues_>
+constexpr StaticType static_enum(char const* name, const StaticEnumValue (&values)[NumValues_])
+{
+    return StaticType{name, detail::TYPE_KIND_ENUM, Api_::template type_id<Enum_>(), &detail::TypeKey<Enum_>::value,
+                      nullptr, nullptr, nullptr, nullptr, false, nullptr, nullptr, 0,
+                      values, NumValues_};
+}
+
+//! Lets scripts free instances of a static class with to-be-closed variables, like TypeExporter::enable_close().
+constexpr StaticType enable_close(const StaticType& type)
+{
+    return StaticType{type.name, type.kind, type.typeId, type.typeKey,
+                      type.constructor, type.gc, type.close, type.newindex, true,
+                      type.nativeSizeHook, type.methods, type.numMethods,
+                      type.values, type.numValues};
+}
+
+template <typename Api_, std::size_t NumTypes_>
+constexpr StaticApiInfo static_api(char const* name, const StaticType (&types)[NumTypes_])
+{
+    static_assert(NumTypes_ == Api_::TypeSet::size(), "(LC): A static API needs exactly one StaticType per type in its type list.");
+    return StaticApiInfo{name, Api_::id(), &detail::TypeRegistryKey<Api_::id()>::value, types, NumTypes_};
+}
+
+namespace detail
+{
+
+//! [-2]: type registry
+//! [-1]: API table
+inline void export_static_class(lua_State* L, const StaticType& type, int typeRegistry)
+{
+    lua_createtable(L, 0, 0); // class table
+    lua_createtable(L, 0, 4); // instance metatable
+    lua_createtable(L, 0, (int)type.numMethods); // methods table
+    for (std::size_t i = 0; i < type.numMethods; i++) {
+        lua_pushcfunction(L, type.methods[i].function);
+        lua_setfield(L, -2, type.methods[i].name);
+    }
+
+    // [-3]: class table
+    // [-2]: instance metatable
+    // [-1]: methods table
+    lua_pushvalue(L, -1);
+    lua_pushcclosure(L, &instance_index, 1);
+    lua_setfield(L, -3, "__index");
+    lua_pushcclosure(L, type.newindex, 1);
+    lua_setfield(L, -2, "__newindex");
+    lua_pushcfunction(L, type.gc);
+    lua_setfield(L, -2, "__gc");
+    if (type.closeable) {
+        lua_pushcfunction(L, type.close);
+        lua_setfield(L, -2, "__close");
+    }
+    if (type.nativeSizeHook) {
+        lua_pushlightuserdata(L, (void*)type.nativeSizeHook());
+        lua_rawsetp(L, -2, NativeSizeHook::key());
+    }
+
+    if (type.constructor) {
+        lua_createtable(L, 0, 1); // class metatable
+        lua_pushvalue(L, -2);
+        lua_pushcclosure(L, type.constructor, 1);
+        lua_setfield(L, -2, "__call");
+        lua_setmetatable(L, -3);
+    }
+
+    // [-2]: class table
+    // [-1]: instance metatable
+    lua_rawseti(L, typeRegistry, (lua_Integer)type.typeId + 1);
+    lua_setfield(L, -2, type.name);
+}
+
+inline void export_static_enum(lua_State* L, const StaticType& type, ApiId apiId)
+{
+    lua_createtable(L, 0, (int)type.numValues);
+    for (std::size_t i = 0; i < type.numValues; i++) {
+        EnumClassContents* contents = (EnumClassContents*)detail::new_userdata(L, sizeof(EnumClassContents), 0);
+        contents->apiId = apiId;
+        contents->typeId = type.typeId;
+        contents->value = type.values[i].value;
+        lua_setfield(L, -2, type.values[i].name);
+    }
+    lua_setfield(L, -2, type.name);
+}
+
+} // namespace detail
+
+//! Exports a static API, the same way lc::Api::export_to() would.
+inline void export_static_api(lua_State* L, const StaticApiInfo& api)
+{
+    lua_createtable(L, (int)api.numTypes, (int)api.numTypes); // type registry
+    int typeRegistry = lua_gettop(L);
+
+    // If the API is named, push/use a new table. Otherwise, just use the global table.
+    bool named = api.name && *api.name;
+    if (named) lua_createtable(L, 0, (int)api.numTypes);
+    else lua_pushglobaltable(L);
+
+    for (std::size_t i = 0; i < api.numTypes; i++) {
+        const StaticType& type = api.types[i];
+        if (type.kind == detail::TYPE_KIND_CLASS) detail::export_static_class(L, type, typeRegistry);
+        else detail::export_static_enum(L, type, api.id);
+
+        lua_pushinteger(L, (lua_Integer)type.typeId);
+        lua_rawsetp(L, typeRegistry, type.typeKey());
+    }
+
+    if (named) lua_setglobal(L, api.name);
+    else lua_pop(L, 1);
+
+    lua_pushvalue(L, typeRegistry);
+    lua_rawsetp(L, LUA_REGISTRYINDEX, api.registryKey());
+    detail::register_api(L, typeRegistry, api.id);
+    lua_pop(L, 1);
+}
+
+} // namespace lc
+
+#endif // LC_STATIC_HPP
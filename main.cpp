@@ -1,6 +1,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <lc/lc.hpp>
+#include <lc/lc_event.hpp>
 
 using namespace std;
 
@@ -8,10 +9,17 @@ class Factory;
 
 struct Bar
 {
+    static int alive;
+
     int one = 1;
     int two = 2;
+
+    Bar() { alive++; }
+    ~Bar() { alive--; }
 };
 
+int Bar::alive = 0;
+
 enum class TestEnum1
 {
     ONE,
@@ -71,13 +79,29 @@ int main()
         lc::enum_value("THREE", TestEnum2::THREE)
     );
 
+    // The script subscribes to these. Events that point to classes are borrowed, so C++ keeps owning them.
+    lc::EventBus<lc::TypeSet<lc::Class<Foo>, lc::Class<Bar>, lc::Enum<TestEnum1>, lc::Enum<TestEnum2>>> events("Events");
+    auto& barEvents = events.add_event<Bar*>("bar");
+
     lua_State* L = luaL_newstate();
     luaL_openlibs(L);
     api.export_to(L);
+    events.export_to(L);
 
     luaL_dofile(L, "scripts/test.lua");
     if (lua_gettop(L)) printf("Error: %s\n", lua_tostring(L, -1));
+
+    Bar* kept = new Bar();
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    int alive = Bar::alive;
+    barEvents.post(kept);
+    events.flush(L);
+    lua_gc(L, LUA_GCCOLLECT, 0);
+    bool borrowed = Bar::alive == alive;
+    printf(borrowed ? "Events kept their Bar\n" : "Error: an event's Bar was freed by Lua\n");
+
     lua_close(L);
+    if (borrowed) delete kept;
 
-    return EXIT_SUCCESS;
+    return borrowed ? EXIT_SUCCESS : EXIT_FAILURE;
 }
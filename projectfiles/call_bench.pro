@@ -0,0 +1,33 @@
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+CONFIG -= qt
+
+# Build with qmake "COMPACT=1" for compact method wrappers. scripts/call_bench.sh builds both.
+!isEmpty(COMPACT): DEFINES += LC_COMPACT_BINDINGS
+# And with "RECORD=1" to be able to record calls with "call_bench record <path>".
+!isEmpty(RECORD): DEFINES += LC_RECORD_CALLS
+# And with e.g. "LUA_DIR=D:/projects/middleware/lua-5.4.6 LUA_LIB=lua54" to build against another Lua.
+isEmpty(LUA_DIR): LUA_DIR = D:/projects/middleware/lua-5.3.3
+isEmpty(LUA_LIB): LUA_LIB = lua53
+
+QMAKE_CXXFLAGS += -std=c++11 -Wno-missing-field-initializers -fno-rtti -fno-exceptions
+
+HEADERS += \
+           include/lc/lc.hpp \
+           include/lc/lc_compact.hpp \
+           include/lc/lc_gc.hpp \
+           include/lc/lc_record.hpp \
+           include/lc/lc_scratch.hpp \
+           include/lc/detail/lc_common.hpp \
+           include/lc/detail/lc_memory.hpp \
+           include/lc/detail/lc_scratch.hpp \
+           include/lc/detail/lc_utility.hpp \
+           include/lc/detail/lc_stack.hpp
+
+SOURCES += bench/call_bench.cpp
+
+INCLUDEPATH += include
+INCLUDEPATH += $$LUA_DIR/include/
+
+LIBS += -L"$$LUA_DIR/" -l$$LUA_LIB
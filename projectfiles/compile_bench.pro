@@ -0,0 +1,25 @@
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+CONFIG -= qt
+
+# Number of types in the generated API, e.g. qmake "BENCH_TYPES=1000".
+# scripts/compile_bench.sh builds 50, 200 and 1000 in one go.
+isEmpty(BENCH_TYPES): BENCH_TYPES = 200
+DEFINES += LC_BENCH_TYPES=$$BENCH_TYPES
+
+QMAKE_CXXFLAGS += -std=c++11 -Wno-missing-field-initializers -fno-rtti -fno-exceptions
+
+HEADERS += \
+           include/lc/lc.hpp \
+           include/lc/detail/lc_common.hpp \
+           include/lc/detail/lc_memory.hpp \
+           include/lc/detail/lc_utility.hpp \
+           include/lc/detail/lc_stack.hpp
+
+SOURCES += bench/compile_bench.cpp
+
+INCLUDEPATH += include
+INCLUDEPATH += D:/projects/middleware/lua-5.3.3/include/
+
+LIBS += -L"D:/projects/middleware/lua-5.3.3/" -llua53
@@ -7,7 +7,26 @@ QMAKE_CXXFLAGS += -std=c++11 -Wno-missing-field-initializers -Winline -fno-rtti
 
 HEADERS += \
            include/lc/lc.hpp \
+           include/lc/lc_async.hpp \
+           include/lc/lc_batch.hpp \
+           include/lc/lc_bundle.hpp \
+           include/lc/lc_callable.hpp \
+           include/lc/lc_cache.hpp \
+           include/lc/lc_channel.hpp \
+           include/lc/lc_compact.hpp \
+           include/lc/lc_container.hpp \
+           include/lc/lc_director.hpp \
+           include/lc/lc_event.hpp \
+           include/lc/lc_gc.hpp \
+           include/lc/lc_handle.hpp \
+           include/lc/lc_range.hpp \
+           include/lc/lc_record.hpp \
+           include/lc/lc_scratch.hpp \
+           include/lc/lc_snapshot.hpp \
+           include/lc/lc_static.hpp \
            include/lc/detail/lc_common.hpp \
+           include/lc/detail/lc_memory.hpp \
+           include/lc/detail/lc_scratch.hpp \
            include/lc/detail/lc_utility.hpp \
            include/lc/detail/lc_stack.hpp \
            include/lc/detail/lc_storage.hpp
@@ -0,0 +1,25 @@
+TEMPLATE = app
+CONFIG += console
+CONFIG -= app_bundle
+CONFIG -= qt
+
+# Build with e.g. "LUA_DIR=D:/projects/middleware/lua-5.4.6 LUA_LIB=lua54" to build against another Lua.
+isEmpty(LUA_DIR): LUA_DIR = D:/projects/middleware/lua-5.3.3
+isEmpty(LUA_LIB): LUA_LIB = lua53
+
+QMAKE_CXXFLAGS += -std=c++11 -Wno-missing-field-initializers -fno-rtti -fno-exceptions
+
+HEADERS += \
+           include/lc/lc.hpp \
+           include/lc/lc_snapshot.hpp \
+           include/lc/detail/lc_common.hpp \
+           include/lc/detail/lc_memory.hpp \
+           include/lc/detail/lc_utility.hpp \
+           include/lc/detail/lc_stack.hpp
+
+SOURCES += bench/snapshot_bench.cpp
+
+INCLUDEPATH += include
+INCLUDEPATH += $$LUA_DIR/include/
+
+LIBS += -L"$$LUA_DIR/" -l$$LUA_LIB
@@ -0,0 +1,32 @@
+#!/bin/sh
+# Builds bench/call_bench.cpp with inlined and with compact method wrappers, and reports
+# the size of each wrapper set and, if the benchmark links, its call latencies.
+#
+# Usage: scripts/call_bench.sh [lua include dir] [lua libraries]
+# CXX and CXXFLAGS are taken from the environment.
+
+cd "$(dirname "$0")/.." || exit 1
+
+LUA_INCLUDE=${1:-/usr/include/lua5.3}
+LUA_LIBS=${2:--llua5.3}
+CXX=${CXX:-g++}
+CXXFLAGS=${CXXFLAGS:--O2}
+OUT=${TMPDIR:-/tmp}/lc_call_bench
+
+mkdir -p "$OUT" || exit 1
+
+for mode in inline compact; do
+    defines=
+    [ "$mode" = compact ] && defines=-DLC_COMPACT_BINDINGS
+
+    $CXX -std=c++11 -fno-rtti -fno-exceptions $CXXFLAGS -Iinclude -I"$LUA_INCLUDE" \
+         $defines -c bench/call_bench.cpp -o "$OUT/call_$mode.o" || exit 1
+    text=$(size "$OUT/call_$mode.o" | awk 'NR == 2 { print $1 }')
+    echo "$mode: $text text bytes"
+
+    if $CXX "$OUT/call_$mode.o" $LUA_LIBS -o "$OUT/call_$mode" 2> /dev/null; then
+        "$OUT/call_$mode"
+    else
+        echo "(not linked against $LUA_LIBS, so not run)"
+    fi
+done
@@ -0,0 +1,27 @@
+#!/bin/sh
+# Compiles bench/compile_bench.cpp with APIs of 50, 200 and 1000 types and reports
+# the compile time and object size of each, which should grow close to linearly.
+#
+# Usage: scripts/compile_bench.sh [lua include dir] [sizes...]
+# CXX and CXXFLAGS are taken from the environment.
+
+cd "$(dirname "$0")/.." || exit 1
+
+LUA_INCLUDE=${1:-/usr/include/lua5.3}
+[ $# -gt 0 ] && shift
+SIZES=${*:-50 200 1000}
+CXX=${CXX:-g++}
+CXXFLAGS=${CXXFLAGS:--O2}
+OUT=${TMPDIR:-/tmp}/lc_compile_bench
+
+mkdir -p "$OUT" || exit 1
+printf '%8s %10s %12s\n' types seconds text-bytes
+
+for n in $SIZES; do
+    start=$(date +%s.%N)
+    $CXX -std=c++11 -fno-rtti -fno-exceptions $CXXFLAGS -Iinclude -I"$LUA_INCLUDE" \
+         -DLC_BENCH_TYPES="$n" -c bench/compile_bench.cpp -o "$OUT/bench_$n.o" || exit 1
+    end=$(date +%s.%N)
+    text=$(size "$OUT/bench_$n.o" | awk 'NR == 2 { print $1 }')
+    printf '%8s %10.2f %12s\n' "$n" "$(awk "BEGIN { print $end - $start }")" "$text"
+done
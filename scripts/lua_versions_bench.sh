@@ -0,0 +1,39 @@
+#!/bin/sh
+# Builds bench/call_bench.cpp against Lua 5.3 and Lua 5.4 and runs both, and the 5.4 build once
+# more with the generational collector, to compare call latencies between the versions.
+#
+# Usage: scripts/lua_versions_bench.sh [5.3 include dir] [5.3 libraries] [5.4 include dir] [5.4 libraries]
+# CXX and CXXFLAGS are taken from the environment; add -DLC_COMPACT_BINDINGS to CXXFLAGS to compare
+# compact wrappers instead.
+
+cd "$(dirname "$0")/.." || exit 1
+
+LUA53_INCLUDE=${1:-/usr/include/lua5.3}
+LUA53_LIBS=${2:--llua5.3}
+LUA54_INCLUDE=${3:-/usr/include/lua5.4}
+LUA54_LIBS=${4:--llua5.4}
+CXX=${CXX:-g++}
+CXXFLAGS=${CXXFLAGS:--O2}
+OUT=${TMPDIR:-/tmp}/lc_lua_versions_bench
+
+mkdir -p "$OUT" || exit 1
+
+for version in 5.3 5.4; do
+    if [ "$version" = 5.3 ]; then
+        include=$LUA53_INCLUDE
+        libs=$LUA53_LIBS
+    else
+        include=$LUA54_INCLUDE
+        libs=$LUA54_LIBS
+    fi
+
+    exe="$OUT/call_bench_$version"
+    if ! $CXX -std=c++11 -fno-rtti -fno-exceptions $CXXFLAGS -Iinclude -I"$include" \
+              bench/call_bench.cpp $libs -o "$exe"; then
+        echo "(couldn't build against Lua $version in $include with $libs)"
+        continue
+    fi
+
+    "$exe"
+    [ "$version" = 5.4 ] && "$exe" generational
+done
@@ -6,3 +6,10 @@ local b = foo:make_bar(bar, 1, 2, 3, 4)
 
 local TestEnum1 = TestApi.TestEnum1
 foo:test_enum(TestEnum1.ONE)
+
+local seen = 0
+Events:subscribe("bar", function(batch)
+    for i = 1, #batch do
+        if batch[i].one == 1 then seen = seen + 1 end
+    end
+end)